@@ -34,37 +34,552 @@
 #define avl_idx2cmp(idx) (!(idx)?-1:1)
 
 /*
- * Generic search routine for AVL tree
- *
- * The key parameter needs not to be a valid AVL node, we only use it as an
- * parameter to cmpfunc.
+ * If AVL_PREFETCH is defined, the descent loops prefetch both children of a
+ * node before comparing the key with it, so that the next level is on its way
+ * to the cache while the comparison routine runs. The data the comparison
+ * routine reads out of the nodes is prefetched by the avl_prefetch_t routine
+ * given to the _prefetch forms of search and insertion, if any.
+ */
+#ifdef AVL_PREFETCH
+#define avl_prefetch_children(node) do {				\
+	__builtin_prefetch((node)->avl_children[0]);			\
+	__builtin_prefetch((node)->avl_children[1]);			\
+} while (0)
+#else
+#define avl_prefetch_children(node) do { } while (0)
+#endif
+
+/*
+ * If AVL_RCU is defined, the links followed by lookups are published with
+ * release stores and read with acquire loads. Insertion, removal and rotations
+ * change them in an order such that a lookup running concurrently with a
+ * writer always sees an acyclic binary search tree, though possibly with some
+ * nodes temporarily out of reach. See avl_rcu.h.
+ */
+#ifdef AVL_RCU
+#define avl_store_link(link, node) \
+	__atomic_store_n(&(link), (node), __ATOMIC_RELEASE)
+#define avl_load_link(link) __atomic_load_n(&(link), __ATOMIC_ACQUIRE)
+#else
+#define avl_store_link(link, node) ((link) = (node))
+#define avl_load_link(link) (link)
+#endif
+
+/*
+ * If AVL_STATS is defined, every thread counts the work done on its behalf,
+ * see avl_stats_get(). Otherwise the counting compiles to nothing.
+ */
+#ifdef AVL_STATS
+static __thread avl_stats_t avl_stats;
+
+#define avl_stat_add(field, n) ((void)(avl_stats.field += (n)))
+#define avl_stat_descent(depth) avl_stat_record_descent(depth)
+
+static inline void
+avl_stat_record_descent(unsigned long depth)
+{
+	avl_stats.avl_descents++;
+	avl_stats.avl_depth_sum += depth;
+	if (avl_stats.avl_depth_max < depth)
+		avl_stats.avl_depth_max = depth;
+}
+#else
+#define avl_stat_add(field, n) ((void)0)
+#define avl_stat_descent(depth) ((void)(depth))
+#endif
+
+/* Call a comparison routine, counting the call */
+#define avl_compare(fn, a, b) (avl_stat_add(avl_compares, 1), (fn)((a), (b)))
+
+/*
+ * Recompute the subtree size and the augmented data of a node from its
+ * children.
+ */
+static inline void
+avl_update(avl_root_t *avlroot, avl_node_t *node)
+{
+#ifdef AVL_ORDER_STATISTICS
+	node->avl_size = 1 + avl_subtree_size(node->avl_children[0]) +
+	    avl_subtree_size(node->avl_children[1]);
+#endif
+#ifdef AVL_AUGMENT
+	if (avlroot->avl_augment)
+		avlroot->avl_augment(node);
+#else
+	(void)avlroot;
+	(void)node;
+#endif
+}
+
+/*
+ * Propagate the augmented data from the given node up to the root.
  *
- * Return either NULL if the node with corresponding key is not found, or
- * pointer to the node with corresponding key
+ * Every node up to and including stop is recomputed unconditionally. Beyond
+ * that, the propagation ends at the first node whose augmented data does not
+ * change, as none of its ancestors can change either.
  */
-avl_node_t *
-avl_search(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc)
+#ifdef AVL_AUGMENT
+static void
+avl_propagate(avl_root_t *avlroot, avl_node_t *node, avl_node_t *stop)
+{
+	avl_augment_t *augment = avlroot->avl_augment;
+
+	if (!augment)
+		return;
+
+	for (; node; node = avl_get_parent(node)) {
+		int changed;
+
+		changed = augment(node);
+		if (node == stop)
+			stop = NULL;
+		else if (!stop && !changed)
+			break;
+	}
+}
+#else
+static inline void
+avl_propagate(avl_root_t *avlroot, avl_node_t *node, avl_node_t *stop)
+{
+	(void)avlroot;
+	(void)node;
+	(void)stop;
+}
+#endif
+
+/*
+ * Initialize an empty tree sharing the augmentation routine of another one
+ */
+static inline void
+avl_root_like(avl_root_t *avlroot, const avl_root_t *like)
+{
+	avlroot->avl_root = NULL;
+#ifdef AVL_AUGMENT
+	avlroot->avl_augment = like->avl_augment;
+#else
+	(void)like;
+#endif
+}
+
+/*
+ * Adjust the subtree size of every node from the given node up to the root.
+ */
+static inline void
+avl_adjust_size(avl_node_t *node, int delta)
+{
+#ifdef AVL_ORDER_STATISTICS
+	for (; node; node = avl_get_parent(node))
+		node->avl_size += delta;
+#else
+	(void)node;
+	(void)delta;
+#endif
+}
+
+/*
+ * Search key that is either a node compared by avl_cmp_t, or a bare key
+ * compared by avl_keycmp_t
+ */
+struct avl_key {
+	const void *key;
+	avl_cmp_t *cmpfunc;
+	avl_keycmp_t *keycmp;
+};
+
+static inline int
+avl_key_cmp(const struct avl_key *key, avl_node_t *node)
+{
+	if (key->cmpfunc)
+		return avl_compare(key->cmpfunc, (avl_node_t *)key->key, node);
+	return avl_compare(key->keycmp, key->key, node);
+}
+
+/*
+ * Call the user prefetch routine, if any, on the children of node
+ */
+static inline void
+avl_prefetch_user(avl_node_t *node, avl_prefetch_t *prefetch)
+{
+	avl_node_t *child;
+
+	if (!prefetch)
+		return;
+	if ((child = avl_load_link(node->avl_children[0])))
+		prefetch(child);
+	if ((child = avl_load_link(node->avl_children[1])))
+		prefetch(child);
+}
+
+static inline avl_node_t *
+avl_search_internal(avl_root_t *avlroot, const struct avl_key *key,
+    avl_prefetch_t *prefetch)
 {
+	unsigned long depth = 0;
 	avl_node_t *retval;
-	
+
 	/*
 	 * Do the AVL lookup as normal binary search tree.
 	 */
-	retval = avlroot->avl_root;
+	retval = avl_load_link(avlroot->avl_root);
+	if (retval && prefetch)
+		prefetch(retval);
 	while (retval) {
 		int cmp;
 
-		cmp = cmpfunc(key, retval);
+		avl_prefetch_children(retval);
+		avl_prefetch_user(retval, prefetch);
+		depth++;
+		cmp = avl_key_cmp(key, retval);
 		if (!cmp)
 			/* The node with exact key is found, so we leave the
 			 * loop */
 			break;
-		retval = retval->avl_children[avl_cmp2idx(cmp)];
+		retval = avl_load_link(retval->avl_children[avl_cmp2idx(cmp)]);
 	}
 
+	avl_stat_descent(depth);
 	return retval;
 }
 
+/*
+ * Generic search routine for AVL tree
+ *
+ * The key parameter needs not to be a valid AVL node, we only use it as an
+ * parameter to cmpfunc.
+ *
+ * Return either NULL if the node with corresponding key is not found, or
+ * pointer to the node with corresponding key
+ */
+avl_node_t *
+avl_search(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc)
+{
+	struct avl_key k = { key, cmpfunc, NULL };
+
+	return avl_search_internal(avlroot, &k, NULL);
+}
+
+/*
+ * Search routine for AVL tree with a bare key
+ *
+ * Same as avl_search(), except that the key is passed to keycmp as it is, so
+ * the caller does not need to wrap the key into a node.
+ *
+ * Return either NULL if the node with corresponding key is not found, or
+ * pointer to the node with corresponding key
+ */
+avl_node_t *
+avl_search_key(avl_root_t *avlroot, const void *key, avl_keycmp_t *keycmp)
+{
+	struct avl_key k = { key, NULL, keycmp };
+
+	return avl_search_internal(avlroot, &k, NULL);
+}
+
+/*
+ * Same as avl_search() and avl_search_key(), except that prefetch is called
+ * with both children of every node before the key is compared with it, so
+ * that the data the comparison routine reads for the next level is on its way
+ * to the cache while it runs.
+ */
+avl_node_t *
+avl_search_prefetch(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc,
+    avl_prefetch_t *prefetch)
+{
+	struct avl_key k = { key, cmpfunc, NULL };
+
+	return avl_search_internal(avlroot, &k, prefetch);
+}
+
+avl_node_t *
+avl_search_key_prefetch(avl_root_t *avlroot, const void *key,
+    avl_keycmp_t *keycmp, avl_prefetch_t *prefetch)
+{
+	struct avl_key k = { key, NULL, keycmp };
+
+	return avl_search_internal(avlroot, &k, prefetch);
+}
+
+/* Number of lookups in flight in avl_search_many() */
+#define AVL_SEARCH_GROUP 8
+
+/*
+ * Batched search routine for AVL tree
+ *
+ * Look up each of the @n keys as avl_search_key() does, and store the result
+ * of keys[i] in out[i]. Up to AVL_SEARCH_GROUP lookups are in progress at a
+ * time, each one advancing by one level in turn. The node a lookup is about
+ * to visit is prefetched (with @prefetch as well, if it is not NULL), so that
+ * the cache misses of all the lookups in the group overlap instead of being
+ * taken one after another.
+ */
+void
+avl_search_many(avl_root_t *avlroot, const void *const *keys, size_t n,
+    avl_keycmp_t *keycmp, avl_prefetch_t *prefetch, avl_node_t **out)
+{
+	struct {
+		size_t i;
+		avl_node_t *cur;
+	} group[AVL_SEARCH_GROUP];
+	int s, active;
+	size_t next;
+	avl_node_t *root;
+
+	root = avl_load_link(avlroot->avl_root);
+	if (!root) {
+		for (next = 0; next < n; ++next)
+			out[next] = NULL;
+		return;
+	}
+
+	for (active = 0; active < AVL_SEARCH_GROUP && active < (int)n;
+	    ++active) {
+		group[active].i = active;
+		group[active].cur = root;
+	}
+	next = active;
+
+	while (active) {
+		for (s = 0; s < active; ) {
+			int cmp;
+			avl_node_t *node = group[s].cur;
+
+			cmp = avl_compare(keycmp, keys[group[s].i], node);
+			if (cmp)
+				node = avl_load_link(
+				    node->avl_children[avl_cmp2idx(cmp)]);
+			if (cmp && node) {
+				__builtin_prefetch(node);
+				if (prefetch)
+					prefetch(node);
+				group[s++].cur = node;
+				continue;
+			}
+
+			/* The lookup is over, start the next one in its
+			 * place, or drop it from the group */
+			out[group[s].i] = node;
+			if (next < n) {
+				group[s].i = next++;
+				group[s++].cur = root;
+			} else {
+				group[s] = group[--active];
+			}
+		}
+	}
+}
+
+/*
+ * Generic bound search routine for AVL tree
+ *
+ * Find the nearest node on the side of the key given by direction, that is,
+ * the first node following the key if the direction is 1 (right), or the last
+ * node preceding the key if the direction is -1 (left). If inclusive is
+ * non-zero, a node equal to the key also qualifies.
+ *
+ * The lookup is done in a single descent. Every node qualifying on the way
+ * down is closer to the key than the previous candidate, thus the last one
+ * found is the answer.
+ *
+ * Return either a valid AVL node or NULL.
+ */
+static avl_node_t *
+avl_bound(avl_root_t *avlroot, const struct avl_key *key, int dir,
+    int inclusive)
+{
+	int which_child;
+	avl_node_t *cur, *candidate;
+
+	which_child = avl_cmp2idx(dir);
+	candidate = NULL;
+	cur = avl_load_link(avlroot->avl_root);
+	while (cur) {
+		int cmp, qualified;
+
+		avl_prefetch_children(cur);
+		cmp = avl_key_cmp(key, cur);
+		if (!cmp)
+			qualified = inclusive;
+		else
+			qualified = avl_cmp2idx(cmp) != which_child;
+
+		if (qualified) {
+			/* A closer candidate may reside in the subtree
+			 * towards the key */
+			candidate = cur;
+			cur = avl_load_link(cur->avl_children[!which_child]);
+		} else {
+			cur = avl_load_link(cur->avl_children[which_child]);
+		}
+	}
+
+	return candidate;
+}
+
+/*
+ * Find the first node whose key is not less than the given key.
+ *
+ * Return either a valid AVL node or NULL.
+ */
+avl_node_t *
+avl_lower_bound(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc)
+{
+	struct avl_key k = { key, cmpfunc, NULL };
+
+	return avl_bound(avlroot, &k, 1, 1);
+}
+
+/*
+ * Find the first node whose key is greater than the given key.
+ *
+ * Return either a valid AVL node or NULL.
+ */
+avl_node_t *
+avl_upper_bound(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc)
+{
+	struct avl_key k = { key, cmpfunc, NULL };
+
+	return avl_bound(avlroot, &k, 1, 0);
+}
+
+/*
+ * Find the last node whose key is not greater than the given key.
+ *
+ * Return either a valid AVL node or NULL.
+ */
+avl_node_t *
+avl_floor(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc)
+{
+	struct avl_key k = { key, cmpfunc, NULL };
+
+	return avl_bound(avlroot, &k, -1, 1);
+}
+
+/*
+ * Find the first node whose key is not less than the given key, which is the
+ * counterpart of avl_floor() and the same as avl_lower_bound().
+ *
+ * Return either a valid AVL node or NULL.
+ */
+avl_node_t *
+avl_ceil(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc)
+{
+	return avl_lower_bound(avlroot, key, cmpfunc);
+}
+
+/*
+ * Bare key counterparts of the bound search routines above
+ */
+avl_node_t *
+avl_lower_bound_key(avl_root_t *avlroot, const void *key, avl_keycmp_t *keycmp)
+{
+	struct avl_key k = { key, NULL, keycmp };
+
+	return avl_bound(avlroot, &k, 1, 1);
+}
+
+avl_node_t *
+avl_upper_bound_key(avl_root_t *avlroot, const void *key, avl_keycmp_t *keycmp)
+{
+	struct avl_key k = { key, NULL, keycmp };
+
+	return avl_bound(avlroot, &k, 1, 0);
+}
+
+avl_node_t *
+avl_floor_key(avl_root_t *avlroot, const void *key, avl_keycmp_t *keycmp)
+{
+	struct avl_key k = { key, NULL, keycmp };
+
+	return avl_bound(avlroot, &k, -1, 1);
+}
+
+avl_node_t *
+avl_ceil_key(avl_root_t *avlroot, const void *key, avl_keycmp_t *keycmp)
+{
+	return avl_lower_bound_key(avlroot, key, keycmp);
+}
+
+/*
+ * Find both ends of the nodes whose keys are equal to the key in a single
+ * descent: the bounds share the path down to the first such node, below which
+ * the lower bound is in its left subtree and the upper bound in its right one.
+ */
+static avl_node_t *
+avl_equal_range_internal(avl_root_t *avlroot, const struct avl_key *key,
+    avl_node_t **end)
+{
+	int cmp;
+	avl_node_t *cur, *lower, *upper;
+
+	lower = upper = NULL;
+	cur = avl_load_link(avlroot->avl_root);
+	while (cur) {
+		avl_prefetch_children(cur);
+		cmp = avl_key_cmp(key, cur);
+		if (!cmp)
+			break;
+		if (cmp < 0)
+			lower = upper = cur;
+		cur = avl_load_link(cur->avl_children[avl_cmp2idx(cmp)]);
+	}
+
+	if (cur) {
+		avl_node_t *node;
+
+		lower = cur;
+		node = avl_load_link(cur->avl_children[0]);
+		while (node) {
+			avl_prefetch_children(node);
+			if (avl_key_cmp(key, node) <= 0) {
+				lower = node;
+				node = avl_load_link(node->avl_children[0]);
+			} else {
+				node = avl_load_link(node->avl_children[1]);
+			}
+		}
+		node = avl_load_link(cur->avl_children[1]);
+		while (node) {
+			avl_prefetch_children(node);
+			if (avl_key_cmp(key, node) < 0) {
+				upper = node;
+				node = avl_load_link(node->avl_children[0]);
+			} else {
+				node = avl_load_link(node->avl_children[1]);
+			}
+		}
+	}
+
+	*end = upper;
+	return lower;
+}
+
+/*
+ * Find the nodes whose keys are equal to the given key, e.g. in a tree built
+ * with avl_insert_multi()
+ *
+ * Return the first node whose key is not less than the key, and set end to the
+ * first node whose key is greater, either of which may be NULL. The nodes
+ * equal to the key are those from the former up to, but not including, the
+ * latter.
+ */
+avl_node_t *
+avl_equal_range(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc,
+    avl_node_t **end)
+{
+	struct avl_key k = { key, cmpfunc, NULL };
+
+	return avl_equal_range_internal(avlroot, &k, end);
+}
+
+avl_node_t *
+avl_equal_range_key(avl_root_t *avlroot, const void *key, avl_keycmp_t *keycmp,
+    avl_node_t **end)
+{
+	struct avl_key k = { key, NULL, keycmp };
+
+	return avl_equal_range_internal(avlroot, &k, end);
+}
+
 /*
  * Find the predecessor or successor of the current node based on direction
  * given.
@@ -86,10 +601,10 @@ avl_prev_next(avl_node_t *node, int dir)
 			node = node->avl_children[!which_child];
 		return node;
 	}
-	parent = node->avl_parent;
+	parent = avl_get_parent(node);
 	while (parent && parent->avl_children[which_child] == node) {
 		node = parent;
-		parent = node->avl_parent;
+		parent = avl_get_parent(node);
 	}
 	return parent;
 }
@@ -160,66 +675,251 @@ avl_next(avl_node_t *node)
 }
 
 /*
- * Subtree rebalancing routine
+ * Prefetch the subtree a cursor moves into next when leaving its current node
+ * in the given direction, while the caller is busy with the node.
  *
- * Whenever the balancing factor of node goes beyond 1 or -1, we need to
- * rebalance the subtree rooted at the given node so that the balancing factor
- * will be restored to within -1 and 1.
- * 
- * Return 0 if the height of the tree does not change, otherwise return 1 (The
- * tree can only shrink in height by one unit in that case) .
+ * Only the root of that subtree is prefetched, not its leftmost or rightmost
+ * spine: the address of each node down the spine is only known once its
+ * parent has been loaded, so walking it here would stall on the very misses
+ * the prefetch is meant to hide.
  */
-static int
-avl_rebalance(avl_root_t *avlroot, avl_node_t *node)
+static inline void
+avl_cursor_prefetch(avl_cursor_t *cursor, int which_child)
 {
-	int which_child;
-	avl_node_t *child;
+	avl_node_t *node = avl_cursor_get(cursor);
 
-	which_child = avl_balance2idx(node->avl_balance);
-	child = node->avl_children[which_child];
+	if (node && node->avl_children[which_child])
+		__builtin_prefetch(node->avl_children[which_child]);
+}
 
-	if (node->avl_balance == child->avl_balance) {
-		avl_node_t **slot;
-		avl_node_t *R, *S, *R_parent, *B;
+/*
+ * Push the nodes from the given one down to the leftmost or rightmost end of
+ * its subtree on the path of the cursor.
+ */
+static void
+avl_cursor_descend(avl_cursor_t *cursor, avl_node_t *node, int which_child)
+{
+	while (node) {
+		cursor->path[cursor->depth++] = node;
+		node = node->avl_children[which_child];
+	}
+}
 
-		/*
-		 * Case 1:
-		 * Single rotation is required
-		 *
-		 *     **R              S
-		 *      / \            / \
-		 *    *S   Y    ->    X   R
-		 *    / \ (h)       (h+1)/ \
-		 *   X   B              B   Y
+/*
+ * Position the cursor at the first or the last node based on direction given.
+ * The direction must be either -1 (left) or 1 (right).
+ */
+static avl_node_t *
+avl_cursor_end(avl_cursor_t *cursor, avl_root_t *avlroot, int dir)
+{
+	int which_child = avl_cmp2idx(dir);
+
+	cursor->depth = 0;
+	avl_cursor_descend(cursor, avlroot->avl_root, which_child);
+	avl_cursor_prefetch(cursor, !which_child);
+	return avl_cursor_get(cursor);
+}
+
+/*
+ * Position the cursor at the first node of the tree.
+ *
+ * Return either a valid AVL node or NULL.
+ */
+avl_node_t *
+avl_cursor_first(avl_cursor_t *cursor, avl_root_t *avlroot)
+{
+	return avl_cursor_end(cursor, avlroot, -1);
+}
+
+/*
+ * Position the cursor at the last node of the tree.
+ *
+ * Return either a valid AVL node or NULL.
+ */
+avl_node_t *
+avl_cursor_last(avl_cursor_t *cursor, avl_root_t *avlroot)
+{
+	return avl_cursor_end(cursor, avlroot, 1);
+}
+
+/*
+ * Position the cursor at the first node whose key is not less than the key,
+ * in O(log n) time.
+ */
+static avl_node_t *
+avl_cursor_seek_internal(avl_cursor_t *cursor, avl_root_t *avlroot,
+    const struct avl_key *key)
+{
+	int depth;
+	avl_node_t *cur;
+
+	/* The path to the candidate is a prefix of the path searched */
+	depth = 0;
+	cursor->depth = 0;
+	cur = avlroot->avl_root;
+	while (cur) {
+		avl_prefetch_children(cur);
+		cursor->path[cursor->depth++] = cur;
+		if (avl_key_cmp(key, cur) <= 0) {
+			depth = cursor->depth;
+			cur = cur->avl_children[0];
+		} else {
+			cur = cur->avl_children[1];
+		}
+	}
+	cursor->depth = depth;
+	avl_cursor_prefetch(cursor, 1);
+	return avl_cursor_get(cursor);
+}
+
+/*
+ * Position the cursor at the first node whose key is not less than the given
+ * key.
+ *
+ * Return either a valid AVL node or NULL.
+ */
+avl_node_t *
+avl_cursor_seek(avl_cursor_t *cursor, avl_root_t *avlroot, avl_node_t *key,
+    avl_cmp_t *cmpfunc)
+{
+	struct avl_key k = { key, cmpfunc, NULL };
+
+	return avl_cursor_seek_internal(cursor, avlroot, &k);
+}
+
+/*
+ * Same as avl_cursor_seek(), but with a bare key
+ */
+avl_node_t *
+avl_cursor_seek_key(avl_cursor_t *cursor, avl_root_t *avlroot,
+    const void *key, avl_keycmp_t *keycmp)
+{
+	struct avl_key k = { key, NULL, keycmp };
+
+	return avl_cursor_seek_internal(cursor, avlroot, &k);
+}
+
+/*
+ * Move the cursor to the predecessor or successor of its node based on
+ * direction given, the same way as avl_prev_next() but climbing the path
+ * instead of the parent links. Past either end, the cursor stays there.
+ * The direction must be either -1 (left) or 1 (right).
+ *
+ * Return either a valid AVL node or NULL.
+ */
+static avl_node_t *
+avl_cursor_step(avl_cursor_t *cursor, int dir)
+{
+	int which_child;
+	avl_node_t *node, *child;
+
+	which_child = avl_cmp2idx(dir);
+	node = avl_cursor_get(cursor);
+	if (!node)
+		return NULL;
+
+	if (node->avl_children[which_child]) {
+		avl_cursor_descend(cursor, node->avl_children[which_child],
+		    !which_child);
+	} else {
+		do {
+			child = cursor->path[--cursor->depth];
+		} while (cursor->depth &&
+		    cursor->path[cursor->depth - 1]->avl_children[which_child] ==
+		    child);
+	}
+	avl_cursor_prefetch(cursor, which_child);
+	return avl_cursor_get(cursor);
+}
+
+/*
+ * Move the cursor to the predecessor of its node.
+ *
+ * Return either a valid AVL node or NULL.
+ */
+avl_node_t *
+avl_cursor_prev(avl_cursor_t *cursor)
+{
+	return avl_cursor_step(cursor, -1);
+}
+
+/*
+ * Move the cursor to the successor of its node.
+ *
+ * Return either a valid AVL node or NULL.
+ */
+avl_node_t *
+avl_cursor_next(avl_cursor_t *cursor)
+{
+	return avl_cursor_step(cursor, 1);
+}
+
+/*
+ * Subtree rebalancing routine
+ *
+ * Whenever the balancing factor of node goes beyond 1 or -1, we need to
+ * rebalance the subtree rooted at the given node so that the balancing factor
+ * will be restored to within -1 and 1.
+ * 
+ * Return 0 if the height of the tree does not change, otherwise return 1 (The
+ * tree can only shrink in height by one unit in that case) .
+ */
+static int
+avl_rebalance(avl_root_t *avlroot, avl_node_t *node)
+{
+	int which_child;
+	avl_node_t *child;
+
+	which_child = avl_balance2idx(avl_get_balance(node));
+	child = node->avl_children[which_child];
+
+	if (avl_get_balance(node) == avl_get_balance(child)) {
+		avl_node_t **slot;
+		avl_node_t *R, *S, *R_parent, *B;
+
+		/*
+		 * Case 1:
+		 * Single rotation is required
+		 *
+		 *     **R              S
+		 *      / \            / \
+		 *    *S   Y    ->    X   R
+		 *    / \ (h)       (h+1)/ \
+		 *   X   B              B   Y
 		 * (h+1)(h)            (h) (h)
 		 *
 		 * Since the height of subtree is shortened in this case, the
 		 * adjustment of balance factor needs to continue at the parent
 		 * of this subtree.
 		 */
+
+		avl_stat_add(avl_rotations[0], 1);
 		
 		R = node;
 		S = child;
-		R_parent = R->avl_parent;
+		R_parent = avl_get_parent(R);
 		B = S->avl_children[!which_child];
 		if (!R_parent)
 			slot = &avlroot->avl_root;
 		else
 			slot = R_parent->avl_children + avl_which_child(R);
 
-		*slot = S;
-		S->avl_parent = R_parent;
-		
-		R->avl_parent = S;
-		S->avl_children[!which_child] = R;
-
-		R->avl_children[which_child] = B;
+		avl_store_link(R->avl_children[which_child], B);
 		if (B)
-			B->avl_parent = R;
+			avl_set_parent(B, R);
+
+		avl_set_parent(R, S);
+		avl_store_link(S->avl_children[!which_child], R);
+
+		avl_store_link(*slot, S);
+		avl_set_parent(S, R_parent);
 		
-		S->avl_balance = R->avl_balance = 0;
+		avl_set_balance(S, 0);
+		avl_set_balance(R, 0);
+		avl_update(avlroot, R);
+		avl_update(avlroot, S);
 		return 1;
-	} else if (child->avl_balance) {
+	} else if (avl_get_balance(child)) {
 		avl_node_t **slot;
 		avl_node_t *R, *S, *Q, *R_parent, *B, *C;
 
@@ -266,43 +966,48 @@ avl_rebalance(avl_root_t *avlroot, avl_node_t *node)
 		 * of this subtree.
 		 */
 
+		avl_stat_add(avl_rotations[1], 1);
+
 		R = node;
 		S = child;
 		Q = S->avl_children[!which_child];
-		R_parent = R->avl_parent;
+		R_parent = avl_get_parent(R);
 		B = Q->avl_children[!which_child];
 		C = Q->avl_children[which_child];
-		if (!R->avl_parent)
+		if (!R_parent)
 			slot = &avlroot->avl_root;
 		else
-			slot = R->avl_parent->avl_children + avl_which_child(R);
+			slot = R_parent->avl_children + avl_which_child(R);
 
-		*slot = Q;
-		Q->avl_parent = R_parent;
-		
-		R->avl_children[which_child] = B;
-		if (B)
-			B->avl_parent = R;
-		S->avl_children[!which_child] = C;
+		avl_store_link(S->avl_children[!which_child], C);
 		if (C)
-			C->avl_parent = S;
+			avl_set_parent(C, S);
+		avl_store_link(R->avl_children[which_child], B);
+		if (B)
+			avl_set_parent(B, R);
 		
-		Q->avl_children[!which_child] = R;
-		R->avl_parent = Q;
-		Q->avl_children[which_child] = S;
-		S->avl_parent = Q;
-
-		if (Q->avl_balance == S->avl_balance) {
-			S->avl_balance = Q->avl_balance * -1;
-			R->avl_balance = 0;
-		} else if (Q->avl_balance) {
-			R->avl_balance = Q->avl_balance * -1;
-			S->avl_balance = 0;
+		avl_store_link(Q->avl_children[which_child], S);
+		avl_set_parent(S, Q);
+		avl_store_link(Q->avl_children[!which_child], R);
+		avl_set_parent(R, Q);
+
+		avl_store_link(*slot, Q);
+		avl_set_parent(Q, R_parent);
+
+		if (avl_get_balance(Q) == avl_get_balance(S)) {
+			avl_set_balance(S, avl_get_balance(Q) * -1);
+			avl_set_balance(R, 0);
+		} else if (avl_get_balance(Q)) {
+			avl_set_balance(R, avl_get_balance(Q) * -1);
+			avl_set_balance(S, 0);
 		} else {
-			S->avl_balance = 0;
-			R->avl_balance = 0;
+			avl_set_balance(S, 0);
+			avl_set_balance(R, 0);
 		}	
-		Q->avl_balance = 0;
+		avl_set_balance(Q, 0);
+		avl_update(avlroot, R);
+		avl_update(avlroot, S);
+		avl_update(avlroot, Q);
 		return 1;
 	} else {
 		avl_node_t **slot;
@@ -324,78 +1029,55 @@ avl_rebalance(avl_root_t *avlroot, avl_node_t *node)
 		 * parent of this subtree.
 		 */
 
+		avl_stat_add(avl_rotations[2], 1);
+
 		R = node;
 		S = child;
-		R_parent = R->avl_parent;
+		R_parent = avl_get_parent(R);
 		B = S->avl_children[!which_child];
 		if (!R_parent)
 			slot = &avlroot->avl_root;
 		else
 			slot = R_parent->avl_children + avl_which_child(R);
 
-		*slot = S;
-		S->avl_parent = R_parent;
-		
-		R->avl_parent = S;
-		S->avl_children[!which_child] = R;
-
-		R->avl_children[which_child] = B;
+		avl_store_link(R->avl_children[which_child], B);
 		if (B)
-			B->avl_parent = R;
+			avl_set_parent(B, R);
+
+		avl_set_parent(R, S);
+		avl_store_link(S->avl_children[!which_child], R);
+
+		avl_store_link(*slot, S);
+		avl_set_parent(S, R_parent);
 
-		S->avl_balance = R->avl_balance * -1;
+		avl_set_balance(S, avl_get_balance(R) * -1);
+		avl_update(avlroot, R);
+		avl_update(avlroot, S);
 	}
 	return 0;
 }
 
 /*
- * Generic insert routine for AVL tree
+ * Rebalancing routine after a subtree has grown
  *
- * The node parameter is the new node to be inserted into the AVL tree.
+ * The subtree rooted at the given node has just grown in height by one.
+ * Recalculate balance factor from the parent of the node up to possibly the
+ * root of the tree.
  *
- * Return the node pointer with the same key as node parameter. That is, if
- * there exists a node with the same key as node parameter, the pointer returned
- * will be different from node parameter.
+ * Return 1 if the height of the whole tree has grown, otherwise 0.
  */
-avl_node_t *
-avl_insert(avl_root_t *avlroot, avl_node_t *node, avl_cmp_t *cmpfunc)
+static int
+avl_grow_fixup(avl_root_t *avlroot, avl_node_t *node)
 {
-	avl_node_t *cur, *parent, **curp;
-	
-	/*
-	 * Do the AVL lookup as normal binary search tree.
-	 */
-	curp = &avlroot->avl_root;
-	cur = *curp;
-	parent = NULL;
-	while (cur) {
-		int cmp;
-
-		cmp = cmpfunc(node, cur);
-		if (!cmp)
-			/* The node with exact key is found, so we return the
-			 * found node */
-			return cur;
-		
-		curp = &cur->avl_children[avl_cmp2idx(cmp)];
-		parent = cur;
-		cur = *curp;
-	}
+	avl_node_t *parent;
 
-	/* Insert the node into the tree */
-	*curp = cur = node;
-	cur->avl_parent = parent;
-	cur->avl_balance = 0;
-	cur->avl_children[0] = cur->avl_children[1] = NULL;
-	
-	/*
-	 * Recalculate balance factor from the parent of the inserted node up to
-	 * possibly the root of the tree
-	 */
+	avl_stat_add(avl_fixups, 1);
+	parent = avl_get_parent(node);
 	while (parent) {
 		int which_child;
 		int balance, abs_balance;
 
+		avl_stat_add(avl_fixup_steps, 1);
 		which_child = avl_which_child(node);
 		balance = avl_idx2cmp(which_child);
 
@@ -410,148 +1092,1335 @@ avl_insert(avl_root_t *avlroot, avl_node_t *node, avl_cmp_t *cmpfunc)
 		 * properties, we have to do rotation to restore AVL tree
 		 * properties.
 		 */
-		abs_balance = avl_abs_balance(parent->avl_balance + balance);
+		balance += avl_get_balance(parent);
+		abs_balance = avl_abs_balance(balance);
 		if (!abs_balance) {
 			/* Perfect balance is introduced, thus we simply break
 			 * the loop */
-			parent->avl_balance += balance;
-			break;
+			avl_set_balance(parent, balance);
+			return 0;
 		} else if (abs_balance == 1) {
-			parent->avl_balance += balance;
-		} else {
+			avl_set_balance(parent, balance);
+		} else if (avl_rebalance(avlroot, parent)) {
 			/* The node violates AVL tree properties, we need to
 			 * do rotation on the node to restore the balance of
-			 * the tree. Since we only need to do it once along
-			 * the path in order to restore AVL tree properties,
-			 * after the rotation we simply break the loop */
-			avl_rebalance(avlroot, parent);
-			break;
+			 * the tree. After a single or double rotation the
+			 * subtree is back to its height before growing, so
+			 * we simply break the loop. This is always the case
+			 * on insertion */
+			return 0;
+		} else {
+			/* The rotation does not shorten the subtree, which
+			 * can only happen if the grown child is in perfect
+			 * balance (e.g. on joining trees). The subtree is now
+			 * rooted at the former child */
+			parent = avl_get_parent(parent);
 		}
 
 		/* The next iteration will start at the parent of the node on
 		 * which we have adjusted its balance factor */
 		node = parent;
-		parent = parent->avl_parent;
+		parent = avl_get_parent(parent);
 	}
-	return cur;
+	return 1;
 }
 
 /*
- * Generic node removal routine for AVL tree
+ * Link a node into the AVL tree at the given position
  *
- * Remove the specified node from AVL tree rooted at avlroot
+ * The parent parameter is the node the new node is attached to, and
+ * which_child tells whether the new node becomes the left (0) or the right (1)
+ * child of parent. That child slot must be empty. If parent is NULL, the tree
+ * must be empty and the node becomes the root.
+ *
+ * This allows callers to do the descent on their own (e.g. with an inlined
+ * comparison) and still share the rebalancing with avl_insert().
  */
 void
-avl_remove(avl_root_t *avlroot, avl_node_t *node)
+avl_insert_at(avl_root_t *avlroot, avl_node_t *parent, int which_child,
+    avl_node_t *node)
 {
-	int which_child;
-	avl_node_t *parent;
-
-	if (!node->avl_children[0] && !node->avl_children[1]) {
-		parent = node->avl_parent;
-		if (!parent) {
-			/* This is the only node in the tree, thus we reset
-			 * avlroot and return. */
-			avlroot->avl_root = NULL;
-			return;
-		}
-
-		which_child = avl_which_child(node);
-		parent->avl_children[which_child] = NULL;
-	} else {
-		int gchild_idx;
-		avl_node_t *child;
-		avl_node_t *gchild;
-
-		if (node->avl_balance < 0) {
-			/* First select the in-order predecessor node based on
-			 * balance factor */
-			child = avl_prev_next(node, -1);
-			if (!child)
-				child = avl_prev_next(node, 1);
-		} else {
-			child = avl_prev_next(node, 1);
-			if (!child)
-				child = avl_prev_next(node, -1);
-		}
-
-		gchild_idx = avl_balance2idx(child->avl_balance);
-		gchild = child->avl_children[gchild_idx];
-		/* The parent of the deleted node should be at @child if
-		 * @child is @node's direct child */
-		parent = child;
-		which_child = avl_which_child(child);
-		if (child->avl_parent != node) {
-			/* The parent of the deleted node should be at @child as
-			 * @child is not the direct child of @node */
-			parent = child->avl_parent;
-
-			/*
-			 * Update the pointer of @child to point to the subtree
-			 * that @child originally resides in
-			 */
-			child->avl_children[which_child] =
-			    node->avl_children[which_child];
-			if (child->avl_children[which_child])
-				child->avl_children[which_child]->avl_parent =
-				    child;
+	avl_set_parent(node, parent);
+	avl_set_balance(node, 0);
+	node->avl_children[0] = node->avl_children[1] = NULL;
+#ifdef AVL_ORDER_STATISTICS
+	node->avl_size = 1;
+#endif
+	if (!parent)
+		avl_store_link(avlroot->avl_root, node);
+	else
+		avl_store_link(parent->avl_children[which_child], node);
 
-			/*
-			 * Update the parent of grandchild
-			 */
-			parent->avl_children[which_child] = gchild;
-			if (gchild)
-				gchild->avl_parent = parent;
-		}
-		
-		child->avl_children[!which_child] =
-		    node->avl_children[!which_child];
-		if (child->avl_children[!which_child])
-			child->avl_children[!which_child]->avl_parent = child;
-		child->avl_balance = node->avl_balance;
+	/*
+	 * Every ancestor of the new node gains one node in its subtree. The
+	 * augmented data is brought up to date before any rotation, which
+	 * in turn recomputes the nodes it moves.
+	 */
+	avl_adjust_size(parent, 1);
+	avl_propagate(avlroot, node, node);
+	
+	avl_grow_fixup(avlroot, node);
+}
 
-		/*
-		 * Update the parent of @child to be the parent of @node
-		 */
-		child->avl_parent = node->avl_parent;
-		if (!child->avl_parent)
-			avlroot->avl_root = child;
-		else
-			node->avl_parent->avl_children[avl_which_child(node)] =
-			    child;
-	}
+static inline avl_node_t *
+avl_insert_internal(avl_root_t *avlroot, const struct avl_key *key,
+    avl_node_t *node, avl_prefetch_t *prefetch)
+{
+	int which_child = 0;
+	unsigned long depth = 0;
+	avl_node_t *cur, *parent;
 	
 	/*
-	 * Recalculate balance factor from the parent of the deleted node up to
-	 * possibly the root of the tree
+	 * Do the AVL lookup as normal binary search tree.
 	 */
-	while (parent) {
-		int balance, abs_balance;
+	cur = avlroot->avl_root;
+	parent = NULL;
+	if (cur && prefetch)
+		prefetch(cur);
+	while (cur) {
+		int cmp;
 
-		balance = avl_idx2cmp(which_child) * -1;
+		avl_prefetch_children(cur);
+		avl_prefetch_user(cur, prefetch);
+		depth++;
+		cmp = avl_key_cmp(key, cur);
+		if (!cmp) {
+			/* The node with exact key is found, so we return the
+			 * found node */
+			avl_stat_descent(depth);
+			return cur;
+		}
+		
+		which_child = avl_cmp2idx(cmp);
+		parent = cur;
+		cur = cur->avl_children[which_child];
+	}
 
-		/* The next iteration will start at the parent of the node on
-		 * which we have adjusted its balance factor */
-		which_child = avl_which_child(parent);
-		node = parent;
-		parent = parent->avl_parent;
+	/* Insert the node into the tree */
+	avl_stat_descent(depth);
+	avl_insert_at(avlroot, parent, which_child, node);
+	return node;
+}
 
-		/*
-		 * Calculate the balance factor on the current node.
-		 *
-		 * As long as balance factor is [-1,1], we do not need to do
-		 * rotation on the node. If the node violates the AVL tree
-		 * properties, we have to do rotation to restore AVL tree
-		 * properties.
+/*
+ * Generic insert routine for AVL tree
+ *
+ * The node parameter is the new node to be inserted into the AVL tree.
+ *
+ * Return the node pointer with the same key as node parameter. That is, if
+ * there exists a node with the same key as node parameter, the pointer returned
+ * will be different from node parameter.
+ */
+avl_node_t *
+avl_insert(avl_root_t *avlroot, avl_node_t *node, avl_cmp_t *cmpfunc)
+{
+	struct avl_key k = { node, cmpfunc, NULL };
+
+	return avl_insert_internal(avlroot, &k, node, NULL);
+}
+
+/*
+ * Insert routine for AVL tree with a bare key
+ *
+ * Same as avl_insert(), except that the key of the new node is given
+ * separately and passed to keycmp as it is.
+ *
+ * Return the node pointer with the same key as key parameter. That is, if
+ * there exists a node with the same key, the pointer returned will be
+ * different from node parameter.
+ */
+avl_node_t *
+avl_insert_key(avl_root_t *avlroot, const void *key, avl_node_t *node,
+    avl_keycmp_t *keycmp)
+{
+	struct avl_key k = { key, NULL, keycmp };
+
+	return avl_insert_internal(avlroot, &k, node, NULL);
+}
+
+/*
+ * Same as avl_insert() and avl_insert_key(), except that prefetch is called
+ * on the nodes of the descent like avl_search_prefetch() does
+ */
+avl_node_t *
+avl_insert_prefetch(avl_root_t *avlroot, avl_node_t *node, avl_cmp_t *cmpfunc,
+    avl_prefetch_t *prefetch)
+{
+	struct avl_key k = { node, cmpfunc, NULL };
+
+	return avl_insert_internal(avlroot, &k, node, prefetch);
+}
+
+avl_node_t *
+avl_insert_key_prefetch(avl_root_t *avlroot, const void *key, avl_node_t *node,
+    avl_keycmp_t *keycmp, avl_prefetch_t *prefetch)
+{
+	struct avl_key k = { key, NULL, keycmp };
+
+	return avl_insert_internal(avlroot, &k, node, prefetch);
+}
+
+/*
+ * Insert routine for AVL tree allowing duplicate keys
+ *
+ * Same as avl_insert(), except that the node is always inserted: a node whose
+ * key is equal to existing ones goes after all of them, so that equal keys are
+ * kept in insertion order.
+ */
+void
+avl_insert_multi(avl_root_t *avlroot, avl_node_t *node, avl_cmp_t *cmpfunc)
+{
+	int which_child = 0;
+	avl_node_t *cur, *parent;
+
+	cur = avlroot->avl_root;
+	parent = NULL;
+	while (cur) {
+		avl_prefetch_children(cur);
+		which_child = avl_cmp2idx(avl_compare(cmpfunc, node, cur));
+		parent = cur;
+		cur = cur->avl_children[which_child];
+	}
+
+	avl_insert_at(avlroot, parent, which_child, node);
+}
+
+/*
+ * Same as avl_insert_multi(), but with a bare key
+ */
+void
+avl_insert_multi_key(avl_root_t *avlroot, const void *key, avl_node_t *node,
+    avl_keycmp_t *keycmp)
+{
+	int which_child = 0;
+	avl_node_t *cur, *parent;
+
+	cur = avlroot->avl_root;
+	parent = NULL;
+	while (cur) {
+		avl_prefetch_children(cur);
+		which_child = avl_cmp2idx(avl_compare(keycmp, key, cur));
+		parent = cur;
+		cur = cur->avl_children[which_child];
+	}
+
+	avl_insert_at(avlroot, parent, which_child, node);
+}
+
+/*
+ * Climb from a node towards the root until reaching the subtree which the key
+ * must belong to.
+ *
+ * The cmp parameter is the result of comparing the key with the node, and
+ * must not be zero. Only the ancestors at which the climb turns towards the
+ * key need to be compared with it.
+ *
+ * Return the root of the subtree to descend from, or an ancestor with the
+ * same key.
+ */
+static avl_node_t *
+avl_climb(avl_node_t *node, const struct avl_key *key, int cmp)
+{
+	int which_child;
+	avl_node_t *parent;
+
+	which_child = avl_cmp2idx(cmp);
+	while ((parent = avl_get_parent(node))) {
+		if (parent->avl_children[which_child] != node) {
+			/* The parent lies on the same side as the key, so the
+			 * key belongs to the current subtree unless it lies
+			 * beyond the parent */
+			cmp = avl_key_cmp(key, parent);
+			if (!cmp)
+				return parent;
+			if (avl_cmp2idx(cmp) != which_child)
+				break;
+		}
+		node = parent;
+	}
+	return node;
+}
+
+/*
+ * Search for the key starting from a node of the tree, see avl_search_from()
+ */
+static avl_node_t *
+avl_search_from_internal(avl_node_t *start, const struct avl_key *key)
+{
+	int cmp;
+	avl_node_t *cur;
+
+	cmp = avl_key_cmp(key, start);
+	if (!cmp)
+		return start;
+
+	/* The start node has been compared already */
+	cur = avl_climb(start, key, cmp);
+	if (cur == start)
+		cur = start->avl_children[avl_cmp2idx(cmp)];
+	while (cur) {
+		avl_prefetch_children(cur);
+		cmp = avl_key_cmp(key, cur);
+		if (!cmp)
+			break;
+		cur = cur->avl_children[avl_cmp2idx(cmp)];
+	}
+	return cur;
+}
+
+/*
+ * Finger search routine for AVL tree
+ *
+ * Same as avl_search(), except that the search starts from the given node
+ * rather than from the root: it climbs from there just as far as the subtree
+ * the key must belong to, and descends into it. The cost is the height of
+ * the smallest subtree holding both the start node and the key, which for a
+ * key d positions away is O(log d) on average and amortizes to O(1) over a
+ * sequential sweep, but reaches the root for neighbours on either side of it.
+ *
+ * Return either NULL if the node with corresponding key is not found, or
+ * pointer to the node with corresponding key
+ */
+avl_node_t *
+avl_search_from(avl_node_t *start, avl_node_t *key, avl_cmp_t *cmpfunc)
+{
+	struct avl_key k = { key, cmpfunc, NULL };
+
+	return avl_search_from_internal(start, &k);
+}
+
+/*
+ * Same as avl_search_from(), but with a bare key
+ */
+avl_node_t *
+avl_search_from_key(avl_node_t *start, const void *key, avl_keycmp_t *keycmp)
+{
+	struct avl_key k = { key, NULL, keycmp };
+
+	return avl_search_from_internal(start, &k);
+}
+
+/*
+ * Insert a node by descending from the given child slot of parent, or from
+ * the root of the tree if parent is NULL.
+ *
+ * Return the node pointer with the same key as the key parameter.
+ */
+static avl_node_t *
+avl_insert_from(avl_root_t *avlroot, avl_node_t *parent, int which_child,
+    const struct avl_key *key, avl_node_t *node)
+{
+	avl_node_t *cur;
+
+	if (!parent)
+		cur = avlroot->avl_root;
+	else
+		cur = parent->avl_children[which_child];
+
+	while (cur) {
+		int cmp;
+
+		avl_prefetch_children(cur);
+		cmp = avl_key_cmp(key, cur);
+		if (!cmp)
+			return cur;
+
+		which_child = avl_cmp2idx(cmp);
+		parent = cur;
+		cur = cur->avl_children[which_child];
+	}
+
+	avl_insert_at(avlroot, parent, which_child, node);
+	return node;
+}
+
+/*
+ * Insert routine for AVL tree with a hint
+ *
+ * The hint parameter is a node in the tree close to where the new node is
+ * expected to go. If the new node falls right between the hint and its
+ * predecessor or successor, it is attached directly, which takes two
+ * comparisons. Otherwise the descent starts from the neighbourhood of the
+ * hint rather than from the root. A NULL hint is the same as avl_insert().
+ *
+ * Return the node pointer with the same key as node parameter, like
+ * avl_insert().
+ */
+avl_node_t *
+avl_insert_hint(avl_root_t *avlroot, avl_node_t *hint, avl_node_t *node,
+    avl_cmp_t *cmpfunc)
+{
+	int cmp, which_child;
+	avl_node_t *neighbour;
+	struct avl_key key = { node, cmpfunc, NULL };
+
+	if (!hint)
+		return avl_insert(avlroot, node, cmpfunc);
+
+	cmp = avl_compare(cmpfunc, node, hint);
+	if (!cmp)
+		return hint;
+
+	which_child = avl_cmp2idx(cmp);
+	neighbour = avl_prev_next(hint, avl_idx2cmp(which_child));
+	if (neighbour) {
+		cmp = avl_compare(cmpfunc, node, neighbour);
+		if (!cmp)
+			return neighbour;
+		if (avl_cmp2idx(cmp) == which_child) {
+			/* The node lies beyond the neighbour as well */
+			hint = avl_climb(neighbour, &key, cmp);
+			if (hint == neighbour)
+				return avl_insert_from(avlroot, neighbour,
+				    which_child, &key, node);
+			return avl_insert_from(avlroot, avl_get_parent(hint),
+			    avl_which_child(hint), &key, node);
+		}
+	}
+
+	/*
+	 * The node goes between the hint and its neighbour. If the hint has a
+	 * subtree towards the neighbour, the neighbour is the nearest node of
+	 * that subtree and has no child towards the hint.
+	 */
+	if (!hint->avl_children[which_child])
+		avl_insert_at(avlroot, hint, which_child, node);
+	else
+		avl_insert_at(avlroot, neighbour, !which_child, node);
+	return node;
+}
+
+/*
+ * Insert a batch of nodes sorted in ascending order
+ *
+ * Consecutive keys of a sorted batch tend to land next to each other, thus the
+ * descent for each node starts from the position of the previous node in the
+ * batch rather than from the root, and climbs only as far as needed. The
+ * batch needs not to be sorted for correctness, but the saving is gone
+ * otherwise.
+ *
+ * Like avl_insert(), a node is not inserted if a node with the same key
+ * exists. In that case nodes[i] is replaced with the existing node, so that
+ * on return every nodes[i] is the node in the tree with the key of the
+ * original nodes[i].
+ *
+ * Return the number of nodes inserted.
+ */
+size_t
+avl_insert_sorted_batch(avl_root_t *avlroot, avl_node_t **nodes, size_t n,
+    avl_cmp_t *cmpfunc)
+{
+	size_t i, inserted = 0;
+	avl_node_t *finger = NULL;
+
+	for (i = 0; i < n; ++i) {
+		struct avl_key key = { nodes[i], cmpfunc, NULL };
+		avl_node_t *ret;
+
+		if (!finger) {
+			ret = avl_insert_from(avlroot, NULL, 0, &key, nodes[i]);
+		} else {
+			int cmp;
+			avl_node_t *start;
+
+			cmp = avl_compare(cmpfunc, nodes[i], finger);
+			if (!cmp) {
+				nodes[i] = finger;
+				continue;
+			}
+
+			start = avl_climb(finger, &key, cmp);
+			if (start == finger)
+				/* The comparison with the finger is known */
+				ret = avl_insert_from(avlroot, finger,
+				    avl_cmp2idx(cmp), &key, nodes[i]);
+			else
+				ret = avl_insert_from(avlroot,
+				    avl_get_parent(start),
+				    avl_which_child(start), &key, nodes[i]);
+		}
+
+		if (ret == nodes[i])
+			inserted++;
+		nodes[i] = finger = ret;
+	}
+	return inserted;
+}
+
+/*
+ * Generic node removal routine for AVL tree
+ *
+ * Remove the specified node from AVL tree rooted at avlroot
+ */
+void
+avl_remove(avl_root_t *avlroot, avl_node_t *node)
+{
+	int which_child;
+	avl_node_t *parent, *replacement = NULL;
+
+	if (!node->avl_children[0] && !node->avl_children[1]) {
+		parent = avl_get_parent(node);
+		if (!parent) {
+			/* This is the only node in the tree, thus we reset
+			 * avlroot and return. */
+			avl_store_link(avlroot->avl_root, NULL);
+			return;
+		}
+
+		which_child = avl_which_child(node);
+		avl_store_link(parent->avl_children[which_child], NULL);
+	} else {
+		int gchild_idx;
+		avl_node_t *child;
+		avl_node_t *gchild;
+		avl_node_t *node_parent;
+
+		if (avl_get_balance(node) < 0) {
+			/* First select the in-order predecessor node based on
+			 * balance factor */
+			child = avl_prev_next(node, -1);
+			if (!child)
+				child = avl_prev_next(node, 1);
+		} else {
+			child = avl_prev_next(node, 1);
+			if (!child)
+				child = avl_prev_next(node, -1);
+		}
+
+		gchild_idx = avl_balance2idx(avl_get_balance(child));
+		gchild = child->avl_children[gchild_idx];
+		/* The parent of the deleted node should be at @child if
+		 * @child is @node's direct child */
+		parent = child;
+		which_child = avl_which_child(child);
+		if (avl_get_parent(child) != node) {
+			/* The parent of the deleted node should be at @child as
+			 * @child is not the direct child of @node */
+			parent = avl_get_parent(child);
+
+			/*
+			 * Update the parent of grandchild. @child is unlinked
+			 * from the tree first, so that linking it to the
+			 * subtree it resides in does not make a cycle.
+			 */
+			avl_store_link(parent->avl_children[which_child],
+			    gchild);
+			if (gchild)
+				avl_set_parent(gchild, parent);
+
+			/*
+			 * Update the pointer of @child to point to the subtree
+			 * that @child originally resides in
+			 */
+			avl_store_link(child->avl_children[which_child],
+			    node->avl_children[which_child]);
+			if (child->avl_children[which_child])
+				avl_set_parent(child->avl_children[which_child],
+				    child);
+		}
+		
+		avl_store_link(child->avl_children[!which_child],
+		    node->avl_children[!which_child]);
+		if (child->avl_children[!which_child])
+			avl_set_parent(child->avl_children[!which_child],
+			    child);
+		avl_set_balance(child, avl_get_balance(node));
+		replacement = child;
+#ifdef AVL_ORDER_STATISTICS
+		child->avl_size = node->avl_size;
+#endif
+
+		/*
+		 * Update the parent of @child to be the parent of @node
+		 */
+		node_parent = avl_get_parent(node);
+		avl_set_parent(child, node_parent);
+		if (!node_parent)
+			avl_store_link(avlroot->avl_root, child);
+		else
+			avl_store_link(node_parent->avl_children[
+			    avl_which_child(node)], child);
+	}
+	
+	/*
+	 * Every node from the parent of the deleted node up to the root loses
+	 * one node in its subtree. If @child took the place of @node, it is on
+	 * this path as well, and it has inherited the subtree size of @node.
+	 * Its augmented data still describes its old subtree though, thus the
+	 * propagation must not stop before reaching it.
+	 */
+	avl_adjust_size(parent, -1);
+	avl_propagate(avlroot, parent, replacement);
+
+	/*
+	 * Recalculate balance factor from the parent of the deleted node up to
+	 * possibly the root of the tree
+	 */
+	avl_stat_add(avl_fixups, 1);
+	while (parent) {
+		int balance, abs_balance;
+
+		avl_stat_add(avl_fixup_steps, 1);
+		balance = avl_idx2cmp(which_child) * -1;
+
+		/* The next iteration will start at the parent of the node on
+		 * which we have adjusted its balance factor */
+		which_child = avl_which_child(parent);
+		node = parent;
+		parent = avl_get_parent(parent);
+
+		/*
+		 * Calculate the balance factor on the current node.
+		 *
+		 * As long as balance factor is [-1,1], we do not need to do
+		 * rotation on the node. If the node violates the AVL tree
+		 * properties, we have to do rotation to restore AVL tree
+		 * properties.
 		 */		
-		abs_balance = avl_abs_balance(node->avl_balance + balance);
+		balance += avl_get_balance(node);
+		abs_balance = avl_abs_balance(balance);
 		if (!abs_balance) {
-			node->avl_balance += balance;
+			avl_set_balance(node, balance);
 		} else if (abs_balance == 1) {
-			node->avl_balance += balance;
+			avl_set_balance(node, balance);
 			break;
 		} else if (!avl_rebalance(avlroot, node)) {
 			break;
 		}
 	}
 }
+
+/*
+ * Building a tree from nodes arriving in sorted order
+ *
+ * The tree is shaped as if the range of in-order positions [0, n) was split
+ * recursively at its middle, and every node is placed as soon as it arrives.
+ * The recursion is emulated by a stack of frames, each holding the range of
+ * a subtree under construction, whose root node is NULL while its left
+ * subtree is being built and set once the root has arrived. As the ranges
+ * halve at each level, the stack never grows beyond the bit length of n.
+ */
+
+/*
+ * Push the frames for the subtree holding the range [lo, hi) down its
+ * leftmost path. The next node to arrive is the root of the top frame.
+ */
+static void
+avl_build_descend(avl_builder_t *b, size_t lo, size_t hi)
+{
+	while (lo < hi) {
+		struct avl_build_frame_s *frame = &b->stack[b->depth++];
+
+		frame->lo = lo;
+		frame->hi = hi;
+		frame->node = NULL;
+		hi = lo + (hi - lo) / 2;
+	}
+	b->subtree = NULL;
+}
+
+/*
+ * Start building the tree @avlroot from @n nodes, which avl_build_push() then
+ * places one at a time in O(1) amortized each, without any comparison. The
+ * tree is emptied.
+ */
+void
+avl_build_begin(avl_builder_t *b, avl_root_t *avlroot, size_t n)
+{
+	b->avlroot = avlroot;
+	b->depth = 0;
+	avl_build_descend(b, 0, n);
+	avlroot->avl_root = NULL;
+}
+
+/*
+ * Place the next node in sorted order. Once the n-th node is placed, the
+ * tree is complete and holds them all.
+ */
+void
+avl_build_push(avl_builder_t *b, avl_node_t *node)
+{
+	size_t lsize, rsize, mid;
+	struct avl_build_frame_s *frame = &b->stack[b->depth - 1];
+
+	/* The left subtree of the node is complete */
+	node->avl_children[0] = b->subtree;
+	if (b->subtree)
+		avl_set_parent(b->subtree, node);
+	frame->node = node;
+
+	/*
+	 * The left subtree holds floor(m / 2) nodes and the right subtree
+	 * holds the other ceil(m / 2) - 1. Either both have the same height,
+	 * or the right subtree is shorter by one, which happens only if the
+	 * left subtree holds a power of two nodes.
+	 */
+	mid = frame->lo + (frame->hi - frame->lo) / 2;
+	lsize = mid - frame->lo;
+	rsize = frame->hi - mid - 1;
+	if (lsize != rsize && !(lsize & (lsize - 1)))
+		avl_set_balance(node, -1);
+	else
+		avl_set_balance(node, 0);
+
+	avl_build_descend(b, mid + 1, frame->hi);
+
+	/*
+	 * If the right subtree is empty, the subtrees waiting on the stack for
+	 * their right subtree are now complete.
+	 */
+	while (b->depth) {
+		frame = &b->stack[b->depth - 1];
+		if (!frame->node)
+			break;
+
+		node = frame->node;
+		node->avl_children[1] = b->subtree;
+		if (b->subtree)
+			avl_set_parent(b->subtree, node);
+		avl_update(b->avlroot, node);
+		b->subtree = node;
+		b->depth--;
+	}
+
+	if (!b->depth) {
+		avl_set_parent(b->subtree, NULL);
+		b->avlroot->avl_root = b->subtree;
+	}
+}
+
+/*
+ * Build an AVL tree from an array of nodes sorted in ascending order
+ *
+ * The nodes are linked into a perfectly balanced tree in O(n) time without
+ * calling any comparison routine. Any node previously in the tree is
+ * discarded, so the tree should be empty. The keys must be distinct and
+ * sorted, otherwise the tree will be malformed.
+ */
+void
+avl_build_sorted(avl_root_t *avlroot, avl_node_t **nodes, size_t n)
+{
+	size_t i;
+	avl_builder_t b;
+
+	avl_build_begin(&b, avlroot, n);
+	for (i = 0; i < n; ++i)
+		avl_build_push(&b, nodes[i]);
+}
+
+/*
+ * Build an AVL tree from an array of nodes sorted in ascending order, while
+ * checking that the keys are indeed sorted and distinct
+ *
+ * Return NULL if the tree has been built, otherwise the first node whose key
+ * is not greater than that of its predecessor in the array. The tree is left
+ * empty in the latter case.
+ */
+avl_node_t *
+avl_build_sorted_checked(avl_root_t *avlroot, avl_node_t **nodes, size_t n,
+    avl_cmp_t *cmpfunc)
+{
+	size_t i;
+	avl_builder_t b;
+
+	avl_build_begin(&b, avlroot, n);
+	for (i = 0; i < n; ++i) {
+		if (i && avl_compare(cmpfunc, nodes[i - 1], nodes[i]) >= 0) {
+			avlroot->avl_root = NULL;
+			return nodes[i];
+		}
+		avl_build_push(&b, nodes[i]);
+	}
+	return NULL;
+}
+
+/*
+ * Get the height of the subtree rooted at the node, which may be NULL, by
+ * following the taller child down to the bottom.
+ */
+static int
+avl_height(avl_node_t *node)
+{
+	int height = 0;
+
+	while (node) {
+		height++;
+		node = node->avl_children[
+		    avl_balance2idx(avl_get_balance(node))];
+	}
+	return height;
+}
+
+/*
+ * Recompute the subtree size and the augmented data of every node from the
+ * given node up to the root.
+ */
+static void
+avl_update_path(avl_root_t *avlroot, avl_node_t *node)
+{
+	for (; node; node = avl_get_parent(node))
+		avl_update(avlroot, node);
+}
+
+/*
+ * Join two detached subtrees with a pivot node
+ *
+ * The left and right subtrees are of heights lheight and rheight, and every
+ * key in left is less than the key of pivot, which is in turn less than every
+ * key in right. The resulting tree is placed at avlroot.
+ *
+ * If the heights differ by more than one, the pivot is attached along the
+ * inner spine of the taller subtree, at the first node which is at most one
+ * unit taller than the shorter subtree. The subtree there grows by one, and
+ * the balance is restored on the way up as on insertion. The cost is thus
+ * proportional to the difference in height.
+ *
+ * Return the height of the resulting tree.
+ */
+static int
+avl_join_subtrees(avl_root_t *avlroot, avl_node_t *left, int lheight,
+    avl_node_t *pivot, avl_node_t *right, int rheight)
+{
+	int which_child, height, sheight;
+	avl_node_t *cur, *parent, *shorter;
+
+	if (lheight - rheight > 1) {
+		/* Descend along the right spine of left */
+		which_child = 1;
+		cur = left;
+		height = lheight;
+		shorter = right;
+		sheight = rheight;
+	} else if (rheight - lheight > 1) {
+		/* Descend along the left spine of right */
+		which_child = 0;
+		cur = right;
+		height = rheight;
+		shorter = left;
+		sheight = lheight;
+	} else {
+		pivot->avl_children[0] = left;
+		pivot->avl_children[1] = right;
+		avl_set_parent(pivot, NULL);
+		avl_set_balance(pivot, rheight - lheight);
+		if (left)
+			avl_set_parent(left, pivot);
+		if (right)
+			avl_set_parent(right, pivot);
+		avl_update(avlroot, pivot);
+		avlroot->avl_root = pivot;
+		return (lheight < rheight ? rheight : lheight) + 1;
+	}
+
+	avlroot->avl_root = cur;
+	parent = NULL;
+	while (height > sheight + 1) {
+		/* The child on the spine is shorter by two if the node leans
+		 * to the other side */
+		if (avl_get_balance(cur) &&
+		    avl_balance2idx(avl_get_balance(cur)) != which_child)
+			height -= 2;
+		else
+			height -= 1;
+		parent = cur;
+		cur = cur->avl_children[which_child];
+	}
+
+	/*
+	 * The subtree at cur is either as tall as the shorter subtree or one
+	 * unit taller, so it can be a sibling of the shorter subtree under the
+	 * pivot.
+	 */
+	pivot->avl_children[!which_child] = cur;
+	pivot->avl_children[which_child] = shorter;
+	avl_set_balance(pivot, avl_idx2cmp(which_child) * (sheight - height));
+	if (cur)
+		avl_set_parent(cur, pivot);
+	if (shorter)
+		avl_set_parent(shorter, pivot);
+	avl_set_parent(pivot, parent);
+	parent->avl_children[which_child] = pivot;
+
+	avl_update_path(avlroot, pivot);
+	lheight = which_child ? lheight : rheight;
+	return lheight + avl_grow_fixup(avlroot, pivot);
+}
+
+/*
+ * Join two trees with a pivot node
+ *
+ * Every key in the left tree must be less than the key of pivot, which must in
+ * turn be less than every key in the right tree. If pivot is NULL, the first
+ * node of the right tree is taken as the pivot.
+ *
+ * The resulting tree is placed at avlroot, which may be the same as left or
+ * right, and left and right are emptied otherwise. The augmentation routine of
+ * avlroot is used.
+ *
+ * This takes O(log n) time.
+ */
+void
+avl_join(avl_root_t *avlroot, avl_root_t *left, avl_node_t *pivot,
+    avl_root_t *right)
+{
+	avl_node_t *lnode, *rnode;
+
+	if (!pivot && right->avl_root) {
+		pivot = avl_first(right);
+		avl_remove(right, pivot);
+	}
+
+	lnode = left->avl_root;
+	rnode = right->avl_root;
+	left->avl_root = right->avl_root = NULL;
+	if (!pivot) {
+		/* The right tree is empty */
+		avlroot->avl_root = lnode;
+		return;
+	}
+
+	avl_join_subtrees(avlroot, lnode, avl_height(lnode), pivot, rnode,
+	    avl_height(rnode));
+}
+
+/*
+ * Generic split routine for AVL tree
+ *
+ * The path from the root down to where the key would be inserted divides the
+ * tree: every node on the path goes to either side together with its subtree
+ * off the path. Walking the path bottom-up, each of these is joined into the
+ * side it belongs to. The heights joined on either side increase along the
+ * way, so the costs of the joins add up to O(log n).
+ *
+ * The heights are derived from the balance factors on the way up, starting
+ * from the empty subtree at the bottom of the path.
+ */
+static void
+avl_split_internal(avl_root_t *avlroot, const struct avl_key *key,
+    avl_root_t *left, avl_root_t *right)
+{
+	int which_child, height;
+	int lheight, rheight;
+	avl_node_t *cur, *node;
+	avl_root_t lroot, rroot;
+
+	avl_root_like(&lroot, avlroot);
+	avl_root_like(&rroot, avlroot);
+
+	/*
+	 * Nodes not less than the key go right, so the path turns left at
+	 * them.
+	 */
+	which_child = 0;
+	node = NULL;
+	cur = avlroot->avl_root;
+	while (cur) {
+		which_child = avl_key_cmp(key, cur) > 0;
+		node = cur;
+		cur = cur->avl_children[which_child];
+	}
+	avlroot->avl_root = NULL;
+
+	height = lheight = rheight = 0;
+	while (node) {
+		int sheight, pwhich_child;
+		avl_node_t *parent, *sibling;
+
+		/* Read everything needed before the node is relinked */
+		parent = avl_get_parent(node);
+		pwhich_child = parent ? avl_which_child(node) : 0;
+		sibling = node->avl_children[!which_child];
+		if (!which_child)
+			sheight = height + avl_get_balance(node);
+		else
+			sheight = height - avl_get_balance(node);
+		height = (height < sheight ? sheight : height) + 1;
+		if (sibling)
+			avl_set_parent(sibling, NULL);
+
+		if (!which_child)
+			rheight = avl_join_subtrees(&rroot, rroot.avl_root,
+			    rheight, node, sibling, sheight);
+		else
+			lheight = avl_join_subtrees(&lroot, sibling, sheight,
+			    node, lroot.avl_root, lheight);
+
+		which_child = pwhich_child;
+		node = parent;
+	}
+
+	left->avl_root = lroot.avl_root;
+	right->avl_root = rroot.avl_root;
+}
+
+/*
+ * Split the tree into the nodes whose keys are less than the given key, and
+ * the rest
+ *
+ * The former are placed at left and the latter at right, which may be the
+ * same as avlroot. avlroot is emptied otherwise.
+ *
+ * This takes O(log n) time.
+ */
+void
+avl_split(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc,
+    avl_root_t *left, avl_root_t *right)
+{
+	struct avl_key k = { key, cmpfunc, NULL };
+
+	avl_split_internal(avlroot, &k, left, right);
+}
+
+/*
+ * Same as avl_split(), but with a bare key
+ */
+void
+avl_split_key(avl_root_t *avlroot, const void *key, avl_keycmp_t *keycmp,
+    avl_root_t *left, avl_root_t *right)
+{
+	struct avl_key k = { key, NULL, keycmp };
+
+	avl_split_internal(avlroot, &k, left, right);
+}
+
+/*
+ * Destroy routine for AVL tree
+ *
+ * Empty the tree and call fn with arg on every node, unless fn is NULL. The
+ * nodes are visited in post-order, each node after both of its subtrees, so
+ * fn is free to release the node. The tree is torn down without any rotation
+ * or recursion, in O(n) time.
+ */
+void
+avl_destroy(avl_root_t *avlroot, avl_destroy_t *fn, void *arg)
+{
+	avl_node_t *node, *parent;
+
+	node = avlroot->avl_root;
+	avlroot->avl_root = NULL;
+	while (node) {
+		/* Descend to the leftmost leaf of the remaining tree */
+		if (node->avl_children[0]) {
+			node = node->avl_children[0];
+			continue;
+		}
+		if (node->avl_children[1]) {
+			node = node->avl_children[1];
+			continue;
+		}
+
+		/* Detach the leaf before handing it over */
+		parent = avl_get_parent(node);
+		if (parent)
+			parent->avl_children[avl_which_child(node)] = NULL;
+		if (fn)
+			fn(node, arg);
+		node = parent;
+	}
+}
+
+/*
+ * Call fn with arg on every node whose key is in [lo, hi), in order, until it
+ * returns non-zero. fn must not change the tree.
+ */
+static int
+avl_range_foreach_internal(avl_root_t *avlroot, const struct avl_key *lo,
+    const struct avl_key *hi, avl_visit_t *fn, void *arg)
+{
+	avl_node_t *node;
+	int retval;
+
+	for (node = avl_bound(avlroot, lo, 1, 1);
+	    node && avl_key_cmp(hi, node) > 0; node = avl_next(node)) {
+		retval = fn(node, arg);
+		if (retval)
+			return retval;
+	}
+	return 0;
+}
+
+/*
+ * Visit the nodes whose keys are not less than lo and less than hi, in order
+ *
+ * Return the non-zero value fn stopped with, otherwise zero.
+ *
+ * This takes O(log n + k) time for k nodes visited.
+ */
+int
+avl_range_foreach(avl_root_t *avlroot, avl_node_t *lo, avl_node_t *hi,
+    avl_cmp_t *cmpfunc, avl_visit_t *fn, void *arg)
+{
+	struct avl_key klo = { lo, cmpfunc, NULL };
+	struct avl_key khi = { hi, cmpfunc, NULL };
+
+	return avl_range_foreach_internal(avlroot, &klo, &khi, fn, arg);
+}
+
+/*
+ * Same as avl_range_foreach(), but with bare keys
+ */
+int
+avl_range_foreach_key(avl_root_t *avlroot, const void *lo, const void *hi,
+    avl_keycmp_t *keycmp, avl_visit_t *fn, void *arg)
+{
+	struct avl_key klo = { lo, NULL, keycmp };
+	struct avl_key khi = { hi, NULL, keycmp };
+
+	return avl_range_foreach_internal(avlroot, &klo, &khi, fn, arg);
+}
+
+struct avl_range_destroy {
+	avl_destroy_t *fn;
+	void *arg;
+	size_t count;
+};
+
+static void
+avl_range_destroy_node(avl_node_t *node, void *arg)
+{
+	struct avl_range_destroy *d = arg;
+
+	d->count++;
+	if (d->fn)
+		d->fn(node, d->arg);
+}
+
+/*
+ * Cut the nodes in [lo, hi) out with two splits, join the rest back together
+ * and tear the range down.
+ */
+static size_t
+avl_remove_range_internal(avl_root_t *avlroot, const struct avl_key *lo,
+    const struct avl_key *hi, avl_destroy_t *fn, void *arg)
+{
+	avl_root_t range, right;
+	struct avl_range_destroy d = { fn, arg, 0 };
+
+	avl_root_like(&range, avlroot);
+	avl_root_like(&right, avlroot);
+	avl_split_internal(avlroot, lo, avlroot, &range);
+	avl_split_internal(&range, hi, &range, &right);
+	avl_join(avlroot, avlroot, NULL, &right);
+	avl_destroy(&range, avl_range_destroy_node, &d);
+	return d.count;
+}
+
+/*
+ * Remove the nodes whose keys are not less than lo and less than hi, and call
+ * fn with arg on each of them as avl_destroy() does, unless fn is NULL
+ *
+ * Return the number of nodes removed.
+ *
+ * This takes O(log n + k) time for k nodes removed, instead of the
+ * O(k log n) of removing them one by one.
+ */
+size_t
+avl_remove_range(avl_root_t *avlroot, avl_node_t *lo, avl_node_t *hi,
+    avl_cmp_t *cmpfunc, avl_destroy_t *fn, void *arg)
+{
+	struct avl_key klo = { lo, cmpfunc, NULL };
+	struct avl_key khi = { hi, cmpfunc, NULL };
+
+	return avl_remove_range_internal(avlroot, &klo, &khi, fn, arg);
+}
+
+/*
+ * Same as avl_remove_range(), but with bare keys
+ */
+size_t
+avl_remove_range_key(avl_root_t *avlroot, const void *lo, const void *hi,
+    avl_keycmp_t *keycmp, avl_destroy_t *fn, void *arg)
+{
+	struct avl_key klo = { lo, NULL, keycmp };
+	struct avl_key khi = { hi, NULL, keycmp };
+
+	return avl_remove_range_internal(avlroot, &klo, &khi, fn, arg);
+}
+
+/*
+ * Move a node with the relocation routine and point its neighbours at the
+ * new address.
+ *
+ * Return the new address of the node.
+ */
+static avl_node_t *
+avl_relocate(avl_root_t *avlroot, avl_node_t *node, avl_relocate_t *fn,
+    void *arg)
+{
+	avl_node_t *parent, *moved;
+	int i, which_child;
+
+	/* The old node may be gone once the routine returns */
+	parent = avl_get_parent(node);
+	which_child = avl_which_child(node);
+	moved = fn(node, arg);
+	if (moved == node)
+		return node;
+
+	for (i = 0; i < 2; i++)
+		if (moved->avl_children[i])
+			avl_set_parent(moved->avl_children[i], moved);
+	if (parent)
+		avl_store_link(parent->avl_children[which_child], moved);
+	else
+		avl_store_link(avlroot->avl_root, moved);
+	return moved;
+}
+
+static void
+avl_relayout_veb(avl_root_t *avlroot, avl_node_t *node, int height,
+    avl_relocate_t *fn, void *arg);
+
+/*
+ * Lay out, left to right, the subtrees of the given height hanging at the
+ * given depth below the node.
+ */
+static void
+avl_relayout_below(avl_root_t *avlroot, avl_node_t *node, int depth,
+    int height, avl_relocate_t *fn, void *arg)
+{
+	if (!node)
+		return;
+	if (!depth) {
+		avl_relayout_veb(avlroot, node, height, fn, arg);
+		return;
+	}
+	avl_relayout_below(avlroot, node->avl_children[0], depth - 1, height,
+	    fn, arg);
+	avl_relayout_below(avlroot, node->avl_children[1], depth - 1, height,
+	    fn, arg);
+}
+
+/*
+ * Lay out the top levels of the subtree rooted at the node in van Emde Boas
+ * order: the upper half of the levels first, then every subtree below them.
+ */
+static void
+avl_relayout_veb(avl_root_t *avlroot, avl_node_t *node, int height,
+    avl_relocate_t *fn, void *arg)
+{
+	avl_node_t *parent;
+	int top, which_child;
+
+	if (height == 1) {
+		avl_relocate(avlroot, node, fn, arg);
+		return;
+	}
+
+	/* The subtree stays where it hangs while its root moves */
+	parent = avl_get_parent(node);
+	which_child = avl_which_child(node);
+	top = height / 2;
+	avl_relayout_veb(avlroot, node, top, fn, arg);
+	node = parent ? parent->avl_children[which_child] : avlroot->avl_root;
+	avl_relayout_below(avlroot, node, top, height - top, fn, arg);
+}
+
+/*
+ * Move every node of the tree with the relocation routine, in the given
+ * order, e.g. into a fresh arena so that the tree gets the memory layout of a
+ * newly built one back. The links of the tree are updated to the new
+ * addresses as the nodes move; nothing else may hold on to the old ones.
+ */
+void
+avl_relayout(avl_root_t *avlroot, enum avl_layout layout, avl_relocate_t *fn,
+    void *arg)
+{
+	avl_node_t *node;
+	int depth, height;
+
+	if (!avlroot->avl_root)
+		return;
+	switch (layout) {
+	case AVL_LAYOUT_INORDER:
+		for (node = avl_first(avlroot); node; node = avl_next(node))
+			node = avl_relocate(avlroot, node, fn, arg);
+		break;
+	case AVL_LAYOUT_BFS:
+		height = avl_height(avlroot->avl_root);
+		for (depth = 0; depth < height; depth++)
+			avl_relayout_below(avlroot, avlroot->avl_root, depth, 1,
+			    fn, arg);
+		break;
+	case AVL_LAYOUT_VEB:
+		avl_relayout_veb(avlroot, avlroot->avl_root,
+		    avl_height(avlroot->avl_root), fn, arg);
+		break;
+	}
+}
+
+#ifdef AVL_STATS
+/*
+ * Take a snapshot of the counters of the calling thread.
+ */
+void
+avl_stats_get(avl_stats_t *stats)
+{
+	*stats = avl_stats;
+}
+
+/*
+ * Zero the counters of the calling thread.
+ */
+void
+avl_stats_reset(void)
+{
+	static const avl_stats_t zero;
+
+	avl_stats = zero;
+}
+#endif
+
+#ifdef AVL_ORDER_STATISTICS
+/*
+ * Find the node with the given rank, i.e. the k-th smallest node counting
+ * from zero.
+ *
+ * Return either a valid AVL node or NULL if k is not less than the number of
+ * nodes in the tree.
+ */
+avl_node_t *
+avl_select(avl_root_t *avlroot, size_t k)
+{
+	avl_node_t *cur;
+
+	cur = avlroot->avl_root;
+	while (cur) {
+		size_t lsize;
+
+		lsize = avl_subtree_size(cur->avl_children[0]);
+		if (k == lsize)
+			break;
+		if (k < lsize) {
+			cur = cur->avl_children[0];
+		} else {
+			/* Skip the left subtree and the current node */
+			k -= lsize + 1;
+			cur = cur->avl_children[1];
+		}
+	}
+	return cur;
+}
+
+/*
+ * Get the rank of the node, i.e. the number of nodes preceding it in the
+ * tree.
+ */
+size_t
+avl_rank(avl_root_t *avlroot, avl_node_t *node)
+{
+	size_t rank;
+	avl_node_t *parent;
+
+	(void)avlroot;
+	rank = avl_subtree_size(node->avl_children[0]);
+	while ((parent = avl_get_parent(node))) {
+		/* Coming up from the right, the parent and its left subtree
+		 * precede the node */
+		if (parent->avl_children[1] == node)
+			rank += avl_subtree_size(parent->avl_children[0]) + 1;
+		node = parent;
+	}
+	return rank;
+}
+#endif
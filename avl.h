@@ -31,36 +31,238 @@
 #define __AVL_H__
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * Upper bound of the height of an AVL tree, counted in nodes. A tree of height
+ * h holds at least F(h + 2) - 1 nodes, where F is the Fibonacci sequence, so no
+ * tree that fits in the address space is taller than this.
+ */
+#define AVL_MAX_HEIGHT 92
+
 /*
  * Intrusive node structure embedded as data members.
  *
  * For balance factor, a negative integer indicates the subtree rooted at the current
  * node is left-heavy, on the other hand a positive integer indicates the subtree is
  * right-heavy. Zero balance factor indicates the subtree is in perfect balance.
+ *
+ * If AVL_ORDER_STATISTICS is defined, every node also keeps the number of nodes
+ * in the subtree rooted at it, which enables avl_select() and avl_rank().
+ *
+ * If AVL_COMPACT is defined, the balance factor is packed into the two
+ * low-order bits of the parent pointer, which saves a word per node. The
+ * parent and the balance factor must then be accessed with avl_get_parent(),
+ * avl_set_parent(), avl_get_balance() and avl_set_balance(), which work with
+ * either layout.
+ *
+ * Both macros change the layout of the node, thus avl.c and all of its users
+ * must be built with the same settings.
  */
 typedef struct avl_node_s {
 	struct avl_node_s *avl_children[2];	/* Pointers to left child and right child */
+#ifdef AVL_COMPACT
+	uintptr_t avl_pbalance;			/* Parent pointer | (balance factor + 1) */
+#else
 	struct avl_node_s *avl_parent;		/* Pointer to parent node */
 	int avl_balance;			/* Balance factor */
+#endif
+#ifdef AVL_ORDER_STATISTICS
+	size_t avl_size;			/* Number of nodes in the subtree */
+#endif
 } avl_node_t;
 
+/*
+ * Augmentation routine provided by user
+ *
+ * It recomputes the augmented data of the node (e.g. the maximum endpoint of
+ * an interval tree, or the sum of a range-sum tree) from the node itself and
+ * its children, whose augmented data are up to date already.
+ *
+ * Return zero if the augmented data of the node did not change, otherwise
+ * non-zero.
+ */
+typedef int avl_augment_t(avl_node_t *node);
+
+/*
+ * Routine provided by user to dispose of a node removed from the tree
+ */
+typedef void avl_destroy_t(avl_node_t *node, void *arg);
+
+/*
+ * Routine provided by user to visit a node, see avl_range_foreach()
+ *
+ * Return zero to go on with the next node, otherwise non-zero to stop.
+ */
+typedef int avl_visit_t(avl_node_t *node, void *arg);
+
+/*
+ * Routine provided by user to move a node, see avl_relayout()
+ *
+ * It copies the object containing the node to its new place, links included,
+ * and returns the new address of the node. It may free the old object.
+ */
+typedef avl_node_t *avl_relocate_t(avl_node_t *node, void *arg);
+
+/*
+ * Orders in which avl_relayout() moves the nodes
+ */
+enum avl_layout {
+	AVL_LAYOUT_INORDER,			/* Key order, for iteration */
+	AVL_LAYOUT_BFS,				/* Level by level, from the root */
+	AVL_LAYOUT_VEB,				/* van Emde Boas, for lookups */
+};
+
 /*
  * A root structure that holds the whole AVL tree.
+ *
+ * If AVL_AUGMENT is defined, the root also holds an augmentation routine. If
+ * avl_augment is set, it is called on every node whose subtree changes, so
+ * that the augmented data is kept up to date on insertion, removal and
+ * rotation. It must be set while the tree is empty.
  */
 typedef struct avl_root_s {
 	avl_node_t *avl_root;			/* Pointer to the root node */
+#ifdef AVL_AUGMENT
+	avl_augment_t *avl_augment;		/* Augmentation routine, or NULL */
+#endif
 } avl_root_t;
 
+/*
+ * Initialize an empty tree, without augmentation
+ */
+static inline void avl_root_init(avl_root_t *avlroot)
+{
+	avlroot->avl_root = NULL;
+#ifdef AVL_AUGMENT
+	avlroot->avl_augment = NULL;
+#endif
+}
+
 /*
  * AVL comparsion routine provided by user
  */
 typedef int avl_cmp_t(avl_node_t *a, avl_node_t *b);
 
+/*
+ * AVL comparsion routine between a bare key and a node provided by user
+ *
+ * It returns a negative integer, zero or a positive integer if the key is
+ * less than, equal to or greater than the key of the node respectively.
+ */
+typedef int avl_keycmp_t(const void *key, avl_node_t *node);
+
+/*
+ * Prefetch routine provided by user
+ *
+ * It prefetches the data the comparison routine will touch when comparing a
+ * key with the node, e.g. a key stored out of the node. It is given to
+ * avl_search_many() and to the _prefetch forms of search and insertion.
+ */
+typedef void avl_prefetch_t(avl_node_t *node);
+
+/*
+ * State of building a tree from nodes arriving one at a time in sorted order,
+ * with avl_build_begin() and avl_build_push(). The tree is empty until the
+ * last node has arrived.
+ */
+typedef struct avl_builder_s {
+	avl_root_t *avlroot;			/* Tree being built */
+	avl_node_t *subtree;			/* Subtree most recently completed */
+	int depth;				/* Number of frames on the stack */
+	struct avl_build_frame_s {
+		size_t lo, hi;			/* Range of the subtree */
+		avl_node_t *node;		/* Root of the subtree, or NULL */
+	} stack[sizeof(size_t) * 8];
+} avl_builder_t;
+
+#ifdef AVL_STATS
+/*
+ * Counters of the work done by the calling thread, kept if AVL_STATS is
+ * defined, see avl_stats_get()
+ *
+ * The descents are those of avl_search(), avl_insert() and their bare key
+ * and _prefetch forms; their average depth is avl_depth_sum / avl_descents.
+ * The rotations are split by the three cases of avl_rebalance(): single
+ * rotation, double rotation, and single rotation leaving the height unchanged.
+ */
+typedef struct avl_stats_s {
+	unsigned long avl_compares;		/* Comparison routine calls */
+	unsigned long avl_descents;		/* Descents from the root */
+	unsigned long avl_depth_sum;		/* Nodes compared by the descents */
+	unsigned long avl_depth_max;		/* Deepest descent */
+	unsigned long avl_rotations[3];		/* Rebalances by case */
+	unsigned long avl_fixups;		/* Fix-up walks */
+	unsigned long avl_fixup_steps;		/* Nodes visited by them */
+} avl_stats_t;
+#endif
+
+/*
+ * Cursor for walking a tree in order
+ *
+ * It keeps the path from the root down to the current node, so that stepping
+ * never reads parent links and takes amortized O(1) time. The tree must not
+ * change while a cursor is in use; seek again after changing it.
+ */
+typedef struct avl_cursor_s {
+	int depth;				/* Number of nodes on the path */
+	avl_node_t *path[AVL_MAX_HEIGHT];	/* From the root to the current node */
+} avl_cursor_t;
+
+#ifdef AVL_COMPACT
+/*
+ * The node is at least 4-byte aligned, so the two low-order bits of the parent
+ * pointer are free to hold the balance factor, biased by one to [0,2].
+ */
+#define AVL_BALANCE_MASK ((uintptr_t)3)
+
+static inline avl_node_t *avl_get_parent(avl_node_t *node)
+{
+	return (avl_node_t *)(node->avl_pbalance & ~AVL_BALANCE_MASK);
+}
+
+static inline void avl_set_parent(avl_node_t *node, avl_node_t *parent)
+{
+	node->avl_pbalance = (uintptr_t)parent |
+	    (node->avl_pbalance & AVL_BALANCE_MASK);
+}
+
+static inline int avl_get_balance(avl_node_t *node)
+{
+	return (int)(node->avl_pbalance & AVL_BALANCE_MASK) - 1;
+}
+
+static inline void avl_set_balance(avl_node_t *node, int balance)
+{
+	node->avl_pbalance = (node->avl_pbalance & ~AVL_BALANCE_MASK) |
+	    (uintptr_t)(balance + 1);
+}
+#else
+static inline avl_node_t *avl_get_parent(avl_node_t *node)
+{
+	return node->avl_parent;
+}
+
+static inline void avl_set_parent(avl_node_t *node, avl_node_t *parent)
+{
+	node->avl_parent = parent;
+}
+
+static inline int avl_get_balance(avl_node_t *node)
+{
+	return node->avl_balance;
+}
+
+static inline void avl_set_balance(avl_node_t *node, int balance)
+{
+	node->avl_balance = balance;
+}
+#endif
+
 /*
  * Determine whether this node is the left or right child of
  * its parent.
@@ -71,7 +273,7 @@ static inline int avl_which_child(avl_node_t *node)
 {
 	avl_node_t *parent;
 
-	parent = node->avl_parent;
+	parent = avl_get_parent(node);
 	if (!parent)
 		return -1;
 
@@ -80,6 +282,19 @@ static inline int avl_which_child(avl_node_t *node)
 	return 1;
 }
 
+#ifdef AVL_ORDER_STATISTICS
+/*
+ * Get the number of nodes in the subtree rooted at this node, which may be
+ * NULL
+ */
+static inline size_t avl_subtree_size(avl_node_t *node)
+{
+	if (!node)
+		return 0;
+	return node->avl_size;
+}
+#endif
+
 /*
  * Determine whether the subtree rooted at this node is left-heavy or right-heavy
  */
@@ -93,12 +308,144 @@ static inline int avl_abs_balance(int balance)
 avl_node_t *
 avl_search(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc);
 
+avl_node_t *
+avl_search_key(avl_root_t *avlroot, const void *key, avl_keycmp_t *keycmp);
+
+avl_node_t *
+avl_search_prefetch(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc,
+    avl_prefetch_t *prefetch);
+
+avl_node_t *
+avl_search_key_prefetch(avl_root_t *avlroot, const void *key,
+    avl_keycmp_t *keycmp, avl_prefetch_t *prefetch);
+
+avl_node_t *
+avl_search_from(avl_node_t *start, avl_node_t *key, avl_cmp_t *cmpfunc);
+
+avl_node_t *
+avl_search_from_key(avl_node_t *start, const void *key, avl_keycmp_t *keycmp);
+
+void
+avl_search_many(avl_root_t *avlroot, const void *const *keys, size_t n,
+    avl_keycmp_t *keycmp, avl_prefetch_t *prefetch, avl_node_t **out);
+
+avl_node_t *
+avl_lower_bound(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc);
+
+avl_node_t *
+avl_upper_bound(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc);
+
+avl_node_t *
+avl_floor(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc);
+
+avl_node_t *
+avl_ceil(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc);
+
+avl_node_t *
+avl_lower_bound_key(avl_root_t *avlroot, const void *key, avl_keycmp_t *keycmp);
+
+avl_node_t *
+avl_upper_bound_key(avl_root_t *avlroot, const void *key, avl_keycmp_t *keycmp);
+
+avl_node_t *
+avl_floor_key(avl_root_t *avlroot, const void *key, avl_keycmp_t *keycmp);
+
+avl_node_t *
+avl_ceil_key(avl_root_t *avlroot, const void *key, avl_keycmp_t *keycmp);
+
+avl_node_t *
+avl_equal_range(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc,
+    avl_node_t **end);
+
+avl_node_t *
+avl_equal_range_key(avl_root_t *avlroot, const void *key, avl_keycmp_t *keycmp,
+    avl_node_t **end);
+
 avl_node_t *
 avl_insert(avl_root_t *avlroot, avl_node_t *node, avl_cmp_t *cmpfunc);
 
+avl_node_t *
+avl_insert_key(avl_root_t *avlroot, const void *key, avl_node_t *node,
+    avl_keycmp_t *keycmp);
+
+avl_node_t *
+avl_insert_prefetch(avl_root_t *avlroot, avl_node_t *node, avl_cmp_t *cmpfunc,
+    avl_prefetch_t *prefetch);
+
+avl_node_t *
+avl_insert_key_prefetch(avl_root_t *avlroot, const void *key, avl_node_t *node,
+    avl_keycmp_t *keycmp, avl_prefetch_t *prefetch);
+
+void
+avl_insert_multi(avl_root_t *avlroot, avl_node_t *node, avl_cmp_t *cmpfunc);
+
+void
+avl_insert_multi_key(avl_root_t *avlroot, const void *key, avl_node_t *node,
+    avl_keycmp_t *keycmp);
+
+avl_node_t *
+avl_insert_hint(avl_root_t *avlroot, avl_node_t *hint, avl_node_t *node,
+    avl_cmp_t *cmpfunc);
+
+size_t
+avl_insert_sorted_batch(avl_root_t *avlroot, avl_node_t **nodes, size_t n,
+    avl_cmp_t *cmpfunc);
+
+void
+avl_insert_at(avl_root_t *avlroot, avl_node_t *parent, int which_child,
+    avl_node_t *node);
+
 void
 avl_remove(avl_root_t *avlroot, avl_node_t *node);
 
+void
+avl_build_sorted(avl_root_t *avlroot, avl_node_t **nodes, size_t n);
+
+avl_node_t *
+avl_build_sorted_checked(avl_root_t *avlroot, avl_node_t **nodes, size_t n,
+    avl_cmp_t *cmpfunc);
+
+void
+avl_build_begin(avl_builder_t *b, avl_root_t *avlroot, size_t n);
+
+void
+avl_build_push(avl_builder_t *b, avl_node_t *node);
+
+void
+avl_join(avl_root_t *avlroot, avl_root_t *left, avl_node_t *pivot,
+    avl_root_t *right);
+
+void
+avl_split(avl_root_t *avlroot, avl_node_t *key, avl_cmp_t *cmpfunc,
+    avl_root_t *left, avl_root_t *right);
+
+void
+avl_split_key(avl_root_t *avlroot, const void *key, avl_keycmp_t *keycmp,
+    avl_root_t *left, avl_root_t *right);
+
+int
+avl_range_foreach(avl_root_t *avlroot, avl_node_t *lo, avl_node_t *hi,
+    avl_cmp_t *cmpfunc, avl_visit_t *fn, void *arg);
+
+int
+avl_range_foreach_key(avl_root_t *avlroot, const void *lo, const void *hi,
+    avl_keycmp_t *keycmp, avl_visit_t *fn, void *arg);
+
+size_t
+avl_remove_range(avl_root_t *avlroot, avl_node_t *lo, avl_node_t *hi,
+    avl_cmp_t *cmpfunc, avl_destroy_t *fn, void *arg);
+
+size_t
+avl_remove_range_key(avl_root_t *avlroot, const void *lo, const void *hi,
+    avl_keycmp_t *keycmp, avl_destroy_t *fn, void *arg);
+
+void
+avl_destroy(avl_root_t *avlroot, avl_destroy_t *fn, void *arg);
+
+void
+avl_relayout(avl_root_t *avlroot, enum avl_layout layout, avl_relocate_t *fn,
+    void *arg);
+
 avl_node_t *
 avl_first(avl_root_t *root);
 
@@ -111,6 +458,50 @@ avl_prev(avl_node_t *node);
 avl_node_t *
 avl_next(avl_node_t *node);
 
+avl_node_t *
+avl_cursor_first(avl_cursor_t *cursor, avl_root_t *avlroot);
+
+avl_node_t *
+avl_cursor_last(avl_cursor_t *cursor, avl_root_t *avlroot);
+
+avl_node_t *
+avl_cursor_seek(avl_cursor_t *cursor, avl_root_t *avlroot, avl_node_t *key,
+    avl_cmp_t *cmpfunc);
+
+avl_node_t *
+avl_cursor_seek_key(avl_cursor_t *cursor, avl_root_t *avlroot,
+    const void *key, avl_keycmp_t *keycmp);
+
+avl_node_t *
+avl_cursor_prev(avl_cursor_t *cursor);
+
+avl_node_t *
+avl_cursor_next(avl_cursor_t *cursor);
+
+/*
+ * Get the current node of the cursor, or NULL past either end
+ */
+static inline avl_node_t *avl_cursor_get(const avl_cursor_t *cursor)
+{
+	return cursor->depth ? cursor->path[cursor->depth - 1] : NULL;
+}
+
+#ifdef AVL_STATS
+void
+avl_stats_get(avl_stats_t *stats);
+
+void
+avl_stats_reset(void);
+#endif
+
+#ifdef AVL_ORDER_STATISTICS
+avl_node_t *
+avl_select(avl_root_t *avlroot, size_t k);
+
+size_t
+avl_rank(avl_root_t *avlroot, avl_node_t *node);
+#endif
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,560 @@
+/*
+ * Copyright 2017 Ka Ho Ng <ngkaho1234@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#ifndef __AVL_HPP__
+#define __AVL_HPP__
+
+#include "avl.h"
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <utility>
+
+namespace avl {
+
+/*
+ * Intrusive AVL tree of T linked through the avl_node_t data member Hook.
+ *
+ * Compare is a strict weak ordering on T in the style of std::less. Unlike
+ * avl_search() and avl_insert(), the descent is instantiated here and calls
+ * the comparator directly rather than through an avl_cmp_t pointer, thus the
+ * comparison can be inlined.
+ *
+ * The rebalancing and the removal are still done by the C routines, and the
+ * tree is a plain avl_root_t underneath. The root can be handed to C code via
+ * root(), so that mixed C/C++ code can share the same tree.
+ */
+template <class T, avl_node_t T::*Hook, class Compare = std::less<T> >
+class tree {
+public:
+	typedef T value_type;
+	typedef T &reference;
+	typedef const T &const_reference;
+	typedef T *pointer;
+	typedef const T *const_pointer;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef Compare value_compare;
+
+	/*
+	 * Bidirectional iterator over avl_next() and avl_prev()
+	 *
+	 * The past-the-end iterator holds a NULL node, decrementing it gives
+	 * the last element of the tree.
+	 */
+	template <class V>
+	class basic_iterator {
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef V *pointer;
+		typedef V &reference;
+
+		basic_iterator() : root_(NULL), node_(NULL) {}
+
+		/* Allow conversion from iterator to const_iterator */
+		template <class U>
+		basic_iterator(const basic_iterator<U> &it)
+		    : root_(it.root_), node_(it.node_) {}
+
+		reference operator*() const { return *value_of(node_); }
+		pointer operator->() const { return value_of(node_); }
+
+		basic_iterator &operator++()
+		{
+			node_ = avl_next(node_);
+			return *this;
+		}
+
+		basic_iterator operator++(int)
+		{
+			basic_iterator it = *this;
+			++*this;
+			return it;
+		}
+
+		basic_iterator &operator--()
+		{
+			node_ = node_ ? avl_prev(node_) : avl_last(root_);
+			return *this;
+		}
+
+		basic_iterator operator--(int)
+		{
+			basic_iterator it = *this;
+			--*this;
+			return it;
+		}
+
+		template <class U>
+		bool operator==(const basic_iterator<U> &it) const
+		{
+			return node_ == it.node_;
+		}
+
+		template <class U>
+		bool operator!=(const basic_iterator<U> &it) const
+		{
+			return node_ != it.node_;
+		}
+
+		/* The underlying AVL node, NULL for the past-the-end iterator */
+		avl_node_t *node() const { return node_; }
+
+	private:
+		friend class tree;
+		template <class U> friend class basic_iterator;
+
+		basic_iterator(avl_root_t *root, avl_node_t *node)
+		    : root_(root), node_(node) {}
+
+		avl_root_t *root_;
+		avl_node_t *node_;
+	};
+
+	typedef basic_iterator<T> iterator;
+	typedef basic_iterator<const T> const_iterator;
+	typedef std::reverse_iterator<iterator> reverse_iterator;
+	typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+	tree() : comp_() { avl_root_init(&root_); }
+	explicit tree(const Compare &comp) : comp_(comp) { avl_root_init(&root_); }
+
+#ifdef AVL_AUGMENT
+	/*
+	 * Create a tree whose augmented data is maintained by augment, see
+	 * avl_augment_t.
+	 */
+	explicit tree(avl_augment_t *augment, const Compare &comp = Compare())
+	    : comp_(comp)
+	{
+		avl_root_init(&root_);
+		root_.avl_augment = augment;
+	}
+#endif
+
+	/* The nodes are owned by the caller, so the tree cannot be copied */
+	tree(const tree &) = delete;
+	tree &operator=(const tree &) = delete;
+
+	/*
+	 * Get the underlying root structure so that the tree can be used with
+	 * the C routines.
+	 */
+	avl_root_t *root() { return &root_; }
+	const avl_root_t *root() const { return &root_; }
+
+	value_compare value_comp() const { return comp_; }
+
+	/*
+	 * Conversion between the element and its embedded AVL node
+	 */
+	static avl_node_t *node_of(T &value) { return &(value.*Hook); }
+	static const avl_node_t *node_of(const T &value) { return &(value.*Hook); }
+
+	static T *value_of(const avl_node_t *node)
+	{
+		return reinterpret_cast<T *>(
+		    const_cast<char *>(reinterpret_cast<const char *>(node)) -
+		    hook_offset());
+	}
+
+	bool empty() const { return !root_.avl_root; }
+
+	iterator begin() { return make_iterator(avl_first(&root_)); }
+	const_iterator begin() const { return make_iterator(avl_first(mutable_root())); }
+	const_iterator cbegin() const { return begin(); }
+	iterator end() { return make_iterator(NULL); }
+	const_iterator end() const { return make_iterator(NULL); }
+	const_iterator cend() const { return end(); }
+
+	reverse_iterator rbegin() { return reverse_iterator(end()); }
+	const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+	reverse_iterator rend() { return reverse_iterator(begin()); }
+	const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+	/* Get the iterator pointing at an element already in the tree */
+	iterator iterator_to(T &value) { return make_iterator(node_of(value)); }
+	const_iterator iterator_to(const T &value) const
+	{
+		return make_iterator(const_cast<avl_node_t *>(node_of(value)));
+	}
+
+	/*
+	 * Search for the element equivalent to key
+	 *
+	 * Return end() if no such element exists.
+	 */
+	iterator find(const T &key) { return make_iterator(do_find(key)); }
+	const_iterator find(const T &key) const { return make_iterator(do_find(key)); }
+
+	/*
+	 * Heterogeneous lookup, available if Compare declares is_transparent
+	 * and can compare K against T in both orders. The key needs not to be
+	 * wrapped into a T.
+	 */
+	template <class K, class C = Compare, class = typename C::is_transparent>
+	iterator find(const K &key) { return make_iterator(do_find(key)); }
+	template <class K, class C = Compare, class = typename C::is_transparent>
+	const_iterator find(const K &key) const { return make_iterator(do_find(key)); }
+
+	/*
+	 * Search for the first element that is not less than key
+	 *
+	 * Return end() if no such element exists.
+	 */
+	iterator lower_bound(const T &key) { return make_iterator(do_lower_bound(key)); }
+	const_iterator lower_bound(const T &key) const
+	{
+		return make_iterator(do_lower_bound(key));
+	}
+
+	template <class K, class C = Compare, class = typename C::is_transparent>
+	iterator lower_bound(const K &key) { return make_iterator(do_lower_bound(key)); }
+	template <class K, class C = Compare, class = typename C::is_transparent>
+	const_iterator lower_bound(const K &key) const
+	{
+		return make_iterator(do_lower_bound(key));
+	}
+
+	/*
+	 * Search for the first element that is greater than key
+	 *
+	 * Return end() if no such element exists.
+	 */
+	iterator upper_bound(const T &key) { return make_iterator(do_upper_bound(key)); }
+	const_iterator upper_bound(const T &key) const
+	{
+		return make_iterator(do_upper_bound(key));
+	}
+
+	template <class K, class C = Compare, class = typename C::is_transparent>
+	iterator upper_bound(const K &key) { return make_iterator(do_upper_bound(key)); }
+	template <class K, class C = Compare, class = typename C::is_transparent>
+	const_iterator upper_bound(const K &key) const
+	{
+		return make_iterator(do_upper_bound(key));
+	}
+
+	/*
+	 * Search for the elements equivalent to key in a single descent, see
+	 * avl_equal_range()
+	 *
+	 * Return the range of them, [lower_bound(key), upper_bound(key)).
+	 */
+	std::pair<iterator, iterator> equal_range(const T &key)
+	{
+		return make_range(key);
+	}
+	std::pair<const_iterator, const_iterator> equal_range(const T &key) const
+	{
+		return make_range(key);
+	}
+
+	template <class K, class C = Compare, class = typename C::is_transparent>
+	std::pair<iterator, iterator> equal_range(const K &key)
+	{
+		return make_range(key);
+	}
+	template <class K, class C = Compare, class = typename C::is_transparent>
+	std::pair<const_iterator, const_iterator> equal_range(const K &key) const
+	{
+		return make_range(key);
+	}
+
+	/*
+	 * Insert an element into the tree
+	 *
+	 * Return the iterator pointing at the element equivalent to value and
+	 * whether value has been inserted. Like avl_insert(), nothing is
+	 * inserted if an equivalent element already exists.
+	 */
+	std::pair<iterator, bool> insert(T &value)
+	{
+		int which_child = 0;
+		avl_node_t *cur, *parent;
+
+		cur = root_.avl_root;
+		parent = NULL;
+		while (cur) {
+			const T &v = *value_of(cur);
+
+			if (comp_(value, v))
+				which_child = 0;
+			else if (comp_(v, value))
+				which_child = 1;
+			else
+				return std::make_pair(make_iterator(cur), false);
+			parent = cur;
+			cur = cur->avl_children[which_child];
+		}
+
+		avl_insert_at(&root_, parent, which_child, node_of(value));
+		return std::make_pair(make_iterator(node_of(value)), true);
+	}
+
+	/*
+	 * Insert an element into the tree even if equivalent elements exist,
+	 * see avl_insert_multi()
+	 *
+	 * The element goes after the elements equivalent to it. Return the
+	 * iterator pointing at it.
+	 */
+	iterator insert_multi(T &value)
+	{
+		int which_child = 0;
+		avl_node_t *cur, *parent;
+
+		cur = root_.avl_root;
+		parent = NULL;
+		while (cur) {
+			which_child = !comp_(value, *value_of(cur));
+			parent = cur;
+			cur = cur->avl_children[which_child];
+		}
+
+		avl_insert_at(&root_, parent, which_child, node_of(value));
+		return make_iterator(node_of(value));
+	}
+
+	/*
+	 * Insert an element next to hint, see avl_insert_hint()
+	 *
+	 * If value belongs right before or right after the element pointed at
+	 * by hint, it is attached without a descent. end() stands for the last
+	 * element. Return the iterator pointing at the element equivalent to
+	 * value.
+	 */
+	iterator insert(const_iterator hint, T &value)
+	{
+		int which_child;
+		avl_node_t *node, *neighbour;
+
+		node = hint.node_ ? hint.node_ : avl_last(&root_);
+		if (!node)
+			return insert(value).first;
+
+		if (comp_(value, *value_of(node)))
+			which_child = 0;
+		else if (comp_(*value_of(node), value))
+			which_child = 1;
+		else
+			return make_iterator(node);
+
+		neighbour = which_child ? avl_next(node) : avl_prev(node);
+		if (neighbour) {
+			const T &v = *value_of(neighbour);
+
+			if (which_child ? !comp_(value, v) : !comp_(v, value))
+				return insert(value).first;
+		}
+
+		if (!node->avl_children[which_child])
+			avl_insert_at(&root_, node, which_child, node_of(value));
+		else
+			avl_insert_at(&root_, neighbour, !which_child, node_of(value));
+		return make_iterator(node_of(value));
+	}
+
+	/*
+	 * Remove the element pointed at by the iterator
+	 *
+	 * Return the iterator following the removed element.
+	 */
+	iterator erase(const_iterator it)
+	{
+		avl_node_t *next = avl_next(it.node_);
+
+		avl_remove(&root_, it.node_);
+		return make_iterator(next);
+	}
+
+	void erase(T &value) { avl_remove(&root_, node_of(value)); }
+
+	/*
+	 * Remove every element, see avl_destroy()
+	 *
+	 * clear_and_dispose() calls disposer(T *) on every element after
+	 * unlinking it, so that the element can be released.
+	 */
+	void clear() { avl_destroy(&root_, NULL, NULL); }
+
+	template <class Disposer>
+	void clear_and_dispose(Disposer disposer)
+	{
+		avl_destroy(&root_, &dispose<Disposer>, &disposer);
+	}
+
+private:
+	static std::ptrdiff_t hook_offset()
+	{
+		/* offsetof() for a pointer to data member */
+		const T *value = reinterpret_cast<const T *>(sizeof(T));
+
+		return reinterpret_cast<const char *>(&(value->*Hook)) -
+		    reinterpret_cast<const char *>(value);
+	}
+
+	template <class Disposer>
+	static void dispose(avl_node_t *node, void *arg)
+	{
+		(*static_cast<Disposer *>(arg))(value_of(node));
+	}
+
+	avl_root_t *mutable_root() const { return const_cast<avl_root_t *>(&root_); }
+
+	iterator make_iterator(avl_node_t *node) { return iterator(&root_, node); }
+	const_iterator make_iterator(avl_node_t *node) const
+	{
+		return const_iterator(mutable_root(), node);
+	}
+
+	template <class K>
+	avl_node_t *do_find(const K &key) const
+	{
+		avl_node_t *cur = root_.avl_root;
+
+		while (cur) {
+			const T &v = *value_of(cur);
+
+			if (comp_(key, v))
+				cur = cur->avl_children[0];
+			else if (comp_(v, key))
+				cur = cur->avl_children[1];
+			else
+				break;
+		}
+		return cur;
+	}
+
+	template <class K>
+	avl_node_t *do_lower_bound(const K &key) const
+	{
+		avl_node_t *cur = root_.avl_root;
+		avl_node_t *candidate = NULL;
+
+		while (cur) {
+			if (!comp_(*value_of(cur), key)) {
+				/* cur is a candidate, but a closer one may
+				 * exist in the left subtree */
+				candidate = cur;
+				cur = cur->avl_children[0];
+			} else {
+				cur = cur->avl_children[1];
+			}
+		}
+		return candidate;
+	}
+
+	template <class K>
+	avl_node_t *do_upper_bound(const K &key) const
+	{
+		avl_node_t *cur = root_.avl_root;
+		avl_node_t *candidate = NULL;
+
+		while (cur) {
+			if (comp_(key, *value_of(cur))) {
+				candidate = cur;
+				cur = cur->avl_children[0];
+			} else {
+				cur = cur->avl_children[1];
+			}
+		}
+		return candidate;
+	}
+
+	template <class K>
+	std::pair<avl_node_t *, avl_node_t *> do_equal_range(const K &key) const
+	{
+		avl_node_t *cur = root_.avl_root;
+		avl_node_t *lower = NULL, *upper = NULL, *node;
+
+		while (cur) {
+			const T &v = *value_of(cur);
+
+			if (comp_(key, v)) {
+				lower = upper = cur;
+				cur = cur->avl_children[0];
+			} else if (comp_(v, key)) {
+				cur = cur->avl_children[1];
+			} else {
+				break;
+			}
+		}
+		if (!cur)
+			return std::make_pair(lower, upper);
+
+		/* The bounds are below the first equivalent element */
+		lower = cur;
+		for (node = cur->avl_children[0]; node; ) {
+			if (!comp_(*value_of(node), key)) {
+				lower = node;
+				node = node->avl_children[0];
+			} else {
+				node = node->avl_children[1];
+			}
+		}
+		for (node = cur->avl_children[1]; node; ) {
+			if (comp_(key, *value_of(node))) {
+				upper = node;
+				node = node->avl_children[0];
+			} else {
+				node = node->avl_children[1];
+			}
+		}
+		return std::make_pair(lower, upper);
+	}
+
+	template <class K>
+	std::pair<iterator, iterator> make_range(const K &key)
+	{
+		std::pair<avl_node_t *, avl_node_t *> r = do_equal_range(key);
+
+		return std::make_pair(make_iterator(r.first),
+		    make_iterator(r.second));
+	}
+
+	template <class K>
+	std::pair<const_iterator, const_iterator> make_range(const K &key) const
+	{
+		std::pair<avl_node_t *, avl_node_t *> r = do_equal_range(key);
+
+		return std::make_pair(make_iterator(r.first),
+		    make_iterator(r.second));
+	}
+
+	avl_root_t root_;
+	Compare comp_;
+};
+
+} /* namespace avl */
+
+#endif /* __AVL_HPP__ */
@@ -0,0 +1,655 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <sched.h>
+#include <stddef.h>
+#include "avl_conc.h"
+
+#define avl_cmp2idx(cmp) (!((cmp) < 0))
+
+/*
+ * State bits of avl_version. The version of a node changes whenever its
+ * subtree may lose some keys, i.e. when it is rotated down or unlinked.
+ */
+#define AVL_CONC_UNLINKED	1u		/* Unlinked from the tree */
+#define AVL_CONC_SHRINKING	2u		/* Being rotated down */
+#define AVL_CONC_SHRINK_COUNT	4u		/* Increment per rotation */
+
+/*
+ * What a node needs, as returned by avl_conc_condition(). Any other value is
+ * the correct height of the node, which it does not have.
+ */
+#define AVL_CONC_NOTHING	(-1)
+#define AVL_CONC_UNLINK		(-2)
+#define AVL_CONC_REBALANCE	(-3)
+
+/*
+ * The key to look for, either given as a node compared with cmpfunc or as a
+ * bare key compared with keycmp
+ */
+struct avl_conc_key {
+	const void *key;
+	avl_conc_cmp_t *cmpfunc;
+	avl_conc_keycmp_t *keycmp;
+};
+
+static inline int
+avl_conc_key_cmp(const struct avl_conc_key *key, avl_conc_node_t *node)
+{
+	if (key->cmpfunc)
+		return key->cmpfunc((avl_conc_node_t *)key->key, node);
+	return key->keycmp(key->key, node);
+}
+
+/*
+ * Accessors of the fields read without holding the lock of the node
+ */
+static inline avl_conc_node_t *
+avl_conc_child(avl_conc_node_t *node, int which_child)
+{
+	return __atomic_load_n(&node->avl_children[which_child],
+	    __ATOMIC_ACQUIRE);
+}
+
+static inline void
+avl_conc_set_child(avl_conc_node_t *node, int which_child,
+    avl_conc_node_t *child)
+{
+	__atomic_store_n(&node->avl_children[which_child], child,
+	    __ATOMIC_RELEASE);
+	if (child)
+		__atomic_store_n(&child->avl_parent, node, __ATOMIC_RELEASE);
+}
+
+static inline avl_conc_node_t *
+avl_conc_parent(avl_conc_node_t *node)
+{
+	return __atomic_load_n(&node->avl_parent, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t
+avl_conc_version(avl_conc_node_t *node)
+{
+	return __atomic_load_n(&node->avl_version, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+avl_conc_set_version(avl_conc_node_t *node, uint32_t version)
+{
+	__atomic_store_n(&node->avl_version, version, __ATOMIC_SEQ_CST);
+}
+
+static inline int
+avl_conc_height(avl_conc_node_t *node)
+{
+	return node ? __atomic_load_n(&node->avl_height, __ATOMIC_RELAXED) : 0;
+}
+
+static inline void
+avl_conc_set_height(avl_conc_node_t *node, int height)
+{
+	__atomic_store_n(&node->avl_height, height, __ATOMIC_RELAXED);
+}
+
+static inline int
+avl_conc_is_routing(avl_conc_node_t *node)
+{
+	return __atomic_load_n(&node->avl_routing, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+avl_conc_lock(avl_conc_node_t *node)
+{
+	while (__atomic_exchange_n(&node->avl_lock, 1, __ATOMIC_ACQUIRE)) {
+		int spin = 0;
+
+		/* The holder may not be running, so give it a chance to
+		 * release the lock after a while */
+		while (__atomic_load_n(&node->avl_lock, __ATOMIC_RELAXED))
+			if (++spin > 64)
+				sched_yield();
+	}
+}
+
+static inline void
+avl_conc_unlock(avl_conc_node_t *node)
+{
+	__atomic_store_n(&node->avl_lock, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * State of a fix-up step
+ */
+struct avl_conc_fixup {
+	avl_conc_node_t *released;		/* Node unlinked by the step */
+	int rotated;				/* Whether a rotation was done */
+};
+
+static inline int
+avl_conc_max(int a, int b)
+{
+	return a < b ? b : a;
+}
+
+/*
+ * Initialize an empty tree. @release is called with @arg and every removed
+ * node once it is unlinked, if it is not NULL.
+ */
+void
+avl_conc_init(avl_conc_root_t *avlroot, avl_conc_release_t *release,
+    void *arg)
+{
+	avl_conc_node_t *holder = &avlroot->avl_holder;
+
+	holder->avl_children[0] = holder->avl_children[1] = NULL;
+	holder->avl_parent = NULL;
+	holder->avl_version = 0;
+	holder->avl_height = 0;
+	holder->avl_lock = 0;
+	holder->avl_routing = 0;
+	avlroot->avl_release = release;
+	avlroot->avl_arg = arg;
+}
+
+/*
+ * Return what the node needs: to be unlinked if it is a routing node with at
+ * most one child, to be rotated if it is out of balance, or its height to be
+ * fixed.
+ */
+static int
+avl_conc_condition(avl_conc_node_t *node)
+{
+	int height, lheight, rheight, balance;
+	avl_conc_node_t *left, *right;
+
+	left = avl_conc_child(node, 0);
+	right = avl_conc_child(node, 1);
+	if ((!left || !right) && avl_conc_is_routing(node))
+		return AVL_CONC_UNLINK;
+
+	lheight = avl_conc_height(left);
+	rheight = avl_conc_height(right);
+	balance = rheight - lheight;
+	if (balance < -1 || balance > 1)
+		return AVL_CONC_REBALANCE;
+	height = 1 + avl_conc_max(lheight, rheight);
+	return height != avl_conc_height(node) ? height : AVL_CONC_NOTHING;
+}
+
+/*
+ * Fix the height of a locked node.
+ *
+ * Return the next node to look at: the node itself if it needs more than
+ * that, its parent if its height has changed, or NULL.
+ */
+static avl_conc_node_t *
+avl_conc_fix_height(avl_conc_node_t *node)
+{
+	int cond;
+
+	if (!avl_conc_parent(node))
+		/* The holder */
+		return NULL;
+	cond = avl_conc_condition(node);
+	if (cond == AVL_CONC_UNLINK || cond == AVL_CONC_REBALANCE)
+		return node;
+	if (cond == AVL_CONC_NOTHING)
+		return NULL;
+	avl_conc_set_height(node, cond);
+	return avl_conc_parent(node);
+}
+
+/*
+ * Unlink a routing node with at most one child. Both @parent and @node are
+ * locked.
+ *
+ * Return 1 on success, or 0 if @node is not a child of @parent anymore or
+ * has two children.
+ */
+static int
+avl_conc_unlink(avl_conc_node_t *parent, avl_conc_node_t *node)
+{
+	int which_child;
+	avl_conc_node_t *splice;
+
+	if (parent->avl_children[0] == node)
+		which_child = 0;
+	else if (parent->avl_children[1] == node)
+		which_child = 1;
+	else
+		return 0;
+	if (node->avl_children[0] && node->avl_children[1])
+		return 0;
+
+	splice = node->avl_children[!node->avl_children[0]];
+	avl_conc_set_child(parent, which_child, splice);
+	avl_conc_set_version(node, AVL_CONC_UNLINKED);
+	return 1;
+}
+
+/*
+ * Single rotation of the locked @node with its locked child @child on the
+ * @which_child side, which is too tall. @inner is the child of @child towards
+ * @node, @hother, @houter and @hinner the heights of the other child of @node
+ * and of the children of @child.
+ *
+ *      **N              C
+ *       / \            / \
+ *     *C   O   ->     X   N
+ *     / \                / \
+ *    X   I              I   O
+ *
+ * Return the next node to look at.
+ */
+static avl_conc_node_t *
+avl_conc_rotate(avl_conc_node_t *parent, avl_conc_node_t *node,
+    avl_conc_node_t *child, int which_child, int hother, int houter,
+    avl_conc_node_t *inner, int hinner, struct avl_conc_fixup *fixup)
+{
+	int slot, hnode, balance;
+	uint32_t version = node->avl_version;
+
+	slot = parent->avl_children[1] == node;
+
+	/*
+	 * @node moves down, thus loses the keys of the outer subtree of
+	 * @child. The links are changed in an order that never makes a
+	 * cycle.
+	 */
+	avl_conc_set_version(node, version | AVL_CONC_SHRINKING);
+	avl_conc_set_child(node, which_child, inner);
+	avl_conc_set_child(child, !which_child, node);
+	avl_conc_set_child(parent, slot, child);
+
+	hnode = 1 + avl_conc_max(hinner, hother);
+	avl_conc_set_height(node, hnode);
+	avl_conc_set_height(child, 1 + avl_conc_max(houter, hnode));
+	avl_conc_set_version(node, version + AVL_CONC_SHRINK_COUNT);
+	fixup->rotated = 1;
+
+	/* The heights used for the rotation may be stale, check again */
+	balance = hinner - hother;
+	if (balance < -1 || balance > 1)
+		return node;
+	if ((!inner || !hother) && avl_conc_is_routing(node))
+		return node;
+	balance = houter - hnode;
+	if (balance < -1 || balance > 1)
+		return child;
+	if (!houter && avl_conc_is_routing(child))
+		return child;
+	return avl_conc_fix_height(parent);
+}
+
+/*
+ * Double rotation of the locked @node, its child @child on the @which_child
+ * side and the inner child @inner of @child, all locked. @hinner is the
+ * height of the child of @inner on the @which_child side.
+ *
+ *      **N                I
+ *       / \             /   \
+ *      C*  O   ->      C     N
+ *     / \             / \   / \
+ *    X   I*          X   A B   O
+ *       / \
+ *      A   B
+ *
+ * Return the next node to look at.
+ */
+static avl_conc_node_t *
+avl_conc_rotate_double(avl_conc_node_t *parent, avl_conc_node_t *node,
+    avl_conc_node_t *child, int which_child, int hother, int houter,
+    avl_conc_node_t *inner, int hinner, struct avl_conc_fixup *fixup)
+{
+	int slot, hnode, hchild, hb, balance;
+	uint32_t nversion = node->avl_version;
+	uint32_t cversion = child->avl_version;
+	avl_conc_node_t *a = inner->avl_children[which_child];
+	avl_conc_node_t *b = inner->avl_children[!which_child];
+
+	slot = parent->avl_children[1] == node;
+	hb = avl_conc_height(b);
+
+	/* Both @node and @child move down */
+	avl_conc_set_version(node, nversion | AVL_CONC_SHRINKING);
+	avl_conc_set_version(child, cversion | AVL_CONC_SHRINKING);
+	avl_conc_set_child(node, which_child, b);
+	avl_conc_set_child(child, !which_child, a);
+	avl_conc_set_child(inner, which_child, child);
+	avl_conc_set_child(inner, !which_child, node);
+	avl_conc_set_child(parent, slot, inner);
+
+	hnode = 1 + avl_conc_max(hb, hother);
+	hchild = 1 + avl_conc_max(houter, hinner);
+	avl_conc_set_height(node, hnode);
+	avl_conc_set_height(child, hchild);
+	avl_conc_set_height(inner, 1 + avl_conc_max(hnode, hchild));
+	avl_conc_set_version(node, nversion + AVL_CONC_SHRINK_COUNT);
+	avl_conc_set_version(child, cversion + AVL_CONC_SHRINK_COUNT);
+	fixup->rotated = 1;
+
+	balance = hb - hother;
+	if (balance < -1 || balance > 1)
+		return node;
+	if ((!b || !hother) && avl_conc_is_routing(node))
+		return node;
+	/* @child is left out of balance if @inner was, and is left with a
+	 * single child if the side of @inner it takes was empty */
+	balance = hinner - houter;
+	if (balance < -1 || balance > 1)
+		return child;
+	if ((!a || !houter) && avl_conc_is_routing(child))
+		return child;
+	balance = hchild - hnode;
+	if (balance < -1 || balance > 1)
+		return inner;
+	return avl_conc_fix_height(parent);
+}
+
+/*
+ * Rotate the locked @node whose subtree on the @which_child side is too tall
+ * compared to the other one, of height @hother
+ *
+ * Return the next node to look at.
+ */
+static avl_conc_node_t *
+avl_conc_rebalance_to(avl_conc_node_t *parent, avl_conc_node_t *node,
+    int which_child, int hother, struct avl_conc_fixup *fixup)
+{
+	int houter, hinner;
+	avl_conc_node_t *child, *inner, *next;
+
+	child = node->avl_children[which_child];
+	avl_conc_lock(child);
+	if (avl_conc_height(child) - hother <= 1) {
+		/* Fixed in the meantime */
+		avl_conc_unlock(child);
+		return node;
+	}
+
+	inner = child->avl_children[!which_child];
+	houter = avl_conc_height(child->avl_children[which_child]);
+	hinner = avl_conc_height(inner);
+	if (houter >= hinner) {
+		next = avl_conc_rotate(parent, node, child, which_child,
+		    hother, houter, inner, hinner, fixup);
+		avl_conc_unlock(child);
+		return next;
+	}
+
+	avl_conc_lock(inner);
+	hinner = avl_conc_height(inner);
+	if (houter >= hinner) {
+		next = avl_conc_rotate(parent, node, child, which_child,
+		    hother, houter, inner, hinner, fixup);
+		avl_conc_unlock(inner);
+		avl_conc_unlock(child);
+		return next;
+	}
+
+	hinner = avl_conc_height(inner->avl_children[which_child]);
+	next = avl_conc_rotate_double(parent, node, child, which_child,
+	    hother, houter, inner, hinner, fixup);
+	avl_conc_unlock(inner);
+	avl_conc_unlock(child);
+	return next;
+}
+
+/*
+ * Unlink, rotate or fix the height of the locked @node, as it needs. @parent
+ * is locked as well.
+ *
+ * Return the next node to look at.
+ */
+static avl_conc_node_t *
+avl_conc_rebalance(avl_conc_node_t *parent, avl_conc_node_t *node,
+    struct avl_conc_fixup *fixup)
+{
+	int height, lheight, rheight, balance;
+	avl_conc_node_t *left = node->avl_children[0];
+	avl_conc_node_t *right = node->avl_children[1];
+
+	if ((!left || !right) && avl_conc_is_routing(node)) {
+		if (!avl_conc_unlink(parent, node))
+			return node;
+		fixup->released = node;
+		return avl_conc_fix_height(parent);
+	}
+
+	lheight = avl_conc_height(left);
+	rheight = avl_conc_height(right);
+	balance = rheight - lheight;
+	if (balance < -1)
+		return avl_conc_rebalance_to(parent, node, 0, rheight, fixup);
+	if (balance > 1)
+		return avl_conc_rebalance_to(parent, node, 1, lheight, fixup);
+
+	height = 1 + avl_conc_max(lheight, rheight);
+	if (height != avl_conc_height(node)) {
+		avl_conc_set_height(node, height);
+		return avl_conc_fix_height(parent);
+	}
+	return NULL;
+}
+
+/*
+ * Walk up from @node, fixing heights, rotating and unlinking routing nodes
+ * until no node needs it
+ */
+static void
+avl_conc_fix(avl_conc_root_t *avlroot, avl_conc_node_t *node)
+{
+	while (node && node != &avlroot->avl_holder) {
+		int cond;
+		avl_conc_node_t *parent, *next, *resume = NULL;
+		struct avl_conc_fixup fixup = { NULL, 0 };
+
+		cond = avl_conc_condition(node);
+		if (cond == AVL_CONC_NOTHING ||
+		    (avl_conc_version(node) & AVL_CONC_UNLINKED))
+			return;
+
+		if (cond != AVL_CONC_UNLINK && cond != AVL_CONC_REBALANCE) {
+			avl_conc_lock(node);
+			next = avl_conc_fix_height(node);
+			avl_conc_unlock(node);
+			node = next;
+			continue;
+		}
+
+		/* The parent of a node only changes with the parent locked */
+		parent = avl_conc_parent(node);
+		avl_conc_lock(parent);
+		next = node;
+		if (!(avl_conc_version(parent) & AVL_CONC_UNLINKED) &&
+		    avl_conc_parent(node) == parent) {
+			/* An unlinked node keeps its parent pointer, so check
+			 * again with the node locked */
+			avl_conc_lock(node);
+			if (node->avl_version & AVL_CONC_UNLINKED)
+				next = NULL;
+			else
+				next = avl_conc_rebalance(parent, node, &fixup);
+			avl_conc_unlock(node);
+
+			/*
+			 * A rotation may leave one of the nodes it moved in
+			 * need of another step. The height of @parent is fixed
+			 * after that, as the subtree may have shrunk.
+			 */
+			if (fixup.rotated && next && next != parent &&
+			    next != avl_conc_parent(parent))
+				resume = parent;
+		}
+		avl_conc_unlock(parent);
+
+		if (fixup.released && avlroot->avl_release)
+			avlroot->avl_release(fixup.released, avlroot->avl_arg);
+		if (resume) {
+			avl_conc_fix(avlroot, next);
+			next = resume;
+		}
+		node = next;
+	}
+}
+
+/*
+ * Look for @key, and insert @node at its place if it is not NULL and the key
+ * is not found.
+ *
+ * Every node is reached from its parent by reading the link, then the version
+ * of the child, then validating that the version of the parent has not
+ * changed. If it has, the parent may have been rotated away from the key
+ * meanwhile, and the lookup starts over.
+ *
+ * A routing node with the same key as @key is treated as a smaller key, so
+ * a live node with the same key is always on its right.
+ */
+static avl_conc_node_t *
+avl_conc_lookup(avl_conc_root_t *avlroot, const struct avl_conc_key *key,
+    avl_conc_node_t *node)
+{
+	int which_child;
+	uint32_t version, cversion;
+	avl_conc_node_t *cur, *child;
+
+retry:
+	cur = &avlroot->avl_holder;
+	which_child = 1;
+	version = avl_conc_version(cur);
+	for (;;) {
+		int cmp;
+
+		child = avl_conc_child(cur, which_child);
+		if (!child) {
+			if (!node) {
+				if (avl_conc_version(cur) != version)
+					goto retry;
+				return NULL;
+			}
+
+			avl_conc_lock(cur);
+			if (avl_conc_version(cur) != version) {
+				avl_conc_unlock(cur);
+				goto retry;
+			}
+			if (cur->avl_children[which_child]) {
+				/* Another node was inserted there */
+				avl_conc_unlock(cur);
+				continue;
+			}
+			node->avl_children[0] = node->avl_children[1] = NULL;
+			node->avl_version = 0;
+			node->avl_height = 1;
+			node->avl_lock = 0;
+			node->avl_routing = 0;
+			avl_conc_set_child(cur, which_child, node);
+			avl_conc_unlock(cur);
+
+			avl_conc_fix(avlroot, cur);
+			return node;
+		}
+
+		cmp = avl_conc_key_cmp(key, child);
+		if (!cmp) {
+			if (!avl_conc_is_routing(child))
+				return child;
+			cmp = 1;
+		}
+
+		cversion = avl_conc_version(child);
+		if (cversion & AVL_CONC_SHRINKING) {
+			/* Wait for the rotation, which holds the lock */
+			avl_conc_lock(child);
+			avl_conc_unlock(child);
+		} else if (!(cversion & AVL_CONC_UNLINKED) &&
+		    child == avl_conc_child(cur, which_child)) {
+			if (avl_conc_version(cur) != version)
+				goto retry;
+			cur = child;
+			version = cversion;
+			which_child = avl_cmp2idx(cmp);
+			continue;
+		}
+
+		/* The child has changed, read it again unless @cur has
+		 * changed as well */
+		if (avl_conc_version(cur) != version)
+			goto retry;
+	}
+}
+
+/*
+ * Search routines, same as avl_search() and avl_search_key()
+ */
+avl_conc_node_t *
+avl_conc_search(avl_conc_root_t *avlroot, avl_conc_node_t *key,
+    avl_conc_cmp_t *cmpfunc)
+{
+	struct avl_conc_key k = { key, cmpfunc, NULL };
+
+	return avl_conc_lookup(avlroot, &k, NULL);
+}
+
+avl_conc_node_t *
+avl_conc_search_key(avl_conc_root_t *avlroot, const void *key,
+    avl_conc_keycmp_t *keycmp)
+{
+	struct avl_conc_key k = { key, NULL, keycmp };
+
+	return avl_conc_lookup(avlroot, &k, NULL);
+}
+
+/*
+ * Insert a new node into the tree
+ *
+ * Return the node with the same key as node parameter, like avl_insert().
+ */
+avl_conc_node_t *
+avl_conc_insert(avl_conc_root_t *avlroot, avl_conc_node_t *node,
+    avl_conc_cmp_t *cmpfunc)
+{
+	struct avl_conc_key k = { node, cmpfunc, NULL };
+
+	return avl_conc_lookup(avlroot, &k, node);
+}
+
+/*
+ * Remove a node from the tree. The node is not found by lookups anymore from
+ * then on, and is handed to the release routine once it is unlinked.
+ */
+void
+avl_conc_remove(avl_conc_root_t *avlroot, avl_conc_node_t *node)
+{
+	avl_conc_lock(node);
+	__atomic_store_n(&node->avl_routing, 1, __ATOMIC_RELEASE);
+	avl_conc_unlock(node);
+
+	avl_conc_fix(avlroot, node);
+}
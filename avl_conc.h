@@ -0,0 +1,119 @@
+/*
+ * Copyright 2017 Ka Ho Ng <ngkaho1234@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#ifndef __AVL_CONC_H__
+#define __AVL_CONC_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Concurrent AVL tree
+ *
+ * This is a relaxed-balance AVL tree after Bronson et al., "A Practical
+ * Concurrent Binary Search Tree" (PPoPP 2010). Any number of threads can
+ * search, insert and remove at the same time:
+ *
+ * - Lookups take no lock. They walk down the tree hand over hand, validating
+ *   the version of each node after reading the link to its child. A rotation
+ *   bumps the version of the nodes it moves down, so that a lookup which may
+ *   have been misled by it starts over.
+ * - Insertions and removals lock the nodes they change, top-down, and restore
+ *   the balance of the tree (from the height kept in every node) on the way
+ *   back up. Updates in disjoint parts of the tree thus proceed in parallel.
+ *
+ * A node with two children cannot be unlinked without moving another node,
+ * so avl_conc_remove() only turns it into a routing node: it stays in the tree
+ * to direct lookups but is not found anymore, and it is unlinked later once it
+ * has at most one child. The release routine is called when a removed node
+ * has been unlinked. Lookups may still be walking through it at that time, so
+ * it must only be freed or reused once all operations that started before are
+ * over, e.g. through an epoch or RCU scheme.
+ */
+typedef struct avl_conc_node_s {
+	struct avl_conc_node_s *avl_children[2];	/* Pointers to left child and right child */
+	struct avl_conc_node_s *avl_parent;		/* Pointer to parent node */
+	uint32_t avl_version;				/* Shrink count and state bits */
+	int32_t avl_height;				/* Height of the subtree */
+	int32_t avl_lock;				/* Spin lock */
+	int32_t avl_routing;				/* Removed, only routes lookups */
+} avl_conc_node_t;
+
+/*
+ * Release routine provided by user, called with a removed node once it has
+ * been unlinked from the tree
+ */
+typedef void avl_conc_release_t(avl_conc_node_t *node, void *arg);
+
+/*
+ * A root structure that holds the whole AVL tree
+ */
+typedef struct avl_conc_root_s {
+	avl_conc_node_t avl_holder;		/* Sentinel, the root is its right child */
+	avl_conc_release_t *avl_release;	/* Release routine, or NULL */
+	void *avl_arg;				/* Argument to avl_release */
+} avl_conc_root_t;
+
+/*
+ * AVL comparsion routine provided by user
+ */
+typedef int avl_conc_cmp_t(avl_conc_node_t *a, avl_conc_node_t *b);
+
+/*
+ * AVL comparsion routine between a bare key and a node provided by user
+ */
+typedef int avl_conc_keycmp_t(const void *key, avl_conc_node_t *node);
+
+void
+avl_conc_init(avl_conc_root_t *avlroot, avl_conc_release_t *release,
+    void *arg);
+
+avl_conc_node_t *
+avl_conc_search(avl_conc_root_t *avlroot, avl_conc_node_t *key,
+    avl_conc_cmp_t *cmpfunc);
+
+avl_conc_node_t *
+avl_conc_search_key(avl_conc_root_t *avlroot, const void *key,
+    avl_conc_keycmp_t *keycmp);
+
+avl_conc_node_t *
+avl_conc_insert(avl_conc_root_t *avlroot, avl_conc_node_t *node,
+    avl_conc_cmp_t *cmpfunc);
+
+void
+avl_conc_remove(avl_conc_root_t *avlroot, avl_conc_node_t *node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AVL_CONC_H__ */
@@ -0,0 +1,380 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include "avl_cow.h"
+
+#define avl_cmp2idx(cmp) (!((cmp) < 0))
+#define avl_balance2idx(cmp) (!((cmp) < 0))
+#define avl_idx2cmp(idx) (!(idx)?-1:1)
+
+/*
+ * The key to look for in a descent, either given as a node compared with
+ * cmpfunc or as a bare key compared with keycmp
+ */
+struct avl_cow_key {
+	const void *key;
+	avl_np_cmp_t *cmpfunc;
+	avl_np_keycmp_t *keycmp;
+};
+
+static inline int
+avl_cow_key_cmp(const struct avl_cow_key *key, avl_np_node_t *node)
+{
+	if (key->cmpfunc)
+		return key->cmpfunc((avl_np_node_t *)key->key, node);
+	return key->keycmp(key->key, node);
+}
+
+static avl_np_node_t *
+avl_cow_lookup(avl_cow_root_t *avlroot, const struct avl_cow_key *key)
+{
+	if (key->cmpfunc)
+		return avl_np_search(&avlroot->avl_tree,
+		    (avl_np_node_t *)key->key, key->cmpfunc);
+	return avl_np_search_key(&avlroot->avl_tree, key->key, key->keycmp);
+}
+
+/*
+ * The path recorded on the way down, as in avl_np.c. Every node on it is
+ * private to the version.
+ */
+struct avl_cow_path {
+	avl_np_node_t **link[AVL_MAX_HEIGHT];
+	int dir[AVL_MAX_HEIGHT];
+	int depth;
+};
+
+static inline void
+avl_cow_get(avl_np_node_t *node)
+{
+	if (node)
+		__atomic_add_fetch(&avl_cow_node(node)->avl_refs, 1,
+		    __ATOMIC_RELAXED);
+}
+
+/*
+ * Drop a link to @node, releasing it and dropping its own links if it was
+ * the last one
+ */
+static void
+avl_cow_put(avl_cow_root_t *avlroot, avl_np_node_t *node)
+{
+	while (node && !__atomic_sub_fetch(&avl_cow_node(node)->avl_refs, 1,
+	    __ATOMIC_ACQ_REL)) {
+		avl_np_node_t *right = node->avl_children[1];
+
+		avl_cow_put(avlroot, node->avl_children[0]);
+		if (avlroot->avl_release)
+			avlroot->avl_release(avl_cow_node(node),
+			    avlroot->avl_arg);
+		node = right;
+	}
+}
+
+/*
+ * Make the node @link refers to private to the version, by copying it if
+ * another link refers to it. @link must be in a private node or in the root.
+ *
+ * Return the node, or NULL if it could not be copied.
+ */
+static avl_np_node_t *
+avl_cow_unshare(avl_cow_root_t *avlroot, avl_np_node_t **link)
+{
+	avl_np_node_t *node = *link;
+	avl_cow_node_t *copy;
+
+	/* A node with a single link from a private node cannot be reached
+	 * from another version */
+	if (__atomic_load_n(&avl_cow_node(node)->avl_refs,
+	    __ATOMIC_ACQUIRE) == 1)
+		return node;
+
+	copy = avlroot->avl_clone(avl_cow_node(node), avlroot->avl_arg);
+	if (!copy)
+		return NULL;
+	copy->avl_np = *node;
+	copy->avl_refs = 1;
+	avl_cow_get(node->avl_children[0]);
+	avl_cow_get(node->avl_children[1]);
+	*link = &copy->avl_np;
+	avl_cow_put(avlroot, node);
+	return *link;
+}
+
+/*
+ * Descend from the root looking for @key like avl_np_descend(), copying the
+ * shared nodes on the way
+ *
+ * Return 0, or -1 if a node could not be copied.
+ */
+static int
+avl_cow_descend(avl_cow_root_t *avlroot, const struct avl_cow_key *key,
+    struct avl_cow_path *path)
+{
+	avl_np_node_t **link = &avlroot->avl_tree.avl_root;
+
+	path->depth = 0;
+	while (*link) {
+		int cmp;
+		avl_np_node_t *node;
+
+		node = avl_cow_unshare(avlroot, link);
+		if (!node)
+			return -1;
+		path->link[path->depth] = link;
+		cmp = avl_cow_key_cmp(key, node);
+		if (!cmp)
+			return 0;
+		path->dir[path->depth++] = avl_cmp2idx(cmp);
+		link = &node->avl_children[avl_cmp2idx(cmp)];
+	}
+	path->link[path->depth] = link;
+	return 0;
+}
+
+/*
+ * Start a version with an empty tree. @clone and @release are used on its
+ * nodes, and on those of the snapshots taken from it.
+ */
+void
+avl_cow_init(avl_cow_root_t *avlroot, avl_cow_clone_t *clone,
+    avl_cow_release_t *release, void *arg)
+{
+	avlroot->avl_tree.avl_root = NULL;
+	avlroot->avl_clone = clone;
+	avlroot->avl_release = release;
+	avlroot->avl_arg = arg;
+}
+
+/*
+ * Take a snapshot of @avlroot into @snap. Both versions can then be modified
+ * independently.
+ */
+void
+avl_cow_snapshot(avl_cow_root_t *snap, avl_cow_root_t *avlroot)
+{
+	*snap = *avlroot;
+	avl_cow_get(avlroot->avl_tree.avl_root);
+}
+
+/*
+ * Drop a version, releasing the nodes no other version links to. The version
+ * is empty on return.
+ */
+void
+avl_cow_free(avl_cow_root_t *avlroot)
+{
+	avl_cow_put(avlroot, avlroot->avl_tree.avl_root);
+	avlroot->avl_tree.avl_root = NULL;
+}
+
+/*
+ * Insert a new node into the version
+ *
+ * Return the node with the same key as node parameter, like avl_insert(), or
+ * NULL if a node could not be copied. The node returned is shared with other
+ * versions, so its key must not be changed.
+ */
+avl_cow_node_t *
+avl_cow_insert(avl_cow_root_t *avlroot, avl_cow_node_t *node,
+    avl_np_cmp_t *cmpfunc)
+{
+	int i;
+	avl_np_node_t *found;
+	struct avl_cow_path path;
+	struct avl_cow_key k = { &node->avl_np, cmpfunc, NULL };
+
+	/* Do not copy anything for a key that is already there */
+	found = avl_cow_lookup(avlroot, &k);
+	if (found)
+		return avl_cow_node(found);
+	if (avl_cow_descend(avlroot, &k, &path))
+		return NULL;
+
+	node->avl_np.avl_children[0] = node->avl_np.avl_children[1] = NULL;
+	node->avl_np.avl_balance = 0;
+	node->avl_refs = 1;
+	*path.link[path.depth] = &node->avl_np;
+
+	/*
+	 * Walk back up as in avl_np_insert(). A rotation on insertion only
+	 * involves nodes on the path, which are private already.
+	 */
+	for (i = path.depth - 1; i >= 0; --i) {
+		int balance, abs_balance;
+		avl_np_node_t *parent = *path.link[i];
+
+		balance = parent->avl_balance + avl_idx2cmp(path.dir[i]);
+		abs_balance = avl_abs_balance(balance);
+		if (!abs_balance) {
+			parent->avl_balance = balance;
+			break;
+		} else if (abs_balance == 1) {
+			parent->avl_balance = balance;
+		} else {
+			avl_np_rebalance(path.link[i]);
+			break;
+		}
+	}
+	return node;
+}
+
+/*
+ * Copy the nodes off the path that the rotations on the way back up from a
+ * removal at @depth will touch, so that nothing has to be copied once the
+ * tree is being changed. The walk is the same as the one that follows.
+ *
+ * Return 0, or -1 if a node could not be copied.
+ */
+static int
+avl_cow_unshare_siblings(avl_cow_root_t *avlroot, struct avl_cow_path *path,
+    int depth)
+{
+	int i;
+
+	for (i = depth - 1; i >= 0; --i) {
+		int balance, abs_balance, which_child;
+		avl_np_node_t *parent = *path->link[i], *S;
+
+		balance = parent->avl_balance - avl_idx2cmp(path->dir[i]);
+		abs_balance = avl_abs_balance(balance);
+		if (abs_balance == 1)
+			break;
+		else if (!abs_balance)
+			continue;
+
+		which_child = avl_balance2idx(parent->avl_balance);
+		S = avl_cow_unshare(avlroot,
+		    &parent->avl_children[which_child]);
+		if (!S)
+			return -1;
+		if (parent->avl_balance != S->avl_balance && S->avl_balance) {
+			/* A double rotation, which shortens the subtree */
+			if (!avl_cow_unshare(avlroot,
+			    &S->avl_children[!which_child]))
+				return -1;
+		} else if (!S->avl_balance) {
+			break;
+		}
+	}
+	return 0;
+}
+
+static int
+avl_cow_remove_internal(avl_cow_root_t *avlroot, const struct avl_cow_key *key)
+{
+	int i, depth, side = 0, k;
+	avl_np_node_t *node, *child = NULL;
+	struct avl_cow_path path;
+
+	if (!avl_cow_lookup(avlroot, key))
+		return 0;
+	if (avl_cow_descend(avlroot, key, &path))
+		return -1;
+
+	depth = k = path.depth;
+	node = *path.link[depth];
+	if (node->avl_children[0] && node->avl_children[1]) {
+		/* Copy the path down to the node taking the place of @node */
+		side = avl_balance2idx(node->avl_balance);
+		path.dir[depth++] = side;
+		path.link[depth] = &node->avl_children[side];
+		for (;;) {
+			child = avl_cow_unshare(avlroot, path.link[depth]);
+			if (!child)
+				return -1;
+			if (!child->avl_children[!side])
+				break;
+			path.dir[depth] = !side;
+			path.link[depth + 1] = &child->avl_children[!side];
+			++depth;
+		}
+	}
+	if (avl_cow_unshare_siblings(avlroot, &path, depth))
+		return -1;
+
+	/* From here on, the same as avl_np_remove() */
+	if (!child) {
+		*path.link[depth] = node->avl_children[!node->avl_children[0]];
+	} else {
+		*path.link[depth] = child->avl_children[side];
+		child->avl_children[0] = node->avl_children[0];
+		child->avl_children[1] = node->avl_children[1];
+		child->avl_balance = node->avl_balance;
+		*path.link[k] = child;
+		path.link[k + 1] = &child->avl_children[side];
+	}
+
+	for (i = depth - 1; i >= 0; --i) {
+		int balance, abs_balance;
+		avl_np_node_t *parent = *path.link[i];
+
+		balance = parent->avl_balance - avl_idx2cmp(path.dir[i]);
+		abs_balance = avl_abs_balance(balance);
+		if (!abs_balance) {
+			parent->avl_balance = balance;
+		} else if (abs_balance == 1) {
+			parent->avl_balance = balance;
+			break;
+		} else if (!avl_np_rebalance(path.link[i])) {
+			break;
+		}
+	}
+
+	/* The links of @node have moved to other nodes, which keep them */
+	avl_cow_node(node)->avl_refs = 0;
+	if (avlroot->avl_release)
+		avlroot->avl_release(avl_cow_node(node), avlroot->avl_arg);
+	return 1;
+}
+
+/*
+ * Remove the node with the same key as @key from the version. The node is
+ * released once no version links to it.
+ *
+ * Return 1 if a node was removed, 0 if no node has the key, or -1 if a node
+ * could not be copied, in which case the version is left unchanged.
+ */
+int
+avl_cow_remove(avl_cow_root_t *avlroot, avl_np_node_t *key,
+    avl_np_cmp_t *cmpfunc)
+{
+	struct avl_cow_key k = { key, cmpfunc, NULL };
+
+	return avl_cow_remove_internal(avlroot, &k);
+}
+
+int
+avl_cow_remove_key(avl_cow_root_t *avlroot, const void *key,
+    avl_np_keycmp_t *keycmp)
+{
+	struct avl_cow_key k = { key, NULL, keycmp };
+
+	return avl_cow_remove_internal(avlroot, &k);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2017 Ka Ho Ng <ngkaho1234@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#ifndef __AVL_COW_H__
+#define __AVL_COW_H__
+
+#include "avl_np.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Persistent AVL tree
+ *
+ * A version of the tree is only a root, and versions share the nodes they
+ * have in common. Shared nodes are never modified: insertion and removal copy
+ * the path from the root to the position they change, along with the few
+ * siblings a rotation on the way back up touches. Taking a snapshot thus
+ * costs O(1), and every later modification of either version O(log n).
+ *
+ * The nodes are built on avl_np_node_t, so a version is read with the
+ * avl_np_*() routines on avl_cow_np(). Every node counts the links to it from
+ * parents and roots, and is handed to the release routine of the tree once
+ * that number drops to 0.
+ *
+ * One version must not be modified or read while it is modified, but
+ * different versions may be used from different threads.
+ */
+typedef struct avl_cow_node_s {
+	avl_np_node_t avl_np;			/* Links, must come first */
+	unsigned avl_refs;			/* Number of links to the node */
+} avl_cow_node_t;
+
+/*
+ * Return a new node with the same key and data as @node, or NULL. The links
+ * are set up by the tree.
+ */
+typedef avl_cow_node_t *avl_cow_clone_t(avl_cow_node_t *node, void *arg);
+
+/*
+ * Called on a node no version links to anymore
+ */
+typedef void avl_cow_release_t(avl_cow_node_t *node, void *arg);
+
+/*
+ * A version of the tree
+ */
+typedef struct avl_cow_root_s {
+	avl_np_root_t avl_tree;			/* The tree of the version */
+	avl_cow_clone_t *avl_clone;		/* Node copy routine */
+	avl_cow_release_t *avl_release;		/* Node release routine */
+	void *avl_arg;				/* Argument of both routines */
+} avl_cow_root_t;
+
+void
+avl_cow_init(avl_cow_root_t *avlroot, avl_cow_clone_t *clone,
+    avl_cow_release_t *release, void *arg);
+
+void
+avl_cow_snapshot(avl_cow_root_t *snap, avl_cow_root_t *avlroot);
+
+void
+avl_cow_free(avl_cow_root_t *avlroot);
+
+avl_cow_node_t *
+avl_cow_insert(avl_cow_root_t *avlroot, avl_cow_node_t *node,
+    avl_np_cmp_t *cmpfunc);
+
+int
+avl_cow_remove(avl_cow_root_t *avlroot, avl_np_node_t *key,
+    avl_np_cmp_t *cmpfunc);
+
+int
+avl_cow_remove_key(avl_cow_root_t *avlroot, const void *key,
+    avl_np_keycmp_t *keycmp);
+
+/*
+ * Return the tree of a version, for the avl_np_*() read routines
+ */
+static inline avl_np_root_t *
+avl_cow_np(avl_cow_root_t *avlroot)
+{
+	return &avlroot->avl_tree;
+}
+
+/*
+ * Return the node a link of the tree refers to
+ */
+static inline avl_cow_node_t *
+avl_cow_node(avl_np_node_t *node)
+{
+	return (avl_cow_node_t *)node;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AVL_COW_H__ */
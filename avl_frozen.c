@@ -0,0 +1,200 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "avl_frozen.h"
+
+#define AVL_FROZEN_ALIGN 64
+
+/*
+ * Keys and nodes are stored from index 1, so that the children of the key at
+ * index k are at 2k and 2k + 1
+ */
+struct avl_frozen_s {
+	size_t avl_count;
+	size_t avl_keysize;
+	avl_frozen_cmp_t *avl_cmpfunc;
+	unsigned char *avl_keys;
+	avl_node_t **avl_nodes;
+};
+
+/*
+ * Return the first index visited by an in-order traversal of an implicit tree
+ * of @n keys
+ */
+static inline size_t
+avl_frozen_leftmost(size_t n)
+{
+	size_t k = 1;
+
+	while (k * 2 <= n)
+		k *= 2;
+	return k;
+}
+
+/*
+ * Return the index following @k in an in-order traversal of an implicit tree
+ * of @n keys, or 0 if @k is the last one
+ */
+static inline size_t
+avl_frozen_next(size_t k, size_t n)
+{
+	if (k * 2 + 1 <= n) {
+		k = k * 2 + 1;
+		while (k * 2 <= n)
+			k *= 2;
+		return k;
+	}
+	while (k & 1)
+		k >>= 1;
+	return k >> 1;
+}
+
+/*
+ * Build a frozen snapshot of the tree. @extract copies the key of a node,
+ * which takes @keysize bytes in the snapshot, and @cmpfunc compares a bare
+ * key with such a copy (in the same order as the tree).
+ *
+ * Return the snapshot, or NULL if memory allocation fails.
+ */
+avl_frozen_t *
+avl_freeze(avl_root_t *avlroot, size_t keysize, avl_extract_t *extract,
+    avl_frozen_cmp_t *cmpfunc)
+{
+	size_t n = 0, k, bytes;
+	avl_node_t *node;
+	avl_frozen_t *frozen;
+
+	for (node = avl_first(avlroot); node; node = avl_next(node))
+		++n;
+
+	frozen = malloc(sizeof(*frozen));
+	if (!frozen)
+		return NULL;
+	bytes = (n + 1) * keysize;
+	bytes = (bytes + AVL_FROZEN_ALIGN - 1) & ~(size_t)(AVL_FROZEN_ALIGN - 1);
+	frozen->avl_keys = aligned_alloc(AVL_FROZEN_ALIGN, bytes);
+	frozen->avl_nodes = malloc((n + 1) * sizeof(avl_node_t *));
+	if (!frozen->avl_keys || !frozen->avl_nodes) {
+		free(frozen->avl_keys);
+		free(frozen->avl_nodes);
+		free(frozen);
+		return NULL;
+	}
+	frozen->avl_count = n;
+	frozen->avl_keysize = keysize;
+	frozen->avl_cmpfunc = cmpfunc;
+	frozen->avl_nodes[0] = NULL;
+
+	/*
+	 * Walking the tree and the implicit tree in order at the same time
+	 * puts every key at its place
+	 */
+	k = avl_frozen_leftmost(n);
+	for (node = avl_first(avlroot); node; node = avl_next(node)) {
+		extract(node, frozen->avl_keys + k * keysize);
+		frozen->avl_nodes[k] = node;
+		k = avl_frozen_next(k, n);
+	}
+	return frozen;
+}
+
+void
+avl_frozen_free(avl_frozen_t *frozen)
+{
+	if (!frozen)
+		return;
+	free(frozen->avl_keys);
+	free(frozen->avl_nodes);
+	free(frozen);
+}
+
+/*
+ * Return the number of keys in the snapshot
+ */
+size_t
+avl_frozen_count(const avl_frozen_t *frozen)
+{
+	return frozen->avl_count;
+}
+
+/*
+ * Return the index of the first key not less than @key, or 0
+ */
+static inline size_t
+avl_frozen_bound(const avl_frozen_t *frozen, const void *key)
+{
+	size_t k = 1;
+	size_t n = frozen->avl_count;
+	size_t keysize = frozen->avl_keysize;
+	const unsigned char *keys = frozen->avl_keys;
+
+	/*
+	 * Go left on keys not less than @key and right otherwise, without a
+	 * branch on the result. The 16 descendants four levels below are
+	 * contiguous, so they are fetched while walking down to them.
+	 */
+	while (k <= n) {
+		__builtin_prefetch((const void *)
+		    ((uintptr_t)keys + k * 16 * keysize));
+		k = k * 2 + (frozen->avl_cmpfunc(key, keys + k * keysize) > 0);
+	}
+
+	/*
+	 * The last left turn was taken at the bound. Cancel the right turns
+	 * taken after it (the trailing ones), then that left turn.
+	 */
+	return k >> (__builtin_ctzll(~(unsigned long long)k) + 1);
+}
+
+/*
+ * Return the node of the first key not less than @key, or NULL if there is
+ * no such key
+ */
+avl_node_t *
+avl_frozen_lower_bound(const avl_frozen_t *frozen, const void *key)
+{
+	return frozen->avl_nodes[avl_frozen_bound(frozen, key)];
+}
+
+/*
+ * Return the node with the same key as @key, or NULL if there is no such
+ * key
+ */
+avl_node_t *
+avl_frozen_search(const avl_frozen_t *frozen, const void *key)
+{
+	size_t k = avl_frozen_bound(frozen, key);
+
+	if (k && !frozen->avl_cmpfunc(key,
+	    frozen->avl_keys + k * frozen->avl_keysize))
+		return frozen->avl_nodes[k];
+	return NULL;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2017 Ka Ho Ng <ngkaho1234@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#ifndef __AVL_FROZEN_H__
+#define __AVL_FROZEN_H__
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Frozen snapshot of an AVL tree
+ *
+ * A snapshot holds a copy of the key of every node in a contiguous array laid
+ * out in Eytzinger (breadth-first) order, along with the node each key came
+ * from. The first levels of the implicit tree share a few cache lines, and
+ * the position of the next key only depends on the result of the comparison,
+ * so lookups can prefetch the keys a few levels below instead of chasing
+ * pointers.
+ *
+ * A snapshot is immutable. It is not affected by later changes of the tree,
+ * but the node pointers it returns are only valid as long as the nodes are.
+ * To replace the snapshot seen by readers, build a new one, publish its
+ * pointer with a release store (readers load it with acquire semantics), and
+ * free the old one once no reader can still be using it.
+ */
+typedef struct avl_frozen_s avl_frozen_t;
+
+/*
+ * Copy the key of a node into @key, which has the key size given to
+ * avl_freeze()
+ */
+typedef void avl_extract_t(avl_node_t *node, void *key);
+
+/*
+ * Comparsion routine between a bare key and a key extracted by avl_extract_t
+ */
+typedef int avl_frozen_cmp_t(const void *key, const void *frozen_key);
+
+avl_frozen_t *
+avl_freeze(avl_root_t *avlroot, size_t keysize, avl_extract_t *extract,
+    avl_frozen_cmp_t *cmpfunc);
+
+void
+avl_frozen_free(avl_frozen_t *frozen);
+
+size_t
+avl_frozen_count(const avl_frozen_t *frozen);
+
+avl_node_t *
+avl_frozen_search(const avl_frozen_t *frozen, const void *key);
+
+avl_node_t *
+avl_frozen_lower_bound(const avl_frozen_t *frozen, const void *key);
+
+/*
+ * Frozen snapshot of a tree with integer keys
+ *
+ * The keys are stored as a static B-tree of 64-byte blocks, 16 keys of 32
+ * bits or 8 keys of 64 bits each, and lookups rank the key among a whole block
+ * with SIMD comparisons at every step. The tree is thus walked in about
+ * log16(n) or log8(n) steps without a data-dependent branch.
+ *
+ * Keys are compared as unsigned integers. Signed keys can be mapped to the
+ * same order by flipping their sign bit.
+ */
+typedef struct avl_frozen_int_s avl_frozen_int_t;
+
+/*
+ * Return the integer key of a node
+ */
+typedef uint64_t avl_intkey_t(avl_node_t *node);
+
+/*
+ * Implementations of the block search
+ */
+enum avl_simd {
+	AVL_SIMD_AUTO,				/* The best one the CPU supports */
+	AVL_SIMD_SCALAR,
+	AVL_SIMD_AVX2,
+	AVL_SIMD_AVX512,
+	AVL_SIMD_NEON
+};
+
+avl_frozen_int_t *
+avl_freeze_u32(avl_root_t *avlroot, avl_intkey_t *intkey);
+
+avl_frozen_int_t *
+avl_freeze_u64(avl_root_t *avlroot, avl_intkey_t *intkey);
+
+void
+avl_frozen_int_free(avl_frozen_int_t *frozen);
+
+int
+avl_frozen_int_use(avl_frozen_int_t *frozen, enum avl_simd simd);
+
+avl_node_t *
+avl_frozen_int_search(const avl_frozen_int_t *frozen, uint64_t key);
+
+avl_node_t *
+avl_frozen_int_lower_bound(const avl_frozen_int_t *frozen, uint64_t key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AVL_FROZEN_H__ */
@@ -0,0 +1,390 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include "avl_frozen.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AVL_SIMD_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/* Size of a block, which is a cache line */
+#define AVL_FROZEN_BLOCK 64
+
+/* Bound of the depth of the block tree, the fanout being at least 9 */
+#define AVL_FROZEN_MAX_DEPTH 24
+
+/*
+ * Return the number of keys less than @key in a block
+ */
+typedef unsigned avl_rank32_t(const uint32_t *block, uint32_t key);
+typedef unsigned avl_rank64_t(const uint64_t *block, uint64_t key);
+
+/*
+ * Block @k has the children k * (B + 1) + i + 1 for i in [0, B], B being the
+ * number of keys in a block. Slots past the last key hold the largest value and
+ * a NULL node, thus come last in the order of the tree.
+ */
+struct avl_frozen_int_s {
+	size_t avl_count;
+	size_t avl_nblocks;
+	unsigned avl_fanout;			/* Number of keys in a block */
+	void *avl_keys;
+	avl_node_t **avl_nodes;
+	avl_rank32_t *avl_rank32;
+	avl_rank64_t *avl_rank64;
+};
+
+static unsigned
+avl_rank32_scalar(const uint32_t *block, uint32_t key)
+{
+	unsigned i, rank = 0;
+
+	for (i = 0; i < AVL_FROZEN_BLOCK / sizeof(uint32_t); ++i)
+		rank += block[i] < key;
+	return rank;
+}
+
+static unsigned
+avl_rank64_scalar(const uint64_t *block, uint64_t key)
+{
+	unsigned i, rank = 0;
+
+	for (i = 0; i < AVL_FROZEN_BLOCK / sizeof(uint64_t); ++i)
+		rank += block[i] < key;
+	return rank;
+}
+
+#ifdef AVL_SIMD_X86
+/*
+ * AVX2 only has signed comparisons, so both sides are biased by the sign bit
+ */
+__attribute__((target("avx2"))) static unsigned
+avl_rank32_avx2(const uint32_t *block, uint32_t key)
+{
+	__m256i bias = _mm256_set1_epi32(INT32_MIN);
+	__m256i x = _mm256_xor_si256(_mm256_set1_epi32((int)key), bias);
+	__m256i lo = _mm256_xor_si256(
+	    _mm256_load_si256((const __m256i *)block), bias);
+	__m256i hi = _mm256_xor_si256(
+	    _mm256_load_si256((const __m256i *)block + 1), bias);
+	unsigned mask;
+
+	mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+	    _mm256_cmpgt_epi32(x, lo)));
+	mask |= _mm256_movemask_ps(_mm256_castsi256_ps(
+	    _mm256_cmpgt_epi32(x, hi))) << 8;
+	return __builtin_popcount(mask);
+}
+
+__attribute__((target("avx2"))) static unsigned
+avl_rank64_avx2(const uint64_t *block, uint64_t key)
+{
+	__m256i bias = _mm256_set1_epi64x(INT64_MIN);
+	__m256i x = _mm256_xor_si256(_mm256_set1_epi64x((long long)key), bias);
+	__m256i lo = _mm256_xor_si256(
+	    _mm256_load_si256((const __m256i *)block), bias);
+	__m256i hi = _mm256_xor_si256(
+	    _mm256_load_si256((const __m256i *)block + 1), bias);
+	unsigned mask;
+
+	mask = _mm256_movemask_pd(_mm256_castsi256_pd(
+	    _mm256_cmpgt_epi64(x, lo)));
+	mask |= _mm256_movemask_pd(_mm256_castsi256_pd(
+	    _mm256_cmpgt_epi64(x, hi))) << 4;
+	return __builtin_popcount(mask);
+}
+
+__attribute__((target("avx512f"))) static unsigned
+avl_rank32_avx512(const uint32_t *block, uint32_t key)
+{
+	return __builtin_popcount(_mm512_cmplt_epu32_mask(
+	    _mm512_load_si512(block), _mm512_set1_epi32((int)key)));
+}
+
+__attribute__((target("avx512f"))) static unsigned
+avl_rank64_avx512(const uint64_t *block, uint64_t key)
+{
+	return __builtin_popcount(_mm512_cmplt_epu64_mask(
+	    _mm512_load_si512(block), _mm512_set1_epi64((long long)key)));
+}
+#endif
+
+#ifdef __aarch64__
+/*
+ * A true comparison yields all ones, i.e. -1 in every lane
+ */
+static unsigned
+avl_rank32_neon(const uint32_t *block, uint32_t key)
+{
+	uint32x4_t x = vdupq_n_u32(key);
+	uint32x4_t sum;
+
+	sum = vcltq_u32(vld1q_u32(block), x);
+	sum = vaddq_u32(sum, vcltq_u32(vld1q_u32(block + 4), x));
+	sum = vaddq_u32(sum, vcltq_u32(vld1q_u32(block + 8), x));
+	sum = vaddq_u32(sum, vcltq_u32(vld1q_u32(block + 12), x));
+	return -vaddvq_u32(sum);
+}
+
+static unsigned
+avl_rank64_neon(const uint64_t *block, uint64_t key)
+{
+	uint64x2_t x = vdupq_n_u64(key);
+	uint64x2_t sum;
+
+	sum = vcltq_u64(vld1q_u64(block), x);
+	sum = vaddq_u64(sum, vcltq_u64(vld1q_u64(block + 2), x));
+	sum = vaddq_u64(sum, vcltq_u64(vld1q_u64(block + 4), x));
+	sum = vaddq_u64(sum, vcltq_u64(vld1q_u64(block + 6), x));
+	return -vaddvq_u64(sum);
+}
+#endif
+
+/*
+ * Select the implementation of the block search
+ *
+ * Return 0 on success, or -1 if the CPU does not support it.
+ */
+int
+avl_frozen_int_use(avl_frozen_int_t *frozen, enum avl_simd simd)
+{
+	if (simd == AVL_SIMD_AUTO) {
+#ifdef AVL_SIMD_X86
+		if (!avl_frozen_int_use(frozen, AVL_SIMD_AVX512))
+			return 0;
+#endif
+		if (!avl_frozen_int_use(frozen, AVL_SIMD_AVX2) ||
+		    !avl_frozen_int_use(frozen, AVL_SIMD_NEON))
+			return 0;
+		simd = AVL_SIMD_SCALAR;
+	}
+
+	switch (simd) {
+	case AVL_SIMD_SCALAR:
+		frozen->avl_rank32 = avl_rank32_scalar;
+		frozen->avl_rank64 = avl_rank64_scalar;
+		return 0;
+#ifdef AVL_SIMD_X86
+	case AVL_SIMD_AVX2:
+		if (!__builtin_cpu_supports("avx2"))
+			return -1;
+		frozen->avl_rank32 = avl_rank32_avx2;
+		frozen->avl_rank64 = avl_rank64_avx2;
+		return 0;
+	case AVL_SIMD_AVX512:
+		if (!__builtin_cpu_supports("avx512f"))
+			return -1;
+		frozen->avl_rank32 = avl_rank32_avx512;
+		frozen->avl_rank64 = avl_rank64_avx512;
+		return 0;
+#endif
+#ifdef __aarch64__
+	case AVL_SIMD_NEON:
+		frozen->avl_rank32 = avl_rank32_neon;
+		frozen->avl_rank64 = avl_rank64_neon;
+		return 0;
+#endif
+	default:
+		return -1;
+	}
+}
+
+static void
+avl_frozen_int_set(avl_frozen_int_t *frozen, size_t slot, avl_node_t *node,
+    uint64_t key)
+{
+	frozen->avl_nodes[slot] = node;
+	if (frozen->avl_fanout == AVL_FROZEN_BLOCK / sizeof(uint32_t))
+		((uint32_t *)frozen->avl_keys)[slot] = (uint32_t)key;
+	else
+		((uint64_t *)frozen->avl_keys)[slot] = key;
+}
+
+static avl_frozen_int_t *
+avl_freeze_int(avl_root_t *avlroot, avl_intkey_t *intkey, unsigned fanout)
+{
+	struct {
+		size_t block;
+		unsigned slot;
+	} stack[AVL_FROZEN_MAX_DEPTH];
+	int depth = 0;
+	size_t n = 0, k = 0;
+	avl_node_t *node;
+	avl_frozen_int_t *frozen;
+
+	for (node = avl_first(avlroot); node; node = avl_next(node))
+		++n;
+
+	frozen = malloc(sizeof(*frozen));
+	if (!frozen)
+		return NULL;
+	frozen->avl_count = n;
+	frozen->avl_fanout = fanout;
+	frozen->avl_nblocks = (n + fanout - 1) / fanout;
+	frozen->avl_keys = aligned_alloc(AVL_FROZEN_BLOCK,
+	    (frozen->avl_nblocks ? frozen->avl_nblocks : 1) * AVL_FROZEN_BLOCK);
+	frozen->avl_nodes = malloc((frozen->avl_nblocks * fanout + 1) *
+	    sizeof(avl_node_t *));
+	if (!frozen->avl_keys || !frozen->avl_nodes) {
+		avl_frozen_int_free(frozen);
+		return NULL;
+	}
+	avl_frozen_int_use(frozen, AVL_SIMD_AUTO);
+
+	/*
+	 * Fill the slots in the order of the block tree: for every block,
+	 * child 0, slot 0, child 1, ..., slot B - 1, child B. The entry on the
+	 * top of the stack is the block whose child @slot is being filled.
+	 */
+	node = avl_first(avlroot);
+	for (;;) {
+		while (k < frozen->avl_nblocks) {
+			stack[depth].block = k;
+			stack[depth++].slot = 0;
+			k = k * (fanout + 1) + 1;
+		}
+		while (depth && stack[depth - 1].slot == fanout)
+			--depth;
+		if (!depth)
+			break;
+
+		k = stack[depth - 1].block * fanout + stack[depth - 1].slot;
+		avl_frozen_int_set(frozen, k, node,
+		    node ? intkey(node) : UINT64_MAX);
+		if (node)
+			node = avl_next(node);
+		k = stack[depth - 1].block * (fanout + 1) +
+		    ++stack[depth - 1].slot + 1;
+	}
+	/* The result of a failed lookup */
+	frozen->avl_nodes[frozen->avl_nblocks * fanout] = NULL;
+	return frozen;
+}
+
+/*
+ * Build a frozen snapshot of a tree with 32-bit or 64-bit integer keys, as
+ * returned by @intkey. The block search is the best one the CPU supports.
+ *
+ * Return the snapshot, or NULL if memory allocation fails.
+ */
+avl_frozen_int_t *
+avl_freeze_u32(avl_root_t *avlroot, avl_intkey_t *intkey)
+{
+	return avl_freeze_int(avlroot, intkey,
+	    AVL_FROZEN_BLOCK / sizeof(uint32_t));
+}
+
+avl_frozen_int_t *
+avl_freeze_u64(avl_root_t *avlroot, avl_intkey_t *intkey)
+{
+	return avl_freeze_int(avlroot, intkey,
+	    AVL_FROZEN_BLOCK / sizeof(uint64_t));
+}
+
+void
+avl_frozen_int_free(avl_frozen_int_t *frozen)
+{
+	if (!frozen)
+		return;
+	free(frozen->avl_keys);
+	free(frozen->avl_nodes);
+	free(frozen);
+}
+
+/*
+ * Return the slot of the first key not less than @key, or the slot past the
+ * last block if there is no such key
+ */
+static inline size_t
+avl_frozen_int_bound(const avl_frozen_int_t *frozen, uint64_t key)
+{
+	unsigned fanout = frozen->avl_fanout;
+	size_t k = 0, found = frozen->avl_nblocks * fanout;
+
+	if (fanout == AVL_FROZEN_BLOCK / sizeof(uint32_t)) {
+		const uint32_t *keys = frozen->avl_keys;
+
+		if (key > UINT32_MAX)
+			return found;
+		while (k < frozen->avl_nblocks) {
+			unsigned i = frozen->avl_rank32(keys + k * fanout,
+			    (uint32_t)key);
+
+			if (i < fanout)
+				found = k * fanout + i;
+			k = k * (fanout + 1) + i + 1;
+		}
+	} else {
+		const uint64_t *keys = frozen->avl_keys;
+
+		while (k < frozen->avl_nblocks) {
+			unsigned i = frozen->avl_rank64(keys + k * fanout, key);
+
+			if (i < fanout)
+				found = k * fanout + i;
+			k = k * (fanout + 1) + i + 1;
+		}
+	}
+	return found;
+}
+
+/*
+ * Return the node of the first key not less than @key, or NULL if there is
+ * no such key
+ */
+avl_node_t *
+avl_frozen_int_lower_bound(const avl_frozen_int_t *frozen, uint64_t key)
+{
+	return frozen->avl_nodes[avl_frozen_int_bound(frozen, key)];
+}
+
+/*
+ * Return the node with the same key as @key, or NULL if there is no such
+ * key
+ */
+avl_node_t *
+avl_frozen_int_search(const avl_frozen_int_t *frozen, uint64_t key)
+{
+	size_t k = avl_frozen_int_bound(frozen, key);
+	size_t end = frozen->avl_nblocks * frozen->avl_fanout;
+
+	if (k == end)
+		return NULL;
+	if (frozen->avl_fanout == AVL_FROZEN_BLOCK / sizeof(uint32_t)) {
+		if (((const uint32_t *)frozen->avl_keys)[k] != key)
+			return NULL;
+	} else if (((const uint64_t *)frozen->avl_keys)[k] != key) {
+		return NULL;
+	}
+	return frozen->avl_nodes[k];
+}
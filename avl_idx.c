@@ -0,0 +1,458 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include "avl_idx.h"
+
+#define avl_cmp2idx(cmp) (!((cmp) < 0))
+#define avl_balance2idx(cmp) (!((cmp) < 0))
+#define avl_idx2cmp(idx) (!(idx)?-1:1)
+
+static inline int
+avl_abs_balance(int balance)
+{
+	return balance < 0 ? -balance : balance;
+}
+
+/*
+ * Return the side of its parent the node at @idx is on, or -1 if it is
+ * the root
+ */
+static inline int
+avl_idx_which_child(const avl_idx_base_t *base, avl_idx_t idx)
+{
+	avl_idx_t parent = avl_idx_node(base, idx)->avl_parent;
+
+	if (parent == AVL_IDX_NIL)
+		return -1;
+	return avl_idx_node(base, parent)->avl_children[1] == idx;
+}
+
+/*
+ * Return the slot in the parent of the node at @idx (or the root) which
+ * refers to the node
+ */
+static inline avl_idx_t *
+avl_idx_slot(const avl_idx_base_t *base, avl_idx_root_t *root, avl_idx_t idx)
+{
+	avl_idx_t parent = avl_idx_node(base, idx)->avl_parent;
+
+	if (parent == AVL_IDX_NIL)
+		return &root->avl_root;
+	return avl_idx_node(base, parent)->avl_children +
+	    avl_idx_which_child(base, idx);
+}
+
+/*
+ * Set the parent of the node at @idx, unless @idx is the null index
+ */
+static inline void
+avl_idx_set_parent(const avl_idx_base_t *base, avl_idx_t idx,
+    avl_idx_t parent)
+{
+	if (idx != AVL_IDX_NIL)
+		avl_idx_node(base, idx)->avl_parent = parent;
+}
+
+avl_idx_t
+avl_idx_search_key(const avl_idx_base_t *base, avl_idx_root_t *root,
+    const void *key, avl_idx_keycmp_t *keycmp)
+{
+	avl_idx_t idx = root->avl_root;
+
+	while (idx != AVL_IDX_NIL) {
+		int cmp = keycmp(key, avl_idx_elem(base, idx));
+
+		if (!cmp)
+			break;
+		idx = avl_idx_node(base, idx)->avl_children[avl_cmp2idx(cmp)];
+	}
+	return idx;
+}
+
+avl_idx_t
+avl_idx_lower_bound_key(const avl_idx_base_t *base, avl_idx_root_t *root,
+    const void *key, avl_idx_keycmp_t *keycmp)
+{
+	avl_idx_t idx = root->avl_root;
+	avl_idx_t found = AVL_IDX_NIL;
+
+	/*
+	 * Remember the last element not less than @key and keep looking for
+	 * a smaller one on its left
+	 */
+	while (idx != AVL_IDX_NIL) {
+		avl_idx_node_t *node = avl_idx_node(base, idx);
+
+		if (keycmp(key, avl_idx_elem(base, idx)) <= 0) {
+			found = idx;
+			idx = node->avl_children[0];
+		} else {
+			idx = node->avl_children[1];
+		}
+	}
+	return found;
+}
+
+static avl_idx_t
+avl_idx_prev_next(const avl_idx_base_t *base, avl_idx_t idx, int dir)
+{
+	int which_child;
+	avl_idx_t child, parent;
+
+	which_child = avl_cmp2idx(dir);
+
+	child = avl_idx_node(base, idx)->avl_children[which_child];
+	if (child != AVL_IDX_NIL) {
+		idx = child;
+		while ((child = avl_idx_node(base, idx)->avl_children[
+		    !which_child]) != AVL_IDX_NIL)
+			idx = child;
+		return idx;
+	}
+	parent = avl_idx_node(base, idx)->avl_parent;
+	while (parent != AVL_IDX_NIL &&
+	    avl_idx_node(base, parent)->avl_children[which_child] == idx) {
+		idx = parent;
+		parent = avl_idx_node(base, idx)->avl_parent;
+	}
+	return parent;
+}
+
+static avl_idx_t
+avl_idx_leftmost_rightmost(const avl_idx_base_t *base, avl_idx_root_t *root,
+    int dir)
+{
+	int which_child = avl_cmp2idx(dir);
+	avl_idx_t prev = AVL_IDX_NIL;
+	avl_idx_t idx = root->avl_root;
+
+	while (idx != AVL_IDX_NIL) {
+		prev = idx;
+		idx = avl_idx_node(base, idx)->avl_children[which_child];
+	}
+
+	return prev;
+}
+
+/*
+ * Return the index of the element with the smallest key, or AVL_IDX_NIL if
+ * the tree is empty
+ */
+avl_idx_t
+avl_idx_first(const avl_idx_base_t *base, avl_idx_root_t *root)
+{
+	return avl_idx_leftmost_rightmost(base, root, -1);
+}
+
+/*
+ * Return the index of the element with the largest key, or AVL_IDX_NIL if
+ * the tree is empty
+ */
+avl_idx_t
+avl_idx_last(const avl_idx_base_t *base, avl_idx_root_t *root)
+{
+	return avl_idx_leftmost_rightmost(base, root, 1);
+}
+
+/*
+ * Return the in-order predecessor of the element at @idx, or AVL_IDX_NIL
+ */
+avl_idx_t
+avl_idx_prev(const avl_idx_base_t *base, avl_idx_t idx)
+{
+	return avl_idx_prev_next(base, idx, -1);
+}
+
+/*
+ * Return the in-order successor of the element at @idx, or AVL_IDX_NIL
+ */
+avl_idx_t
+avl_idx_next(const avl_idx_base_t *base, avl_idx_t idx)
+{
+	return avl_idx_prev_next(base, idx, 1);
+}
+
+/*
+ * Rotate the subtree rooted at the node at @idx, whose balance factor is
+ * about to become -2 or 2. The three cases are the same as in avl.c.
+ *
+ * Return 1 if the subtree is shortened, 0 otherwise.
+ */
+static int
+avl_idx_rebalance(const avl_idx_base_t *base, avl_idx_root_t *root,
+    avl_idx_t idx)
+{
+	int which_child;
+	avl_idx_t *slot;
+	avl_idx_t r, s, r_parent, b;
+	avl_idx_node_t *R, *S;
+
+	r = idx;
+	R = avl_idx_node(base, r);
+	which_child = avl_balance2idx(R->avl_balance);
+	s = R->avl_children[which_child];
+	S = avl_idx_node(base, s);
+	r_parent = R->avl_parent;
+	slot = avl_idx_slot(base, root, r);
+
+	if (R->avl_balance != S->avl_balance && S->avl_balance) {
+		avl_idx_t q, c;
+		avl_idx_node_t *Q;
+
+		/*
+		 * Case 2:
+		 * Double rotation is required
+		 */
+		q = S->avl_children[!which_child];
+		Q = avl_idx_node(base, q);
+		b = Q->avl_children[!which_child];
+		c = Q->avl_children[which_child];
+
+		*slot = q;
+		Q->avl_parent = r_parent;
+
+		R->avl_children[which_child] = b;
+		avl_idx_set_parent(base, b, r);
+		S->avl_children[!which_child] = c;
+		avl_idx_set_parent(base, c, s);
+
+		Q->avl_children[!which_child] = r;
+		R->avl_parent = q;
+		Q->avl_children[which_child] = s;
+		S->avl_parent = q;
+
+		if (Q->avl_balance == S->avl_balance) {
+			S->avl_balance = -Q->avl_balance;
+			R->avl_balance = 0;
+		} else if (Q->avl_balance) {
+			R->avl_balance = -Q->avl_balance;
+			S->avl_balance = 0;
+		} else {
+			S->avl_balance = 0;
+			R->avl_balance = 0;
+		}
+		Q->avl_balance = 0;
+		return 1;
+	}
+
+	/*
+	 * Case 1 and case 3:
+	 * Single rotation is required. In case 3, which only happens on
+	 * deletion, the child is in perfect balance and the height of the
+	 * subtree remains the same.
+	 */
+	b = S->avl_children[!which_child];
+
+	*slot = s;
+	S->avl_parent = r_parent;
+
+	R->avl_parent = s;
+	S->avl_children[!which_child] = r;
+
+	R->avl_children[which_child] = b;
+	avl_idx_set_parent(base, b, r);
+
+	if (S->avl_balance) {
+		S->avl_balance = 0;
+		R->avl_balance = 0;
+		return 1;
+	}
+	S->avl_balance = -R->avl_balance;
+	return 0;
+}
+
+/*
+ * Walk up from the node at @idx whose subtree has just grown by one level
+ * and restore the balance of the tree
+ */
+static void
+avl_idx_grow_fixup(const avl_idx_base_t *base, avl_idx_root_t *root,
+    avl_idx_t idx)
+{
+	avl_idx_t parent;
+
+	parent = avl_idx_node(base, idx)->avl_parent;
+	while (parent != AVL_IDX_NIL) {
+		int balance, abs_balance;
+		avl_idx_node_t *pnode = avl_idx_node(base, parent);
+
+		balance = avl_idx2cmp(avl_idx_which_child(base, idx));
+		balance += pnode->avl_balance;
+		abs_balance = avl_abs_balance(balance);
+		if (!abs_balance) {
+			/* Perfect balance is introduced */
+			pnode->avl_balance = balance;
+			break;
+		} else if (abs_balance == 1) {
+			pnode->avl_balance = balance;
+		} else {
+			/* A rotation on insertion always brings the subtree
+			 * back to its height before growing */
+			avl_idx_rebalance(base, root, parent);
+			break;
+		}
+
+		idx = parent;
+		parent = pnode->avl_parent;
+	}
+}
+
+/*
+ * Insert the element at @idx into the tree.
+ *
+ * Return the index of the element with the same key as the new one. That is,
+ * if there exists an element with the same key, the index returned will be
+ * different from @idx and the tree is left untouched.
+ */
+avl_idx_t
+avl_idx_insert(const avl_idx_base_t *base, avl_idx_root_t *root,
+    avl_idx_t idx, avl_idx_cmp_t *cmpfunc)
+{
+	int which_child = 0;
+	avl_idx_t parent = AVL_IDX_NIL;
+	avl_idx_t cur = root->avl_root;
+	avl_idx_node_t *node;
+	void *elem = avl_idx_elem(base, idx);
+
+	while (cur != AVL_IDX_NIL) {
+		int cmp = cmpfunc(elem, avl_idx_elem(base, cur));
+
+		if (!cmp)
+			return cur;
+		parent = cur;
+		which_child = avl_cmp2idx(cmp);
+		cur = avl_idx_node(base, cur)->avl_children[which_child];
+	}
+
+	node = avl_idx_node(base, idx);
+	node->avl_children[0] = node->avl_children[1] = AVL_IDX_NIL;
+	node->avl_parent = parent;
+	node->avl_balance = 0;
+	if (parent == AVL_IDX_NIL) {
+		root->avl_root = idx;
+		return idx;
+	}
+	avl_idx_node(base, parent)->avl_children[which_child] = idx;
+
+	avl_idx_grow_fixup(base, root, idx);
+	return idx;
+}
+
+/*
+ * Remove the element at @idx from the tree
+ */
+void
+avl_idx_remove(const avl_idx_base_t *base, avl_idx_root_t *root,
+    avl_idx_t idx)
+{
+	int which_child;
+	avl_idx_t parent;
+	avl_idx_node_t *node = avl_idx_node(base, idx);
+
+	if (node->avl_children[0] == AVL_IDX_NIL &&
+	    node->avl_children[1] == AVL_IDX_NIL) {
+		parent = node->avl_parent;
+		if (parent == AVL_IDX_NIL) {
+			/* This is the only node in the tree */
+			root->avl_root = AVL_IDX_NIL;
+			return;
+		}
+
+		which_child = avl_idx_which_child(base, idx);
+		avl_idx_node(base, parent)->avl_children[which_child] =
+		    AVL_IDX_NIL;
+	} else {
+		avl_idx_t child, gchild;
+		avl_idx_node_t *cnode;
+
+		/* Select the in-order predecessor or successor on the
+		 * taller side as the replacement */
+		child = avl_idx_prev_next(base, idx,
+		    node->avl_balance < 0 ? -1 : 1);
+		if (child == AVL_IDX_NIL)
+			child = avl_idx_prev_next(base, idx,
+			    node->avl_balance < 0 ? 1 : -1);
+		cnode = avl_idx_node(base, child);
+
+		gchild = cnode->avl_children[
+		    avl_balance2idx(cnode->avl_balance)];
+		parent = child;
+		which_child = avl_idx_which_child(base, child);
+		if (cnode->avl_parent != idx) {
+			/* @child is not the direct child of @node, it gives
+			 * its place to its only child */
+			parent = cnode->avl_parent;
+
+			cnode->avl_children[which_child] =
+			    node->avl_children[which_child];
+			avl_idx_set_parent(base,
+			    cnode->avl_children[which_child], child);
+
+			avl_idx_node(base, parent)->avl_children[which_child] =
+			    gchild;
+			avl_idx_set_parent(base, gchild, parent);
+		}
+
+		cnode->avl_children[!which_child] =
+		    node->avl_children[!which_child];
+		avl_idx_set_parent(base, cnode->avl_children[!which_child],
+		    child);
+		cnode->avl_balance = node->avl_balance;
+
+		/* @child takes the place of @node */
+		*avl_idx_slot(base, root, idx) = child;
+		cnode->avl_parent = node->avl_parent;
+	}
+
+	/*
+	 * Recalculate balance factor from the parent of the deleted node up to
+	 * possibly the root of the tree
+	 */
+	while (parent != AVL_IDX_NIL) {
+		int balance, abs_balance;
+		avl_idx_node_t *pnode = avl_idx_node(base, parent);
+
+		balance = avl_idx2cmp(which_child) * -1;
+
+		idx = parent;
+		which_child = avl_idx_which_child(base, parent);
+		parent = pnode->avl_parent;
+
+		balance += pnode->avl_balance;
+		abs_balance = avl_abs_balance(balance);
+		if (!abs_balance) {
+			pnode->avl_balance = balance;
+		} else if (abs_balance == 1) {
+			pnode->avl_balance = balance;
+			break;
+		} else if (!avl_idx_rebalance(base, root, idx)) {
+			break;
+		}
+	}
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2017 Ka Ho Ng <ngkaho1234@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#ifndef __AVL_IDX_H__
+#define __AVL_IDX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Index-based AVL tree
+ *
+ * This is the same AVL tree as in avl.h, except that the nodes live in a
+ * single array supplied by the caller, and are linked by their 32-bit indices
+ * into that array rather than by pointers. The node structure is thus half as
+ * big, and since nothing in the tree refers to an address, the array can be
+ * moved, copied or mapped at a different address and remain a valid tree.
+ */
+typedef uint32_t avl_idx_t;
+
+/* The null index */
+#define AVL_IDX_NIL ((avl_idx_t)UINT32_MAX)
+
+/*
+ * Intrusive node structure embedded in the elements of the array.
+ *
+ * The balance factor has the same meaning as in avl_node_t.
+ */
+typedef struct avl_idx_node_s {
+	avl_idx_t avl_children[2];		/* Indices of left child and right child */
+	avl_idx_t avl_parent;			/* Index of parent node */
+	int32_t avl_balance;			/* Balance factor */
+} avl_idx_node_t;
+
+/*
+ * Description of the array holding the nodes. It is only needed at runtime
+ * and can differ from one mapping of the array to another.
+ */
+typedef struct avl_idx_base_s {
+	void *avl_base;				/* Address of element 0 */
+	size_t avl_stride;			/* Size of each element */
+	size_t avl_offset;			/* Offset of avl_idx_node_t in an element */
+} avl_idx_base_t;
+
+/*
+ * A root structure that holds the whole AVL tree. It can be stored along with
+ * the array, as it holds an index as well.
+ */
+typedef struct avl_idx_root_s {
+	avl_idx_t avl_root;			/* Index of the root node */
+} avl_idx_root_t;
+
+/*
+ * AVL comparsion routine between two elements provided by user
+ */
+typedef int avl_idx_cmp_t(const void *a, const void *b);
+
+/*
+ * AVL comparsion routine between a bare key and an element provided by user
+ */
+typedef int avl_idx_keycmp_t(const void *key, const void *elem);
+
+/*
+ * Initialize the root of an empty tree
+ */
+static inline void avl_idx_root_init(avl_idx_root_t *root)
+{
+	root->avl_root = AVL_IDX_NIL;
+}
+
+/*
+ * Get the element at the given index
+ */
+static inline void *avl_idx_elem(const avl_idx_base_t *base, avl_idx_t idx)
+{
+	return (char *)base->avl_base + (size_t)idx * base->avl_stride;
+}
+
+/*
+ * Get the node of the element at the given index
+ */
+static inline avl_idx_node_t *
+avl_idx_node(const avl_idx_base_t *base, avl_idx_t idx)
+{
+	return (avl_idx_node_t *)((char *)avl_idx_elem(base, idx) +
+	    base->avl_offset);
+}
+
+avl_idx_t
+avl_idx_search_key(const avl_idx_base_t *base, avl_idx_root_t *root,
+    const void *key, avl_idx_keycmp_t *keycmp);
+
+avl_idx_t
+avl_idx_lower_bound_key(const avl_idx_base_t *base, avl_idx_root_t *root,
+    const void *key, avl_idx_keycmp_t *keycmp);
+
+avl_idx_t
+avl_idx_insert(const avl_idx_base_t *base, avl_idx_root_t *root,
+    avl_idx_t idx, avl_idx_cmp_t *cmpfunc);
+
+void
+avl_idx_remove(const avl_idx_base_t *base, avl_idx_root_t *root,
+    avl_idx_t idx);
+
+avl_idx_t
+avl_idx_first(const avl_idx_base_t *base, avl_idx_root_t *root);
+
+avl_idx_t
+avl_idx_last(const avl_idx_base_t *base, avl_idx_root_t *root);
+
+avl_idx_t
+avl_idx_prev(const avl_idx_base_t *base, avl_idx_t idx);
+
+avl_idx_t
+avl_idx_next(const avl_idx_base_t *base, avl_idx_t idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AVL_IDX_H__ */
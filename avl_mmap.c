@@ -0,0 +1,605 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "avl_mmap.h"
+
+#define AVL_MMAP_MAGIC		0x31706d6d6c7661ULL	/* "avlmmp1" */
+#define AVL_MMAP_VERSION	2
+
+/* The elements start on a page of their own, so that the header can be
+ * written back alone */
+#define AVL_MMAP_DATA		4096
+#define AVL_MMAP_MIN_CAPACITY	64
+
+/* Marks in the balance factor of the elements which are not in the tree, so
+ * that avl_mmap_recover() tells them from the others */
+#define AVL_MMAP_MARK_FREE	2	/* On the free list */
+#define AVL_MMAP_MARK_LOOSE	3	/* Handed out, not in the tree */
+
+/* Deeper than any AVL tree whose elements are counted by an avl_idx_t */
+#define AVL_MMAP_MAX_DEPTH	64
+
+#define AVL_MMAP_SUM_INIT	0xcbf29ce484222325ULL
+#define AVL_MMAP_SUM_PRIME	0x100000001b3ULL
+
+enum avl_mmap_state {
+	AVL_MMAP_CLEAN,				/* As of the last checkpoint */
+	AVL_MMAP_DIRTY,				/* Changed since */
+};
+
+/*
+ * Header at the start of the file
+ */
+struct avl_mmap_header {
+	uint64_t avl_magic;
+	uint32_t avl_version;
+	uint32_t avl_flags;			/* AVL_MMAP_CHECKSUM or 0 */
+	uint64_t avl_stride;			/* Size of each element */
+	uint64_t avl_offset;			/* Offset of avl_idx_node_t in an element */
+	uint64_t avl_capacity;			/* Number of elements the file has room for */
+	uint64_t avl_used;			/* Number of elements handed out so far */
+	avl_idx_root_t avl_tree;		/* Root of the tree */
+	avl_idx_t avl_free;			/* First free element, linked by avl_children[0] */
+	uint32_t avl_state;			/* enum avl_mmap_state */
+	uint32_t avl_pad;
+	uint64_t avl_data_sum;			/* Checksum of the elements, or 0 */
+	uint64_t avl_header_sum;		/* Checksum of the fields above */
+};
+
+struct avl_mmap_s {
+	struct avl_mmap_header *avl_header;	/* Start of the mapping */
+	size_t avl_size;			/* Size of the mapping */
+	avl_idx_base_t avl_base;		/* The elements in this mapping */
+	int avl_fd;
+};
+
+/*
+ * FNV-1a hash of @len bytes at @data, continuing from @sum
+ */
+static uint64_t
+avl_mmap_sum(uint64_t sum, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--) {
+		sum ^= *p++;
+		sum *= AVL_MMAP_SUM_PRIME;
+	}
+	return sum;
+}
+
+static uint64_t
+avl_mmap_header_sum(const struct avl_mmap_header *header)
+{
+	return avl_mmap_sum(AVL_MMAP_SUM_INIT, header,
+	    offsetof(struct avl_mmap_header, avl_header_sum));
+}
+
+static uint64_t
+avl_mmap_data_sum(const avl_mmap_t *map)
+{
+	return avl_mmap_sum(AVL_MMAP_SUM_INIT, map->avl_base.avl_base,
+	    map->avl_header->avl_used * map->avl_base.avl_stride);
+}
+
+/*
+ * Size of a file with room for @capacity elements, or 0 if it does not fit
+ * in a size_t
+ */
+static size_t
+avl_mmap_size(size_t stride, uint64_t capacity)
+{
+	if (capacity > (SIZE_MAX - AVL_MMAP_DATA) / stride)
+		return 0;
+	return AVL_MMAP_DATA + capacity * stride;
+}
+
+static int
+avl_mmap_map(avl_mmap_t *map, size_t size)
+{
+	void *addr;
+
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    map->avl_fd, 0);
+	if (addr == MAP_FAILED)
+		return -1;
+	map->avl_header = addr;
+	map->avl_size = size;
+	map->avl_base.avl_base = (char *)addr + AVL_MMAP_DATA;
+	return 0;
+}
+
+/*
+ * Lay out a new file with an empty tree
+ */
+static int
+avl_mmap_create(avl_mmap_t *map, int flags)
+{
+	struct avl_mmap_header *header;
+	size_t size;
+
+	size = avl_mmap_size(map->avl_base.avl_stride, AVL_MMAP_MIN_CAPACITY);
+	if (ftruncate(map->avl_fd, size) || avl_mmap_map(map, size))
+		return -1;
+
+	header = map->avl_header;
+	memset(header, 0, sizeof(*header));
+	header->avl_magic = AVL_MMAP_MAGIC;
+	header->avl_version = AVL_MMAP_VERSION;
+	header->avl_flags = flags & AVL_MMAP_CHECKSUM;
+	header->avl_stride = map->avl_base.avl_stride;
+	header->avl_offset = map->avl_base.avl_offset;
+	header->avl_capacity = AVL_MMAP_MIN_CAPACITY;
+	header->avl_used = 0;
+	avl_idx_root_init(&header->avl_tree);
+	header->avl_free = AVL_IDX_NIL;
+	header->avl_state = AVL_MMAP_DIRTY;
+	return avl_mmap_sync(map);
+}
+
+/*
+ * Check the header of an existing file of @size bytes against the layout
+ * asked for. When @recover is set, the state of the file and the checksums
+ * are not checked, as they are not kept up to date between two checkpoints.
+ */
+static int
+avl_mmap_check(avl_mmap_t *map, size_t size, int recover)
+{
+	const struct avl_mmap_header *header = map->avl_header;
+	size_t needed;
+
+	if (header->avl_magic != AVL_MMAP_MAGIC ||
+	    header->avl_version != AVL_MMAP_VERSION) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!recover && header->avl_state != AVL_MMAP_CLEAN) {
+		/* Left between two checkpoints */
+		errno = EIO;
+		return -1;
+	}
+
+	needed = avl_mmap_size(map->avl_base.avl_stride,
+	    header->avl_capacity);
+	if ((!recover &&
+	    header->avl_header_sum != avl_mmap_header_sum(header)) ||
+	    header->avl_stride != map->avl_base.avl_stride ||
+	    header->avl_offset != map->avl_base.avl_offset ||
+	    header->avl_capacity > AVL_IDX_NIL || !needed || needed > size ||
+	    header->avl_used > header->avl_capacity ||
+	    (header->avl_tree.avl_root != AVL_IDX_NIL &&
+	    header->avl_tree.avl_root >= header->avl_used) ||
+	    (header->avl_free != AVL_IDX_NIL &&
+	    header->avl_free >= header->avl_used)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!recover && (header->avl_flags & AVL_MMAP_CHECKSUM) &&
+	    header->avl_data_sum != avl_mmap_data_sum(map)) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Check the subtree of the node at @idx, whose parent is @parent, at @depth
+ * below the root: links, balance factors and order of the keys. @prev is the
+ * node before the subtree in order, and the nodes visited are set in @seen.
+ *
+ * Return the height of the subtree, or -1 if it is broken.
+ */
+static int
+avl_mmap_verify(avl_mmap_t *map, avl_idx_t idx, avl_idx_t parent, int depth,
+    avl_idx_cmp_t *cmpfunc, avl_idx_t *prev, unsigned char *seen)
+{
+	int left, right;
+	avl_idx_node_t *node;
+	const avl_idx_base_t *base = &map->avl_base;
+
+	if (idx == AVL_IDX_NIL)
+		return 0;
+	if (idx >= map->avl_header->avl_used || depth == AVL_MMAP_MAX_DEPTH ||
+	    (seen[idx / 8] & (1 << idx % 8)))
+		return -1;
+	seen[idx / 8] |= 1 << idx % 8;
+
+	node = avl_idx_node(base, idx);
+	if (node->avl_parent != parent)
+		return -1;
+	left = avl_mmap_verify(map, node->avl_children[0], idx, depth + 1,
+	    cmpfunc, prev, seen);
+	if (left < 0)
+		return -1;
+	if (*prev != AVL_IDX_NIL && cmpfunc(avl_idx_elem(base, *prev),
+	    avl_idx_elem(base, idx)) >= 0)
+		return -1;
+	*prev = idx;
+	right = avl_mmap_verify(map, node->avl_children[1], idx, depth + 1,
+	    cmpfunc, prev, seen);
+	if (right < 0 || node->avl_balance != right - left)
+		return -1;
+	return (left > right ? left : right) + 1;
+}
+
+static int
+avl_mmap_in_tree(const avl_idx_node_t *node)
+{
+	return node->avl_balance >= -1 && node->avl_balance <= 1;
+}
+
+/*
+ * Bring a file left between two checkpoints back to a consistent state, then
+ * checkpoint it. The tree is checked in O(n), and only when it is broken, as
+ * when a process died in the middle of a rotation, is it built again from the
+ * elements which are marked as in it, in O(n log n). The other elements are
+ * all freed, including those handed out but not inserted.
+ *
+ * Return 0, or -1 with errno set.
+ */
+static int
+avl_mmap_repair(avl_mmap_t *map, avl_idx_cmp_t *cmpfunc)
+{
+	int broken;
+	avl_idx_t idx, prev = AVL_IDX_NIL;
+	avl_idx_node_t *node;
+	unsigned char *seen;
+	struct avl_mmap_header *header = map->avl_header;
+	const avl_idx_base_t *base = &map->avl_base;
+
+	header->avl_state = AVL_MMAP_DIRTY;
+	seen = calloc(header->avl_used / 8 + 1, 1);
+	if (!seen)
+		return -1;
+	broken = avl_mmap_verify(map, header->avl_tree.avl_root, AVL_IDX_NIL,
+	    0, cmpfunc, &prev, seen) < 0;
+	for (idx = 0; !broken && idx < header->avl_used; ++idx)
+		if (!(seen[idx / 8] & (1 << idx % 8)) &&
+		    avl_mmap_in_tree(avl_idx_node(base, idx)))
+			broken = 1;
+	free(seen);
+
+	if (broken) {
+		avl_idx_root_init(&header->avl_tree);
+		for (idx = 0; idx < header->avl_used; ++idx) {
+			node = avl_idx_node(base, idx);
+			if (!avl_mmap_in_tree(node))
+				continue;
+			/* An element with the key of another one stays out */
+			node->avl_balance = AVL_MMAP_MARK_LOOSE;
+			avl_idx_insert(base, &header->avl_tree, idx, cmpfunc);
+		}
+	}
+
+	header->avl_free = AVL_IDX_NIL;
+	for (idx = header->avl_used; idx-- > 0;) {
+		node = avl_idx_node(base, idx);
+		if (avl_mmap_in_tree(node))
+			continue;
+		node->avl_children[0] = header->avl_free;
+		node->avl_balance = AVL_MMAP_MARK_FREE;
+		header->avl_free = idx;
+	}
+	return avl_mmap_sync(map);
+}
+
+/*
+ * Open the file, and with @recover, bring it back to a consistent state with
+ * that comparison routine
+ */
+static avl_mmap_t *
+avl_mmap_open_internal(const char *path, size_t stride, size_t offset,
+    int flags, avl_idx_cmp_t *recover)
+{
+	int err;
+	struct stat st;
+	avl_mmap_t *map;
+
+	if (stride < sizeof(avl_idx_node_t) ||
+	    offset > stride - sizeof(avl_idx_node_t)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	map = malloc(sizeof(*map));
+	if (!map)
+		return NULL;
+	map->avl_header = NULL;
+	map->avl_base.avl_stride = stride;
+	map->avl_base.avl_offset = offset;
+
+	map->avl_fd = open(path, O_RDWR | (flags & AVL_MMAP_CREATE ? O_CREAT :
+	    0), 0644);
+	if (map->avl_fd < 0 || fstat(map->avl_fd, &st))
+		goto fail;
+	if (!st.st_size && (flags & AVL_MMAP_CREATE)) {
+		if (avl_mmap_create(map, flags))
+			goto fail;
+	} else if (st.st_size < AVL_MMAP_DATA) {
+		errno = EINVAL;
+		goto fail;
+	} else if (avl_mmap_map(map, st.st_size) ||
+	    avl_mmap_check(map, st.st_size, recover != NULL) ||
+	    (recover && avl_mmap_repair(map, recover))) {
+		goto fail;
+	}
+	return map;
+
+fail:
+	err = errno;
+	if (map->avl_header)
+		munmap(map->avl_header, map->avl_size);
+	if (map->avl_fd >= 0)
+		close(map->avl_fd);
+	free(map);
+	errno = err;
+	return NULL;
+}
+
+/*
+ * Open the tree in the file at @path, whose elements are @stride bytes with
+ * their avl_idx_node_t at @offset. The file is created with an empty tree if
+ * it is empty and AVL_MMAP_CREATE is given.
+ *
+ * Return the open tree, or NULL with errno set. errno is EINVAL if the file
+ * does not hold a tree laid out the same way, and EIO if it was changed after
+ * its last checkpoint or its elements do not match their checksum.
+ */
+avl_mmap_t *
+avl_mmap_open(const char *path, size_t stride, size_t offset, int flags)
+{
+	return avl_mmap_open_internal(path, stride, offset, flags, NULL);
+}
+
+/*
+ * Open the tree in the file at @path like avl_mmap_open(), even if it was
+ * changed after its last checkpoint or its elements do not match their
+ * checksum: the tree is checked, repaired if need be with @cmpfunc, and
+ * checkpointed. Every insertion and removal that completed before the file
+ * was left is kept, and one that was interrupted is either completed or
+ * undone.
+ *
+ * Return the open tree, or NULL with errno set. errno is EINVAL if the file
+ * does not hold a tree laid out the same way.
+ */
+avl_mmap_t *
+avl_mmap_recover(const char *path, size_t stride, size_t offset,
+    avl_idx_cmp_t *cmpfunc)
+{
+	return avl_mmap_open_internal(path, stride, offset, 0, cmpfunc);
+}
+
+/*
+ * Checkpoint the tree and unmap it, which is done even if the checkpoint
+ * fails.
+ *
+ * Return 0, or -1 with errno set by the checkpoint, in which case the file
+ * has to be opened with avl_mmap_recover().
+ */
+int
+avl_mmap_close(avl_mmap_t *map)
+{
+	int ret, err;
+
+	ret = avl_mmap_sync(map);
+	err = errno;
+	munmap(map->avl_header, map->avl_size);
+	close(map->avl_fd);
+	free(map);
+	errno = err;
+	return ret;
+}
+
+/*
+ * Checkpoint: write the whole mapping back, then mark the file clean. The
+ * elements reach the disk before the header says they may be trusted.
+ *
+ * Return 0, or -1 with errno set by msync().
+ */
+int
+avl_mmap_sync(avl_mmap_t *map)
+{
+	struct avl_mmap_header *header = map->avl_header;
+
+	if (header->avl_state == AVL_MMAP_CLEAN)
+		return 0;
+
+	if (header->avl_flags & AVL_MMAP_CHECKSUM)
+		header->avl_data_sum = avl_mmap_data_sum(map);
+	if (msync(header, map->avl_size, MS_SYNC))
+		return -1;
+	header->avl_state = AVL_MMAP_CLEAN;
+	header->avl_header_sum = avl_mmap_header_sum(header);
+	return msync(header, sizeof(*header), MS_SYNC);
+}
+
+/*
+ * Mark the file as changed since the last checkpoint, and wait for the mark
+ * to reach the disk. The routines below do so themselves, but it must be
+ * called before changing an element in place.
+ *
+ * Return 0, or -1 with errno set by msync().
+ */
+int
+avl_mmap_dirty(avl_mmap_t *map)
+{
+	struct avl_mmap_header *header = map->avl_header;
+
+	if (header->avl_state == AVL_MMAP_DIRTY)
+		return 0;
+
+	header->avl_state = AVL_MMAP_DIRTY;
+	header->avl_header_sum = avl_mmap_header_sum(header);
+	if (msync(header, sizeof(*header), MS_SYNC)) {
+		header->avl_state = AVL_MMAP_CLEAN;
+		header->avl_header_sum = avl_mmap_header_sum(header);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Double the room in the file. The mapping moves, which the indices do not
+ * mind.
+ */
+static int
+avl_mmap_grow(avl_mmap_t *map)
+{
+	uint64_t capacity = map->avl_header->avl_capacity * 2;
+	struct avl_mmap_header *old = map->avl_header;
+	size_t size, old_size = map->avl_size;
+
+	if (capacity > AVL_IDX_NIL)
+		capacity = AVL_IDX_NIL;
+	size = avl_mmap_size(map->avl_base.avl_stride, capacity);
+	if (capacity == old->avl_capacity || !size) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (size > old_size && ftruncate(map->avl_fd, size))
+		return -1;
+	if (avl_mmap_map(map, size > old_size ? size : old_size)) {
+		map->avl_header = old;
+		map->avl_size = old_size;
+		map->avl_base.avl_base = (char *)old + AVL_MMAP_DATA;
+		return -1;
+	}
+	munmap(old, old_size);
+	map->avl_header->avl_capacity = capacity;
+	return 0;
+}
+
+/*
+ * Allocate an element, from the free ones or from the end of the file, which
+ * grows when it is full. On growth the elements move, so the addresses
+ * previously returned by avl_idx_elem() are no longer valid.
+ *
+ * Return the index of the element, or AVL_IDX_NIL with errno set.
+ */
+avl_idx_t
+avl_mmap_alloc(avl_mmap_t *map)
+{
+	avl_idx_t idx;
+	avl_idx_node_t *node;
+	struct avl_mmap_header *header;
+
+	if (avl_mmap_dirty(map))
+		return AVL_IDX_NIL;
+
+	header = map->avl_header;
+	if (header->avl_free != AVL_IDX_NIL) {
+		idx = header->avl_free;
+		node = avl_idx_node(&map->avl_base, idx);
+		node->avl_balance = AVL_MMAP_MARK_LOOSE;
+		header->avl_free = node->avl_children[0];
+		return idx;
+	}
+	if (header->avl_used == header->avl_capacity && avl_mmap_grow(map))
+		return AVL_IDX_NIL;
+
+	/* Marked before it is counted as handed out */
+	header = map->avl_header;
+	idx = header->avl_used;
+	avl_idx_node(&map->avl_base, idx)->avl_balance = AVL_MMAP_MARK_LOOSE;
+	header->avl_used = idx + 1;
+	return idx;
+}
+
+/*
+ * Give back an element which is not in the tree
+ *
+ * Return 0, or -1 with errno set.
+ */
+int
+avl_mmap_free(avl_mmap_t *map, avl_idx_t idx)
+{
+	avl_idx_node_t *node = avl_idx_node(&map->avl_base, idx);
+
+	if (avl_mmap_dirty(map))
+		return -1;
+	node->avl_children[0] = map->avl_header->avl_free;
+	node->avl_balance = AVL_MMAP_MARK_FREE;
+	map->avl_header->avl_free = idx;
+	return 0;
+}
+
+/*
+ * Insert the element at @idx into the tree, like avl_idx_insert()
+ *
+ * Return the index of the element with the same key, or AVL_IDX_NIL with
+ * errno set.
+ */
+avl_idx_t
+avl_mmap_insert(avl_mmap_t *map, avl_idx_t idx, avl_idx_cmp_t *cmpfunc)
+{
+	if (avl_mmap_dirty(map))
+		return AVL_IDX_NIL;
+	return avl_idx_insert(&map->avl_base, &map->avl_header->avl_tree, idx,
+	    cmpfunc);
+}
+
+/*
+ * Remove the element at @idx from the tree, like avl_idx_remove()
+ *
+ * Return 0, or -1 with errno set.
+ */
+int
+avl_mmap_remove(avl_mmap_t *map, avl_idx_t idx)
+{
+	if (avl_mmap_dirty(map))
+		return -1;
+	avl_idx_remove(&map->avl_base, &map->avl_header->avl_tree, idx);
+	avl_idx_node(&map->avl_base, idx)->avl_balance = AVL_MMAP_MARK_LOOSE;
+	return 0;
+}
+
+/*
+ * The elements and the root, for the avl_idx_*() read routines. Both change
+ * when the file grows.
+ */
+const avl_idx_base_t *
+avl_mmap_base(avl_mmap_t *map)
+{
+	return &map->avl_base;
+}
+
+avl_idx_root_t *
+avl_mmap_root(avl_mmap_t *map)
+{
+	return &map->avl_header->avl_tree;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2017 Ka Ho Ng <ngkaho1234@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#ifndef __AVL_MMAP_H__
+#define __AVL_MMAP_H__
+
+#include "avl_idx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * File-backed index-based AVL tree
+ *
+ * The elements of an index-based tree and its root live in a file mapped in
+ * memory, so that a restarted process, or another one taking over, maps the
+ * file and uses the tree right away: opening costs O(1), and the pages are
+ * read in as the tree is walked. A file in /dev/shm makes the tree survive
+ * the process but not the machine.
+ *
+ * The file starts with a header holding the layout of the elements, the root,
+ * the list of free elements and a checksum of the header, optionally with one
+ * of the elements as well. avl_mmap_sync() is a checkpoint: it writes the
+ * mapping back and marks the file clean, and avl_mmap_close() makes one. The
+ * first change after a checkpoint marks the file dirty on disk before going
+ * ahead, so a file left by a process which died between two checkpoints is
+ * refused by avl_mmap_open() rather than trusted.
+ *
+ * avl_mmap_recover() opens such a file nonetheless: it checks the tree in
+ * O(n) and builds it again if need be, from the elements marked as in it. The
+ * marks are kept in the balance factors of the elements, so that the freed
+ * elements and those handed out but not inserted are told apart from the
+ * others. This recovers the tree as the process left it, but after a crash of
+ * the machine, only the last checkpoint is certain to have reached the disk.
+ *
+ * The file holds native integers and is only meant to be opened on machines
+ * of the same kind. Only one process may use the file at a time.
+ */
+typedef struct avl_mmap_s avl_mmap_t;
+
+/* Create the file if it does not exist */
+#define AVL_MMAP_CREATE		0x1
+/* When creating the file, keep a checksum of the elements as well. It is
+ * computed on every checkpoint and checked on open, both in O(n). */
+#define AVL_MMAP_CHECKSUM	0x2
+
+avl_mmap_t *
+avl_mmap_open(const char *path, size_t stride, size_t offset, int flags);
+
+avl_mmap_t *
+avl_mmap_recover(const char *path, size_t stride, size_t offset,
+    avl_idx_cmp_t *cmpfunc);
+
+int
+avl_mmap_close(avl_mmap_t *map);
+
+int
+avl_mmap_sync(avl_mmap_t *map);
+
+int
+avl_mmap_dirty(avl_mmap_t *map);
+
+avl_idx_t
+avl_mmap_alloc(avl_mmap_t *map);
+
+int
+avl_mmap_free(avl_mmap_t *map, avl_idx_t idx);
+
+avl_idx_t
+avl_mmap_insert(avl_mmap_t *map, avl_idx_t idx, avl_idx_cmp_t *cmpfunc);
+
+int
+avl_mmap_remove(avl_mmap_t *map, avl_idx_t idx);
+
+const avl_idx_base_t *
+avl_mmap_base(avl_mmap_t *map);
+
+avl_idx_root_t *
+avl_mmap_root(avl_mmap_t *map);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AVL_MMAP_H__ */
@@ -0,0 +1,442 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include "avl_np.h"
+
+#define avl_cmp2idx(cmp) (!((cmp) < 0))
+#define avl_balance2idx(cmp) (!((cmp) < 0))
+#define avl_idx2cmp(idx) (!(idx)?-1:1)
+
+/*
+ * The key to look for in a descent, either given as a node compared with
+ * cmpfunc or as a bare key compared with keycmp
+ */
+struct avl_np_key {
+	const void *key;
+	avl_np_cmp_t *cmpfunc;
+	avl_np_keycmp_t *keycmp;
+};
+
+static inline int
+avl_np_key_cmp(const struct avl_np_key *key, avl_np_node_t *node)
+{
+	if (key->cmpfunc)
+		return key->cmpfunc((avl_np_node_t *)key->key, node);
+	return key->keycmp(key->key, node);
+}
+
+/*
+ * The path recorded on the way down. link[i] is the pointer (in the root or
+ * in a node) referring to the i-th node of the path, and dir[i] is the side
+ * of that node the descent went to.
+ */
+struct avl_np_path {
+	avl_np_node_t **link[AVL_MAX_HEIGHT];
+	int dir[AVL_MAX_HEIGHT];
+	int depth;
+};
+
+/*
+ * Descend from the root looking for @key, recording the path. On return
+ * link[depth] refers to the node with the key, or to the empty slot where it
+ * would be inserted.
+ */
+static avl_np_node_t *
+avl_np_descend(avl_np_root_t *avlroot, const struct avl_np_key *key,
+    struct avl_np_path *path)
+{
+	avl_np_node_t **link = &avlroot->avl_root;
+
+	path->depth = 0;
+	while (*link) {
+		int cmp;
+
+		cmp = avl_np_key_cmp(key, *link);
+		path->link[path->depth] = link;
+		if (!cmp)
+			return *link;
+		path->dir[path->depth++] = avl_cmp2idx(cmp);
+		link = &(*link)->avl_children[avl_cmp2idx(cmp)];
+	}
+	path->link[path->depth] = link;
+	return NULL;
+}
+
+static avl_np_node_t *
+avl_np_lookup(avl_np_root_t *avlroot, const struct avl_np_key *key)
+{
+	avl_np_node_t *node = avlroot->avl_root;
+
+	while (node) {
+		int cmp;
+
+		cmp = avl_np_key_cmp(key, node);
+		if (!cmp)
+			break;
+		node = node->avl_children[avl_cmp2idx(cmp)];
+	}
+	return node;
+}
+
+/*
+ * Search routines, same as avl_search() and avl_search_key()
+ */
+avl_np_node_t *
+avl_np_search(avl_np_root_t *avlroot, avl_np_node_t *key,
+    avl_np_cmp_t *cmpfunc)
+{
+	struct avl_np_key k = { key, cmpfunc, NULL };
+
+	return avl_np_lookup(avlroot, &k);
+}
+
+avl_np_node_t *
+avl_np_search_key(avl_np_root_t *avlroot, const void *key,
+    avl_np_keycmp_t *keycmp)
+{
+	struct avl_np_key k = { key, NULL, keycmp };
+
+	return avl_np_lookup(avlroot, &k);
+}
+
+/*
+ * Rotate the subtree referred to by @slot, whose balance factor is about
+ * to become -2 or 2. The three cases are the same as in avl_rebalance(),
+ * except that there is no parent pointer to maintain.
+ *
+ * Return 1 if the subtree is shortened, 0 otherwise.
+ */
+int
+avl_np_rebalance(avl_np_node_t **slot)
+{
+	int which_child;
+	avl_np_node_t *R, *S;
+
+	R = *slot;
+	which_child = avl_balance2idx(R->avl_balance);
+	S = R->avl_children[which_child];
+
+	if (R->avl_balance != S->avl_balance && S->avl_balance) {
+		avl_np_node_t *Q;
+
+		/*
+		 * Case 2:
+		 * Double rotation is required
+		 */
+		Q = S->avl_children[!which_child];
+		R->avl_children[which_child] = Q->avl_children[!which_child];
+		S->avl_children[!which_child] = Q->avl_children[which_child];
+		Q->avl_children[!which_child] = R;
+		Q->avl_children[which_child] = S;
+		*slot = Q;
+
+		if (Q->avl_balance == S->avl_balance) {
+			S->avl_balance = -Q->avl_balance;
+			R->avl_balance = 0;
+		} else if (Q->avl_balance) {
+			R->avl_balance = -Q->avl_balance;
+			S->avl_balance = 0;
+		} else {
+			S->avl_balance = 0;
+			R->avl_balance = 0;
+		}
+		Q->avl_balance = 0;
+		return 1;
+	}
+
+	/*
+	 * Case 1 and case 3:
+	 * Single rotation is required. In case 3, which only happens on
+	 * deletion, the child is in perfect balance and the height of the
+	 * subtree remains the same.
+	 */
+	R->avl_children[which_child] = S->avl_children[!which_child];
+	S->avl_children[!which_child] = R;
+	*slot = S;
+
+	if (S->avl_balance) {
+		S->avl_balance = 0;
+		R->avl_balance = 0;
+		return 1;
+	}
+	S->avl_balance = -R->avl_balance;
+	return 0;
+}
+
+/*
+ * Insert a new node into the tree
+ *
+ * Return the node with the same key as node parameter, like avl_insert().
+ */
+avl_np_node_t *
+avl_np_insert(avl_np_root_t *avlroot, avl_np_node_t *node,
+    avl_np_cmp_t *cmpfunc)
+{
+	int i;
+	avl_np_node_t *found;
+	struct avl_np_path path;
+	struct avl_np_key k = { node, cmpfunc, NULL };
+
+	found = avl_np_descend(avlroot, &k, &path);
+	if (found)
+		return found;
+
+	node->avl_children[0] = node->avl_children[1] = NULL;
+	node->avl_balance = 0;
+	*path.link[path.depth] = node;
+
+	/*
+	 * The subtree on the side recorded in dir[i] has grown, walk back up
+	 * until the growth is absorbed
+	 */
+	for (i = path.depth - 1; i >= 0; --i) {
+		int balance, abs_balance;
+		avl_np_node_t *parent = *path.link[i];
+
+		balance = parent->avl_balance + avl_idx2cmp(path.dir[i]);
+		abs_balance = avl_abs_balance(balance);
+		if (!abs_balance) {
+			parent->avl_balance = balance;
+			break;
+		} else if (abs_balance == 1) {
+			parent->avl_balance = balance;
+		} else {
+			/* A rotation on insertion always brings the subtree
+			 * back to its height before growing */
+			avl_np_rebalance(path.link[i]);
+			break;
+		}
+	}
+	return node;
+}
+
+static avl_np_node_t *
+avl_np_remove_internal(avl_np_root_t *avlroot, const struct avl_np_key *key)
+{
+	int i, depth;
+	avl_np_node_t *node, *child;
+	struct avl_np_path path;
+
+	node = avl_np_descend(avlroot, key, &path);
+	if (!node)
+		return NULL;
+
+	depth = path.depth;
+	if (!node->avl_children[0] || !node->avl_children[1]) {
+		/* @node has at most one child, which takes its place */
+		*path.link[depth] = node->avl_children[!node->avl_children[0]];
+	} else {
+		int side, k = depth;
+
+		/*
+		 * Continue the descent to the in-order predecessor or
+		 * successor on the taller side, which has at most one child
+		 * and will take the place of @node
+		 */
+		side = avl_balance2idx(node->avl_balance);
+		path.dir[depth++] = side;
+		path.link[depth] = &node->avl_children[side];
+		while ((*path.link[depth])->avl_children[!side]) {
+			path.dir[depth] = !side;
+			path.link[depth + 1] =
+			    &(*path.link[depth])->avl_children[!side];
+			++depth;
+		}
+		child = *path.link[depth];
+		*path.link[depth] = child->avl_children[side];
+
+		child->avl_children[0] = node->avl_children[0];
+		child->avl_children[1] = node->avl_children[1];
+		child->avl_balance = node->avl_balance;
+		*path.link[k] = child;
+		/* The link below @node has moved into @child */
+		path.link[k + 1] = &child->avl_children[side];
+	}
+
+	/*
+	 * The subtree on the side recorded in dir[i] has shrunk, walk back up
+	 * until the height of a subtree stays the same
+	 */
+	for (i = depth - 1; i >= 0; --i) {
+		int balance, abs_balance;
+		avl_np_node_t *parent = *path.link[i];
+
+		balance = parent->avl_balance - avl_idx2cmp(path.dir[i]);
+		abs_balance = avl_abs_balance(balance);
+		if (!abs_balance) {
+			parent->avl_balance = balance;
+		} else if (abs_balance == 1) {
+			parent->avl_balance = balance;
+			break;
+		} else if (!avl_np_rebalance(path.link[i])) {
+			break;
+		}
+	}
+	return node;
+}
+
+/*
+ * Remove the node with the same key as @key from the tree. Since there is no
+ * parent pointer, the node has to be found from the root.
+ *
+ * Return the removed node, or NULL if no node has the key.
+ */
+avl_np_node_t *
+avl_np_remove(avl_np_root_t *avlroot, avl_np_node_t *key,
+    avl_np_cmp_t *cmpfunc)
+{
+	struct avl_np_key k = { key, cmpfunc, NULL };
+
+	return avl_np_remove_internal(avlroot, &k);
+}
+
+avl_np_node_t *
+avl_np_remove_key(avl_np_root_t *avlroot, const void *key,
+    avl_np_keycmp_t *keycmp)
+{
+	struct avl_np_key k = { key, NULL, keycmp };
+
+	return avl_np_remove_internal(avlroot, &k);
+}
+
+/*
+ * Push @node and its descendants on the @dir side down to the leftmost or
+ * rightmost one on the path of the cursor
+ */
+static avl_np_node_t *
+avl_np_cursor_descend(avl_np_cursor_t *cursor, avl_np_node_t *node, int dir)
+{
+	int which_child = avl_cmp2idx(dir);
+
+	if (!node)
+		return avl_np_cursor_node(cursor);
+	while (node) {
+		cursor->avl_path[cursor->avl_depth++] = node;
+		node = node->avl_children[which_child];
+	}
+	return cursor->avl_path[cursor->avl_depth - 1];
+}
+
+/*
+ * Move the cursor to the smallest node of the tree and return it, or NULL if
+ * the tree is empty
+ */
+avl_np_node_t *
+avl_np_first(avl_np_root_t *avlroot, avl_np_cursor_t *cursor)
+{
+	cursor->avl_depth = 0;
+	return avl_np_cursor_descend(cursor, avlroot->avl_root, -1);
+}
+
+/*
+ * Move the cursor to the largest node of the tree and return it, or NULL if
+ * the tree is empty
+ */
+avl_np_node_t *
+avl_np_last(avl_np_root_t *avlroot, avl_np_cursor_t *cursor)
+{
+	cursor->avl_depth = 0;
+	return avl_np_cursor_descend(cursor, avlroot->avl_root, 1);
+}
+
+/*
+ * Move the cursor to the first node not less than @key and return it, or
+ * NULL if there is no such node
+ */
+avl_np_node_t *
+avl_np_seek(avl_np_root_t *avlroot, avl_np_cursor_t *cursor,
+    const void *key, avl_np_keycmp_t *keycmp)
+{
+	int found = 0;
+	avl_np_node_t *node = avlroot->avl_root;
+
+	/*
+	 * The path to the bound is a prefix of the path of the descent, so
+	 * the whole path is recorded and cut back to the last candidate
+	 */
+	cursor->avl_depth = 0;
+	while (node) {
+		int cmp;
+
+		cursor->avl_path[cursor->avl_depth++] = node;
+		cmp = keycmp(key, node);
+		if (cmp <= 0)
+			found = cursor->avl_depth;
+		if (!cmp)
+			break;
+		node = node->avl_children[avl_cmp2idx(cmp)];
+	}
+	cursor->avl_depth = found;
+	return avl_np_cursor_node(cursor);
+}
+
+/*
+ * Step the cursor in the direction of @dir. Every node is pushed and popped
+ * once in a full traversal, thus a step takes amortized constant time.
+ */
+static avl_np_node_t *
+avl_np_cursor_step(avl_np_cursor_t *cursor, int dir)
+{
+	int which_child = avl_cmp2idx(dir);
+	avl_np_node_t *node, *child;
+
+	node = avl_np_cursor_node(cursor);
+	if (!node)
+		return NULL;
+	if (node->avl_children[which_child])
+		return avl_np_cursor_descend(cursor,
+		    node->avl_children[which_child], -dir);
+
+	/* Go up until we come from the other side of an ancestor */
+	do {
+		child = cursor->avl_path[--cursor->avl_depth];
+		node = avl_np_cursor_node(cursor);
+	} while (node && node->avl_children[which_child] == child);
+	return node;
+}
+
+/*
+ * Move the cursor to the in-order predecessor and return it, or NULL if the
+ * cursor was at the first node
+ */
+avl_np_node_t *
+avl_np_prev(avl_np_cursor_t *cursor)
+{
+	return avl_np_cursor_step(cursor, -1);
+}
+
+/*
+ * Move the cursor to the in-order successor and return it, or NULL if the
+ * cursor was at the last node
+ */
+avl_np_node_t *
+avl_np_next(avl_np_cursor_t *cursor)
+{
+	return avl_np_cursor_step(cursor, 1);
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2017 Ka Ho Ng <ngkaho1234@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#ifndef __AVL_NP_H__
+#define __AVL_NP_H__
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * AVL tree without parent pointers
+ *
+ * The nodes of this tree only link to their children. Insertion and removal
+ * record the path from the root during the descent, and restore the balance
+ * of the tree by walking back up that path. The node is thus a word smaller
+ * than avl_node_t, and rotations touch fewer nodes. In exchange, it is not
+ * possible to step to the neighbour of an arbitrary node, thus in-order
+ * traversal is done with a cursor which carries the path to the current node.
+ *
+ * The balance factor has the same meaning as in avl_node_t.
+ */
+typedef struct avl_np_node_s {
+	struct avl_np_node_s *avl_children[2];	/* Pointers to left child and right child */
+	int avl_balance;			/* Balance factor */
+} avl_np_node_t;
+
+/*
+ * A root structure that holds the whole AVL tree
+ */
+typedef struct avl_np_root_s {
+	avl_np_node_t *avl_root;
+} avl_np_root_t;
+
+/*
+ * A position in the tree. It stays valid until the tree is modified.
+ */
+typedef struct avl_np_cursor_s {
+	avl_np_node_t *avl_path[AVL_MAX_HEIGHT];	/* Nodes from the root to the current one */
+	int avl_depth;					/* Number of nodes in the path, 0 past the end */
+} avl_np_cursor_t;
+
+/*
+ * AVL comparsion routine provided by user
+ */
+typedef int avl_np_cmp_t(avl_np_node_t *, avl_np_node_t *);
+
+/*
+ * AVL comparsion routine between a bare key and a node provided by user
+ */
+typedef int avl_np_keycmp_t(const void *key, avl_np_node_t *node);
+
+avl_np_node_t *
+avl_np_search(avl_np_root_t *avlroot, avl_np_node_t *key,
+    avl_np_cmp_t *cmpfunc);
+
+avl_np_node_t *
+avl_np_search_key(avl_np_root_t *avlroot, const void *key,
+    avl_np_keycmp_t *keycmp);
+
+avl_np_node_t *
+avl_np_insert(avl_np_root_t *avlroot, avl_np_node_t *node,
+    avl_np_cmp_t *cmpfunc);
+
+avl_np_node_t *
+avl_np_remove(avl_np_root_t *avlroot, avl_np_node_t *key,
+    avl_np_cmp_t *cmpfunc);
+
+avl_np_node_t *
+avl_np_remove_key(avl_np_root_t *avlroot, const void *key,
+    avl_np_keycmp_t *keycmp);
+
+avl_np_node_t *
+avl_np_first(avl_np_root_t *avlroot, avl_np_cursor_t *cursor);
+
+avl_np_node_t *
+avl_np_last(avl_np_root_t *avlroot, avl_np_cursor_t *cursor);
+
+avl_np_node_t *
+avl_np_seek(avl_np_root_t *avlroot, avl_np_cursor_t *cursor,
+    const void *key, avl_np_keycmp_t *keycmp);
+
+avl_np_node_t *
+avl_np_prev(avl_np_cursor_t *cursor);
+
+avl_np_node_t *
+avl_np_next(avl_np_cursor_t *cursor);
+
+/*
+ * Rotate the subtree referred to by @slot, for the variants built on this
+ * tree. Return 1 if the subtree is shortened.
+ */
+int
+avl_np_rebalance(avl_np_node_t **slot);
+
+/*
+ * Return the node the cursor is at, or NULL if it is past the end
+ */
+static inline avl_np_node_t *
+avl_np_cursor_node(const avl_np_cursor_t *cursor)
+{
+	return cursor->avl_depth ? cursor->avl_path[cursor->avl_depth - 1] :
+	    NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AVL_NP_H__ */
@@ -0,0 +1,374 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "avl_pool.h"
+
+/* Smallest slab, and smallest number of objects in a slab */
+#define AVL_POOL_SLAB		(64 * 1024)
+#define AVL_POOL_MIN_OBJS	8
+
+/* Alignment of the objects */
+#define AVL_POOL_ALIGN		16
+
+/* Highest NUMA node a slab can be bound to, plus one */
+#define AVL_POOL_MAX_NODES	1024
+
+/*
+ * Header at the start of every slab
+ */
+struct avl_slab {
+	struct avl_slab *avl_next;		/* Next slab with free objects */
+	struct avl_slab *avl_prev;		/* Previous slab with free objects */
+	struct avl_slab *avl_snext;		/* Next slab of the pool */
+	struct avl_slab *avl_sprev;		/* Previous slab of the pool */
+	void *avl_free;				/* First free object */
+	size_t avl_used;			/* Number of objects handed out */
+	size_t avl_fresh;			/* Number of objects never handed out */
+	int avl_listed;				/* Whether the slab is in avl_partial */
+};
+
+struct avl_pool_s {
+	size_t avl_objsize;			/* Size of an object, aligned */
+	size_t avl_offset;			/* Offset of avl_node_t in an object */
+	size_t avl_slab_size;			/* Size and alignment of a slab */
+	size_t avl_per_slab;			/* Number of objects in a slab */
+	size_t avl_used;			/* Number of objects handed out */
+	size_t avl_nslabs;			/* Number of slabs mapped */
+	int avl_numa_node;			/* Node the slabs are bound to, or -1 */
+	struct avl_slab *avl_partial;		/* Slabs with free objects */
+	struct avl_slab *avl_empty;		/* Empty slab kept for reuse */
+	struct avl_slab *avl_slabs;		/* Every slab */
+};
+
+/* The objects start after the slab header */
+#define AVL_SLAB_START \
+	((sizeof(struct avl_slab) + AVL_POOL_ALIGN - 1) & ~(size_t)(AVL_POOL_ALIGN - 1))
+
+static inline struct avl_slab *
+avl_slab_of(const avl_pool_t *pool, const void *obj)
+{
+	return (struct avl_slab *)((uintptr_t)obj &
+	    ~(uintptr_t)(pool->avl_slab_size - 1));
+}
+
+static inline void *
+avl_slab_obj(const avl_pool_t *pool, struct avl_slab *slab, size_t i)
+{
+	return (char *)slab + AVL_SLAB_START + i * pool->avl_objsize;
+}
+
+/*
+ * Map @size bytes aligned to @size
+ */
+static void *
+avl_pool_map(size_t size)
+{
+	char *p, *aligned;
+
+	p = mmap(NULL, 2 * size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	aligned = (char *)(((uintptr_t)p + size - 1) & ~(uintptr_t)(size - 1));
+	if (aligned > p)
+		munmap(p, aligned - p);
+	if (aligned + size < p + 2 * size)
+		munmap(aligned + size, p + 2 * size - (aligned + size));
+	return aligned;
+}
+
+/*
+ * Prefer the pages of a slab to come from @node. The slab is not touched
+ * yet, so this is where they will be allocated.
+ */
+static void
+avl_pool_bind(void *addr, size_t size, int node)
+{
+#ifdef __linux__
+	/* MPOL_PREFERRED, which is only advice */
+	enum { avl_mpol_preferred = 1 };
+	unsigned long mask[AVL_POOL_MAX_NODES / (8 * sizeof(unsigned long))];
+
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(unsigned long))] |=
+	    1UL << (node % (8 * sizeof(unsigned long)));
+	syscall(SYS_mbind, addr, size, avl_mpol_preferred, mask,
+	    AVL_POOL_MAX_NODES + 1, 0);
+#else
+	(void)addr;
+	(void)size;
+	(void)node;
+#endif
+}
+
+/*
+ * Create a pool of objects of @objsize bytes, whose avl_node_t is at
+ * @offset. If @numa_node is not negative, the slabs are bound to that node.
+ *
+ * Return the pool, or NULL with errno set.
+ */
+avl_pool_t *
+avl_pool_create(size_t objsize, size_t offset, int numa_node)
+{
+	avl_pool_t *pool;
+	size_t slab_size = AVL_POOL_SLAB;
+
+	if (objsize < sizeof(avl_node_t) ||
+	    offset > objsize - sizeof(avl_node_t) ||
+	    numa_node >= AVL_POOL_MAX_NODES ||
+	    objsize > (SIZE_MAX >> 2) / AVL_POOL_MIN_OBJS) {
+		errno = EINVAL;
+		return NULL;
+	}
+	pool = malloc(sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	/* Free objects hold the free list link */
+	if (objsize < sizeof(void *))
+		objsize = sizeof(void *);
+	pool->avl_objsize = (objsize + AVL_POOL_ALIGN - 1) &
+	    ~(size_t)(AVL_POOL_ALIGN - 1);
+	while ((slab_size - AVL_SLAB_START) / pool->avl_objsize <
+	    AVL_POOL_MIN_OBJS)
+		slab_size *= 2;
+	pool->avl_offset = offset;
+	pool->avl_slab_size = slab_size;
+	pool->avl_per_slab = (slab_size - AVL_SLAB_START) / pool->avl_objsize;
+	pool->avl_used = 0;
+	pool->avl_nslabs = 0;
+	pool->avl_numa_node = numa_node < 0 ? -1 : numa_node;
+	pool->avl_partial = NULL;
+	pool->avl_empty = NULL;
+	pool->avl_slabs = NULL;
+	return pool;
+}
+
+/*
+ * Destroy a pool, releasing all of its slabs at once. The objects still
+ * allocated from it, and the trees they are in, must not be used anymore;
+ * use avl_destroy() with avl_pool_release() instead for a tree whose objects
+ * need cleaning up one by one.
+ */
+void
+avl_pool_destroy(avl_pool_t *pool)
+{
+	struct avl_slab *slab, *next;
+
+	for (slab = pool->avl_slabs; slab; slab = next) {
+		next = slab->avl_snext;
+		munmap(slab, pool->avl_slab_size);
+	}
+	free(pool);
+}
+
+static void
+avl_pool_list(avl_pool_t *pool, struct avl_slab *slab)
+{
+	slab->avl_prev = NULL;
+	slab->avl_next = pool->avl_partial;
+	if (pool->avl_partial)
+		pool->avl_partial->avl_prev = slab;
+	pool->avl_partial = slab;
+	slab->avl_listed = 1;
+}
+
+static void
+avl_pool_unlist(avl_pool_t *pool, struct avl_slab *slab)
+{
+	if (slab->avl_prev)
+		slab->avl_prev->avl_next = slab->avl_next;
+	else
+		pool->avl_partial = slab->avl_next;
+	if (slab->avl_next)
+		slab->avl_next->avl_prev = slab->avl_prev;
+	slab->avl_listed = 0;
+}
+
+static struct avl_slab *
+avl_pool_grow(avl_pool_t *pool)
+{
+	struct avl_slab *slab;
+
+	slab = avl_pool_map(pool->avl_slab_size);
+	if (!slab)
+		return NULL;
+	if (pool->avl_numa_node >= 0)
+		avl_pool_bind(slab, pool->avl_slab_size,
+		    pool->avl_numa_node);
+	slab->avl_free = NULL;
+	slab->avl_used = 0;
+	slab->avl_fresh = pool->avl_per_slab;
+	slab->avl_sprev = NULL;
+	slab->avl_snext = pool->avl_slabs;
+	if (pool->avl_slabs)
+		pool->avl_slabs->avl_sprev = slab;
+	pool->avl_slabs = slab;
+	avl_pool_list(pool, slab);
+	pool->avl_nslabs++;
+	return slab;
+}
+
+/*
+ * Take an object from a slab with room
+ */
+static void *
+avl_slab_take(avl_pool_t *pool, struct avl_slab *slab)
+{
+	void *obj;
+
+	if (slab->avl_free) {
+		obj = slab->avl_free;
+		slab->avl_free = *(void **)obj;
+	} else {
+		/* Objects never handed out are taken in address order */
+		obj = avl_slab_obj(pool, slab,
+		    pool->avl_per_slab - slab->avl_fresh--);
+	}
+	if (++slab->avl_used == pool->avl_per_slab)
+		avl_pool_unlist(pool, slab);
+	pool->avl_used++;
+	return obj;
+}
+
+/*
+ * Allocate an object
+ *
+ * Return the object, or NULL if memory ran out.
+ */
+void *
+avl_pool_alloc(avl_pool_t *pool)
+{
+	struct avl_slab *slab = pool->avl_partial;
+
+	if (!slab && pool->avl_empty) {
+		slab = pool->avl_empty;
+		pool->avl_empty = NULL;
+		avl_pool_list(pool, slab);
+	} else if (!slab) {
+		slab = avl_pool_grow(pool);
+		if (!slab)
+			return NULL;
+	}
+	return avl_slab_take(pool, slab);
+}
+
+/*
+ * Allocate an object in the same slab as @hint if it has room, e.g. the
+ * parent or a neighbour of the node about to be inserted, or anywhere
+ * otherwise. @hint may be NULL.
+ */
+void *
+avl_pool_alloc_near(avl_pool_t *pool, const void *hint)
+{
+	struct avl_slab *slab;
+
+	if (hint) {
+		slab = avl_slab_of(pool, hint);
+		if (slab->avl_used < pool->avl_per_slab)
+			return avl_slab_take(pool, slab);
+	}
+	return avl_pool_alloc(pool);
+}
+
+/*
+ * Give an object back to its slab
+ */
+void
+avl_pool_free(avl_pool_t *pool, void *obj)
+{
+	struct avl_slab *slab = avl_slab_of(pool, obj);
+
+	*(void **)obj = slab->avl_free;
+	slab->avl_free = obj;
+	slab->avl_used--;
+	pool->avl_used--;
+	if (!slab->avl_listed)
+		avl_pool_list(pool, slab);
+
+	if (slab->avl_used)
+		return;
+
+	/*
+	 * Keep one empty slab aside, so that a tree going back and forth across
+	 * a slab boundary does not map and unmap a slab on every operation
+	 */
+	avl_pool_unlist(pool, slab);
+	if (!pool->avl_empty) {
+		pool->avl_empty = slab;
+		return;
+	}
+	if (slab->avl_sprev)
+		slab->avl_sprev->avl_snext = slab->avl_snext;
+	else
+		pool->avl_slabs = slab->avl_snext;
+	if (slab->avl_snext)
+		slab->avl_snext->avl_sprev = slab->avl_sprev;
+	munmap(slab, pool->avl_slab_size);
+	pool->avl_nslabs--;
+}
+
+/*
+ * Destroy routine for avl_destroy(), giving the object of every node back to
+ * @pool
+ */
+void
+avl_pool_release(avl_node_t *node, void *pool)
+{
+	avl_pool_t *p = pool;
+
+	avl_pool_free(p, (char *)node - p->avl_offset);
+}
+
+/*
+ * Return the number of objects handed out and not freed
+ */
+size_t
+avl_pool_used(const avl_pool_t *pool)
+{
+	return pool->avl_used;
+}
+
+/*
+ * Return the number of slabs mapped, including the empty one kept for reuse
+ */
+size_t
+avl_pool_slabs(const avl_pool_t *pool)
+{
+	return pool->avl_nslabs;
+}
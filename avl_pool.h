@@ -0,0 +1,86 @@
+/*
+ * Copyright 2017 Ka Ho Ng <ngkaho1234@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#ifndef __AVL_POOL_H__
+#define __AVL_POOL_H__
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Slab allocator for the elements of intrusive trees
+ *
+ * A pool hands out fixed-size objects embedding an avl_node_t from slabs of
+ * 64 KiB or more, each with a free list of its own. Slabs are aligned to
+ * their size, so the slab of an object is found from its address alone:
+ * avl_pool_alloc_near() uses that to place a new object in the slab of a
+ * neighbour in the tree when it has room, so that nodes close in the tree
+ * tend to be close in memory. A slab whose objects are all free is kept aside
+ * and reused before a new one is mapped; it is given back to the system only
+ * when another empty slab is already kept.
+ *
+ * The slabs can be bound to a NUMA node, as a preference, on Linux.
+ *
+ * A pool is not thread-safe: it is meant to be used for a single tree, or by
+ * a single thread.
+ */
+typedef struct avl_pool_s avl_pool_t;
+
+avl_pool_t *
+avl_pool_create(size_t objsize, size_t offset, int numa_node);
+
+void
+avl_pool_destroy(avl_pool_t *pool);
+
+void *
+avl_pool_alloc(avl_pool_t *pool);
+
+void *
+avl_pool_alloc_near(avl_pool_t *pool, const void *hint);
+
+void
+avl_pool_free(avl_pool_t *pool, void *obj);
+
+void
+avl_pool_release(avl_node_t *node, void *pool);
+
+size_t
+avl_pool_used(const avl_pool_t *pool);
+
+size_t
+avl_pool_slabs(const avl_pool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AVL_POOL_H__ */
@@ -0,0 +1,234 @@
+/*
+ * Copyright 2017 Ka Ho Ng <ngkaho1234@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#ifndef __AVL_RCU_H__
+#define __AVL_RCU_H__
+
+#include <sched.h>
+#include "avl.h"
+
+#ifndef AVL_RCU
+#error "avl_rcu.h requires AVL_RCU to be defined for avl.c and its users"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * AVL tree with lookups concurrent to a writer
+ *
+ * With AVL_RCU defined, avl_search(), avl_search_key(), avl_search_many() and
+ * the bound queries never loop or follow an uninitialized link when they run
+ * concurrently with avl_insert(), avl_insert_key(), avl_insert_at() or
+ * avl_remove(), and a node they return has the key they were looking for,
+ * provided that:
+ *
+ * - writers are serialized by the caller, e.g. with a mutex;
+ * - readers run inside an RCU read-side critical section (or under epoch
+ *   protection), and a removed node is only freed or reused after a grace
+ *   period has elapsed.
+ *
+ * However, a rotation or a removal racing with such a lookup may temporarily
+ * hide a subtree from it, thus a negative result (or a bound that is not the
+ * closest one) cannot be trusted. The avl_rcu_ routines below pair the tree
+ * with a sequence count, and retry a lookup whose result may have been
+ * affected by a concurrent writer; use them instead of the bare queries.
+ *
+ * A reader retries only when a writer ran during its lookup. After
+ * AVL_RCU_RETRIES such attempts, it holds back the writers that have not
+ * started yet, waits for the running one to finish and looks up once more, so
+ * that a busy writer cannot starve it. A writer thus waits for at most one
+ * lookup per reader that failed this often. Both wait by yielding the CPU, as
+ * the thread waited for may need it.
+ *
+ * The other routines (iteration, bulk building, joining, splitting, etc.) must
+ * not run concurrently with a writer.
+ */
+typedef struct avl_rcu_root_s {
+	avl_root_t avl_tree;
+	unsigned avl_seq;			/* Odd while a writer is active */
+	unsigned avl_waiters;			/* Readers holding back writers */
+} avl_rcu_root_t;
+
+/* Lookups a reader attempts before it holds back the writers */
+#define AVL_RCU_RETRIES 4
+
+static inline void
+avl_rcu_write_begin(avl_rcu_root_t *root)
+{
+	while (__atomic_load_n(&root->avl_waiters, __ATOMIC_SEQ_CST))
+		sched_yield();
+	__atomic_store_n(&root->avl_seq, root->avl_seq + 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void
+avl_rcu_write_end(avl_rcu_root_t *root)
+{
+	__atomic_store_n(&root->avl_seq, root->avl_seq + 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Start the lookup numbered @attempt, counting from 0, and return the
+ * sequence count to check it against with avl_rcu_read_retry(). Once the
+ * lookup is final, avl_rcu_read_end() must be called with the same @attempt.
+ */
+static inline unsigned
+avl_rcu_read_begin(avl_rcu_root_t *root, int attempt)
+{
+	unsigned seq;
+
+	if (attempt == AVL_RCU_RETRIES)
+		__atomic_fetch_add(&root->avl_waiters, 1, __ATOMIC_SEQ_CST);
+	seq = __atomic_load_n(&root->avl_seq, __ATOMIC_SEQ_CST);
+	while (attempt >= AVL_RCU_RETRIES && (seq & 1)) {
+		sched_yield();
+		seq = __atomic_load_n(&root->avl_seq, __ATOMIC_SEQ_CST);
+	}
+	return seq;
+}
+
+/*
+ * Return nonzero if a writer was active since avl_rcu_read_begin()
+ * returned @seq
+ */
+static inline int
+avl_rcu_read_retry(const avl_rcu_root_t *root, unsigned seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (seq & 1) ||
+	    __atomic_load_n(&root->avl_seq, __ATOMIC_RELAXED) != seq;
+}
+
+static inline void
+avl_rcu_read_end(avl_rcu_root_t *root, int attempt)
+{
+	if (attempt >= AVL_RCU_RETRIES)
+		__atomic_fetch_sub(&root->avl_waiters, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Insert a node, same as avl_insert(). The caller must hold the writer lock.
+ */
+static inline avl_node_t *
+avl_rcu_insert(avl_rcu_root_t *root, avl_node_t *node, avl_cmp_t *cmpfunc)
+{
+	avl_node_t *ret;
+
+	avl_rcu_write_begin(root);
+	ret = avl_insert(&root->avl_tree, node, cmpfunc);
+	avl_rcu_write_end(root);
+	return ret;
+}
+
+/*
+ * Remove a node, same as avl_remove(). The caller must hold the writer lock.
+ *
+ * @defer is then called with the node and @arg, to free the node once the
+ * readers are done with it, e.g. by handing it to call_rcu().
+ */
+static inline void
+avl_rcu_remove(avl_rcu_root_t *root, avl_node_t *node, avl_destroy_t *defer,
+    void *arg)
+{
+	avl_rcu_write_begin(root);
+	avl_remove(&root->avl_tree, node);
+	avl_rcu_write_end(root);
+	if (defer)
+		defer(node, arg);
+}
+
+/*
+ * Define avl_rcu_<query>(), the same as avl_<query>() but safe against a
+ * concurrent writer. With @found_is_final, a node found is always right and
+ * only its absence has to be confirmed.
+ */
+#define AVL_RCU_QUERY(query, keytype, cmptype, found_is_final)		\
+static inline avl_node_t *						\
+avl_rcu_##query(avl_rcu_root_t *root, keytype key, cmptype *cmpfunc)	\
+{									\
+	avl_node_t *node;						\
+	int attempt;							\
+									\
+	for (attempt = 0;; ++attempt) {					\
+		unsigned seq = avl_rcu_read_begin(root, attempt);	\
+									\
+		node = avl_##query(&root->avl_tree, key, cmpfunc);	\
+		if ((found_is_final && node) ||				\
+		    !avl_rcu_read_retry(root, seq))			\
+			break;						\
+	}								\
+	avl_rcu_read_end(root, attempt);				\
+	return node;							\
+}
+
+AVL_RCU_QUERY(search, avl_node_t *, avl_cmp_t, 1)
+AVL_RCU_QUERY(search_key, const void *, avl_keycmp_t, 1)
+AVL_RCU_QUERY(lower_bound, avl_node_t *, avl_cmp_t, 0)
+AVL_RCU_QUERY(lower_bound_key, const void *, avl_keycmp_t, 0)
+AVL_RCU_QUERY(upper_bound, avl_node_t *, avl_cmp_t, 0)
+AVL_RCU_QUERY(upper_bound_key, const void *, avl_keycmp_t, 0)
+AVL_RCU_QUERY(floor, avl_node_t *, avl_cmp_t, 0)
+AVL_RCU_QUERY(floor_key, const void *, avl_keycmp_t, 0)
+AVL_RCU_QUERY(ceil, avl_node_t *, avl_cmp_t, 0)
+AVL_RCU_QUERY(ceil_key, const void *, avl_keycmp_t, 0)
+
+#undef AVL_RCU_QUERY
+
+/*
+ * Batched search safe against a concurrent writer, same as avl_search_many().
+ * The whole batch is searched again when a key was not found and a writer
+ * may have hidden it.
+ */
+static inline void
+avl_rcu_search_many(avl_rcu_root_t *root, const void *const *keys, size_t n,
+    avl_keycmp_t *keycmp, avl_prefetch_t *prefetch, avl_node_t **out)
+{
+	int attempt;
+
+	for (attempt = 0;; ++attempt) {
+		unsigned seq = avl_rcu_read_begin(root, attempt);
+		size_t i;
+
+		avl_search_many(&root->avl_tree, keys, n, keycmp, prefetch,
+		    out);
+		for (i = 0; i < n && out[i]; ++i)
+			;
+		if (i == n || !avl_rcu_read_retry(root, seq))
+			break;
+	}
+	avl_rcu_read_end(root, attempt);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AVL_RCU_H__ */
@@ -0,0 +1,379 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl_serialize.h"
+
+/*
+ * The header is the magic, the version and three zero bytes, the record size
+ * on 32 bits and the number of records on 64 bits
+ */
+#define AVL_SERIALIZE_MAGIC	"AVLS"
+#define AVL_SERIALIZE_VERSION	1
+
+/* Records are written and read in chunks of about this size */
+#define AVL_SERIALIZE_CHUNK	4096
+
+struct avl_deserializer_s {
+	avl_builder_t avl_builder;
+	avl_root_t *avl_root;			/* Tree being loaded */
+	avl_decode_t *avl_decode;
+	avl_cmp_t *avl_cmp;			/* Order check, or NULL */
+	void *avl_arg;				/* Argument of avl_decode */
+	avl_node_t *avl_last;			/* Node most recently placed */
+	avl_node_t *avl_reject;			/* Node out of order, or NULL */
+	size_t avl_recsize;
+	size_t avl_count;			/* Number of records, once the header is in */
+	size_t avl_done;			/* Number of records placed */
+	size_t avl_have;			/* Bytes of the header or record buffered */
+	int avl_started;			/* Whether the header is in */
+	int avl_failed;
+	unsigned char avl_header[AVL_SERIALIZE_HEADER];
+	unsigned char avl_rec[];		/* Record straddling two chunks */
+};
+
+static void
+avl_put_le(unsigned char *p, uint64_t v, int bytes)
+{
+	int i;
+
+	for (i = 0; i < bytes; ++i)
+		p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint64_t
+avl_get_le(const unsigned char *p, int bytes)
+{
+	int i;
+	uint64_t v = 0;
+
+	for (i = 0; i < bytes; ++i)
+		v |= (uint64_t)p[i] << (8 * i);
+	return v;
+}
+
+/*
+ * Write the tree as a header and a record of @recsize bytes per node in key
+ * order. Each record is filled by @encode, and the bytes are handed to @write
+ * in chunks. Both get @arg.
+ *
+ * Return 0, or -1 if @write failed or memory ran out.
+ */
+int
+avl_serialize(avl_root_t *avlroot, size_t recsize, avl_encode_t *encode,
+    avl_write_t *write, void *arg)
+{
+	int ret = -1;
+	size_t n = 0, per_chunk, used = 0;
+	unsigned char header[AVL_SERIALIZE_HEADER], *chunk;
+	avl_node_t *node;
+
+	if (!recsize || recsize > UINT32_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* The count goes first, so that the receiver can build as it reads */
+	for (node = avl_first(avlroot); node; node = avl_next(node))
+		++n;
+	memset(header, 0, sizeof(header));
+	memcpy(header, AVL_SERIALIZE_MAGIC, 4);
+	header[4] = AVL_SERIALIZE_VERSION;
+	avl_put_le(header + 8, recsize, 4);
+	avl_put_le(header + 12, n, 8);
+	if (write(header, sizeof(header), arg))
+		return -1;
+
+	per_chunk = recsize < AVL_SERIALIZE_CHUNK ?
+	    AVL_SERIALIZE_CHUNK / recsize : 1;
+	chunk = malloc(per_chunk * recsize);
+	if (!chunk)
+		return -1;
+	for (node = avl_first(avlroot); node; node = avl_next(node)) {
+		encode(node, chunk + used * recsize, arg);
+		if (++used == per_chunk) {
+			if (write(chunk, used * recsize, arg))
+				goto out;
+			used = 0;
+		}
+	}
+	if (used && write(chunk, used * recsize, arg))
+		goto out;
+	ret = 0;
+out:
+	free(chunk);
+	return ret;
+}
+
+/*
+ * Start loading a tree written by avl_serialize() into @avlroot, which must
+ * be empty. The input is then handed over in chunks of any size to
+ * avl_deserialize_feed(), and the load finished by avl_deserialize_end().
+ * Records are made into nodes by @decode, called with @arg. If @cmpfunc is
+ * not NULL, the nodes are checked to be in strictly ascending order, for
+ * input that cannot be trusted.
+ *
+ * Return the state of the load, or NULL if memory ran out.
+ */
+avl_deserializer_t *
+avl_deserialize_begin(avl_root_t *avlroot, size_t recsize,
+    avl_decode_t *decode, avl_cmp_t *cmpfunc, void *arg)
+{
+	avl_deserializer_t *d;
+
+	if (!recsize || recsize > UINT32_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+	d = malloc(sizeof(*d) + recsize);
+	if (!d)
+		return NULL;
+	d->avl_root = avlroot;
+	d->avl_decode = decode;
+	d->avl_cmp = cmpfunc;
+	d->avl_arg = arg;
+	d->avl_last = d->avl_reject = NULL;
+	d->avl_recsize = recsize;
+	d->avl_count = d->avl_done = d->avl_have = 0;
+	d->avl_started = d->avl_failed = 0;
+	return d;
+}
+
+static int
+avl_deserialize_header(avl_deserializer_t *d)
+{
+	const unsigned char *header = d->avl_header;
+	uint64_t count = avl_get_le(header + 12, 8);
+
+	if (memcmp(header, AVL_SERIALIZE_MAGIC, 4) ||
+	    header[4] != AVL_SERIALIZE_VERSION ||
+	    avl_get_le(header + 8, 4) != d->avl_recsize || count > SIZE_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	d->avl_count = count;
+	d->avl_have = 0;
+	d->avl_started = 1;
+	avl_build_begin(&d->avl_builder, d->avl_root, count);
+	return 0;
+}
+
+static int
+avl_deserialize_place(avl_deserializer_t *d, const void *rec)
+{
+	avl_node_t *node;
+
+	node = d->avl_decode(rec, d->avl_arg);
+	if (!node)
+		return -1;
+	if (d->avl_cmp && d->avl_last && d->avl_cmp(d->avl_last, node) >= 0) {
+		d->avl_reject = node;
+		errno = EINVAL;
+		return -1;
+	}
+	avl_build_push(&d->avl_builder, node);
+	d->avl_last = node;
+	d->avl_done++;
+	return 0;
+}
+
+/*
+ * Hand the next @len bytes of the input over. Records are decoded straight
+ * from @buf, except the ones split between two chunks.
+ *
+ * Return 1 once the tree is complete, 0 if more input is needed, or -1 if the
+ * input is malformed, a record could not be decoded, or the input goes past
+ * the end of the tree, which is left complete in the latter case.
+ */
+int
+avl_deserialize_feed(avl_deserializer_t *d, const void *buf, size_t len)
+{
+	size_t take, recsize = d->avl_recsize;
+	const unsigned char *p = buf, *rec;
+
+	if (d->avl_failed) {
+		errno = EINVAL;
+		return -1;
+	}
+	while (len) {
+		if (!d->avl_started) {
+			take = AVL_SERIALIZE_HEADER - d->avl_have;
+			if (take > len)
+				take = len;
+			memcpy(d->avl_header + d->avl_have, p, take);
+			d->avl_have += take;
+			p += take;
+			len -= take;
+			if (d->avl_have < AVL_SERIALIZE_HEADER)
+				break;
+			if (avl_deserialize_header(d))
+				goto fail;
+			continue;
+		}
+
+		if (d->avl_done == d->avl_count) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (!d->avl_have && len >= recsize) {
+			rec = p;
+			p += recsize;
+			len -= recsize;
+		} else {
+			take = recsize - d->avl_have;
+			if (take > len)
+				take = len;
+			memcpy(d->avl_rec + d->avl_have, p, take);
+			d->avl_have += take;
+			p += take;
+			len -= take;
+			if (d->avl_have < recsize)
+				break;
+			rec = d->avl_rec;
+			d->avl_have = 0;
+		}
+		if (avl_deserialize_place(d, rec))
+			goto fail;
+	}
+	return d->avl_started && d->avl_done == d->avl_count;
+
+fail:
+	d->avl_failed = 1;
+	return -1;
+}
+
+/*
+ * Return the number of bytes of input still expected. Before the header is
+ * in, that is only what remains of the header.
+ */
+size_t
+avl_deserialize_need(const avl_deserializer_t *d)
+{
+	size_t left;
+
+	if (d->avl_failed)
+		return 0;
+	if (!d->avl_started)
+		return AVL_SERIALIZE_HEADER - d->avl_have;
+	left = d->avl_count - d->avl_done;
+	if (left > SIZE_MAX / d->avl_recsize)
+		return SIZE_MAX;
+	return left * d->avl_recsize - d->avl_have;
+}
+
+/*
+ * Hand the nodes of a subtree under construction to @fn
+ */
+static void
+avl_deserialize_discard(avl_node_t *node, avl_destroy_t *fn, void *arg)
+{
+	avl_root_t tmp;
+
+	if (!node)
+		return;
+	avl_set_parent(node, NULL);
+	avl_root_init(&tmp);
+	tmp.avl_root = node;
+	avl_destroy(&tmp, fn, arg);
+}
+
+/*
+ * Finish a load and free its state. If the tree is not complete, the nodes
+ * decoded so far are handed to @fn with @arg, as avl_destroy() does, and the
+ * tree is left empty.
+ *
+ * Return 0 if the tree is complete, -1 otherwise.
+ */
+int
+avl_deserialize_end(avl_deserializer_t *d, avl_destroy_t *fn, void *arg)
+{
+	int i, err = errno;
+	avl_builder_t *b = &d->avl_builder;
+
+	if (d->avl_started && !d->avl_failed &&
+	    d->avl_done == d->avl_count) {
+		free(d);
+		return 0;
+	}
+
+	if (d->avl_started) {
+		/*
+		 * Every node is either the root of a frame, whose right
+		 * subtree is not linked yet, in the left subtree of one, or
+		 * in the subtree most recently completed
+		 */
+		for (i = 0; i < b->depth; ++i) {
+			avl_node_t *node = b->stack[i].node;
+
+			if (node) {
+				node->avl_children[1] = NULL;
+				avl_deserialize_discard(node, fn, arg);
+			}
+		}
+		avl_deserialize_discard(b->subtree, fn, arg);
+		d->avl_root->avl_root = NULL;
+	}
+	if (d->avl_reject && fn)
+		fn(d->avl_reject, arg);
+	free(d);
+	errno = err;
+	return -1;
+}
+
+/*
+ * Load a tree written by avl_serialize() into the empty @avlroot, pulling the
+ * input from @read in chunks. See avl_deserialize_begin() for @decode and
+ * @cmpfunc, and avl_deserialize_end() for @fn, all called with @arg.
+ *
+ * Return 0, or -1 if the tree could not be loaded, in which case it is left
+ * empty.
+ */
+int
+avl_deserialize(avl_root_t *avlroot, size_t recsize, avl_decode_t *decode,
+    avl_cmp_t *cmpfunc, avl_read_t *read, avl_destroy_t *fn, void *arg)
+{
+	size_t len;
+	unsigned char chunk[AVL_SERIALIZE_CHUNK];
+	avl_deserializer_t *d;
+
+	d = avl_deserialize_begin(avlroot, recsize, decode, cmpfunc, arg);
+	if (!d)
+		return -1;
+	while ((len = avl_deserialize_need(d))) {
+		if (len > sizeof(chunk))
+			len = sizeof(chunk);
+		if (read(chunk, len, arg) ||
+		    avl_deserialize_feed(d, chunk, len) < 0)
+			break;
+	}
+	return avl_deserialize_end(d, fn, arg);
+}
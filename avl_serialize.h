@@ -0,0 +1,103 @@
+/*
+ * Copyright 2017 Ka Ho Ng <ngkaho1234@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#ifndef __AVL_SERIALIZE_H__
+#define __AVL_SERIALIZE_H__
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Serialized form of an AVL tree
+ *
+ * A tree is written as a short header holding the number of nodes, followed
+ * by one fixed-size record per node in key order. As the count is known
+ * upfront, the receiver links the nodes with avl_build_begin() and
+ * avl_build_push() as they arrive, in O(n) and without comparing keys: the
+ * shape of the tree does not need to be sent.
+ *
+ * The header is little-endian. The records are encoded and decoded by the
+ * caller, who chooses their byte order.
+ */
+#define AVL_SERIALIZE_HEADER 20
+
+/*
+ * Encode the key and data of @node into the record @rec
+ */
+typedef void avl_encode_t(avl_node_t *node, void *rec, void *arg);
+
+/*
+ * Return a new node made from the record @rec, or NULL on failure
+ */
+typedef avl_node_t *avl_decode_t(const void *rec, void *arg);
+
+/*
+ * Write @len bytes, return 0 or -1 on failure
+ */
+typedef int avl_write_t(const void *buf, size_t len, void *arg);
+
+/*
+ * Read exactly @len bytes, return 0 or -1 on failure
+ */
+typedef int avl_read_t(void *buf, size_t len, void *arg);
+
+/*
+ * State of an incremental load
+ */
+typedef struct avl_deserializer_s avl_deserializer_t;
+
+int
+avl_serialize(avl_root_t *avlroot, size_t recsize, avl_encode_t *encode,
+    avl_write_t *write, void *arg);
+
+int
+avl_deserialize(avl_root_t *avlroot, size_t recsize, avl_decode_t *decode,
+    avl_cmp_t *cmpfunc, avl_read_t *read, avl_destroy_t *fn, void *arg);
+
+avl_deserializer_t *
+avl_deserialize_begin(avl_root_t *avlroot, size_t recsize,
+    avl_decode_t *decode, avl_cmp_t *cmpfunc, void *arg);
+
+int
+avl_deserialize_feed(avl_deserializer_t *d, const void *buf, size_t len);
+
+size_t
+avl_deserialize_need(const avl_deserializer_t *d);
+
+int
+avl_deserialize_end(avl_deserializer_t *d, avl_destroy_t *fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AVL_SERIALIZE_H__ */
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include "avl_shard.h"
+
+/*
+ * Set up @nshards empty shards. Keys are routed by @route, and ordered within
+ * a shard by @cmpfunc and @keycmp, which must agree.
+ *
+ * Return 0, or -1 if the shards could not be allocated.
+ */
+int
+avl_shard_init(avl_shard_root_t *avlroot, size_t nshards,
+    avl_shard_route_t *route, avl_cmp_t *cmpfunc, avl_keycmp_t *keycmp,
+    void *arg)
+{
+	size_t i;
+
+	if (!nshards)
+		return -1;
+	avlroot->avl_shards = aligned_alloc(AVL_SHARD_ALIGN,
+	    nshards * sizeof(avl_shard_t));
+	if (!avlroot->avl_shards)
+		return -1;
+	for (i = 0; i < nshards; ++i) {
+		pthread_mutex_init(&avlroot->avl_shards[i].avl_lock, NULL);
+		avl_root_init(&avlroot->avl_shards[i].avl_tree);
+	}
+	avlroot->avl_nshards = nshards;
+	avlroot->avl_route = route;
+	avlroot->avl_cmp = cmpfunc;
+	avlroot->avl_keycmp = keycmp;
+	avlroot->avl_arg = arg;
+	return 0;
+}
+
+/*
+ * Release the shards, calling fn with arg on every node as avl_destroy() does.
+ * No other thread may use the shards anymore.
+ */
+void
+avl_shard_free(avl_shard_root_t *avlroot, avl_destroy_t *fn, void *arg)
+{
+	size_t i;
+
+	for (i = 0; i < avlroot->avl_nshards; ++i) {
+		avl_destroy(&avlroot->avl_shards[i].avl_tree, fn, arg);
+		pthread_mutex_destroy(&avlroot->avl_shards[i].avl_lock);
+	}
+	free(avlroot->avl_shards);
+	avlroot->avl_shards = NULL;
+	avlroot->avl_nshards = 0;
+}
+
+/*
+ * Lock the shard a key is routed to and return it, so that several operations
+ * can be done on its avl_tree with the avl_*() routines at once
+ */
+avl_shard_t *
+avl_shard_lock(avl_shard_root_t *avlroot, const void *key)
+{
+	avl_shard_t *shard = avl_shard_of(avlroot, key);
+
+	pthread_mutex_lock(&shard->avl_lock);
+	return shard;
+}
+
+void
+avl_shard_unlock(avl_shard_t *shard)
+{
+	pthread_mutex_unlock(&shard->avl_lock);
+}
+
+/*
+ * Search, insertion and removal by key, each under the lock of the shard of
+ * the key. As the lock is dropped on return, the caller is in charge of
+ * keeping the node returned alive.
+ */
+avl_node_t *
+avl_shard_search(avl_shard_root_t *avlroot, const void *key)
+{
+	avl_node_t *node;
+	avl_shard_t *shard = avl_shard_lock(avlroot, key);
+
+	node = avl_search_key(&shard->avl_tree, key, avlroot->avl_keycmp);
+	avl_shard_unlock(shard);
+	return node;
+}
+
+/*
+ * Insert @node with the key @key
+ *
+ * Return the node with the same key, like avl_insert_key().
+ */
+avl_node_t *
+avl_shard_insert(avl_shard_root_t *avlroot, const void *key,
+    avl_node_t *node)
+{
+	avl_shard_t *shard = avl_shard_lock(avlroot, key);
+
+	node = avl_insert_key(&shard->avl_tree, key, node,
+	    avlroot->avl_keycmp);
+	avl_shard_unlock(shard);
+	return node;
+}
+
+/*
+ * Remove the node with the key @key
+ *
+ * Return the node removed, or NULL if there is none.
+ */
+avl_node_t *
+avl_shard_remove(avl_shard_root_t *avlroot, const void *key)
+{
+	avl_node_t *node;
+	avl_shard_t *shard = avl_shard_lock(avlroot, key);
+
+	node = avl_search_key(&shard->avl_tree, key, avlroot->avl_keycmp);
+	if (node)
+		avl_remove(&shard->avl_tree, node);
+	avl_shard_unlock(shard);
+	return node;
+}
+
+/*
+ * Move the node at @i of the heap down to its place
+ */
+static void
+avl_shard_sift_down(avl_shard_iter_t *iter, size_t i)
+{
+	avl_node_t **heap = iter->avl_heap;
+	avl_cmp_t *cmpfunc = iter->avl_root->avl_cmp;
+
+	for (;;) {
+		size_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+		avl_node_t *tmp;
+
+		if (l < iter->avl_count && cmpfunc(heap[l], heap[min]) < 0)
+			min = l;
+		if (r < iter->avl_count && cmpfunc(heap[r], heap[min]) < 0)
+			min = r;
+		if (min == i)
+			break;
+		tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+/*
+ * Start iterating over all the nodes in key order. Every shard stays locked,
+ * in order, until avl_shard_iter_end(), so the view is consistent and
+ * avl_shard_lock() must not be called by the iterating thread meanwhile.
+ *
+ * Return 0, or -1 if the iterator could not be allocated.
+ */
+int
+avl_shard_iter_begin(avl_shard_root_t *avlroot, avl_shard_iter_t *iter)
+{
+	size_t i;
+
+	iter->avl_heap = malloc(avlroot->avl_nshards * sizeof(avl_node_t *));
+	if (!iter->avl_heap)
+		return -1;
+	iter->avl_root = avlroot;
+	iter->avl_count = 0;
+	for (i = 0; i < avlroot->avl_nshards; ++i) {
+		avl_node_t *first;
+
+		pthread_mutex_lock(&avlroot->avl_shards[i].avl_lock);
+		first = avl_first(&avlroot->avl_shards[i].avl_tree);
+		if (first)
+			iter->avl_heap[iter->avl_count++] = first;
+	}
+	for (i = iter->avl_count / 2; i-- > 0; )
+		avl_shard_sift_down(iter, i);
+	return 0;
+}
+
+/*
+ * Return the next node in key order, or NULL once all have been returned
+ */
+avl_node_t *
+avl_shard_iter_next(avl_shard_iter_t *iter)
+{
+	avl_node_t *node, *next;
+
+	if (!iter->avl_count)
+		return NULL;
+	node = iter->avl_heap[0];
+	next = avl_next(node);
+	if (next)
+		iter->avl_heap[0] = next;
+	else
+		iter->avl_heap[0] = iter->avl_heap[--iter->avl_count];
+	avl_shard_sift_down(iter, 0);
+	return node;
+}
+
+void
+avl_shard_iter_end(avl_shard_iter_t *iter)
+{
+	size_t i;
+
+	for (i = iter->avl_root->avl_nshards; i-- > 0; )
+		pthread_mutex_unlock(&iter->avl_root->avl_shards[i].avl_lock);
+	free(iter->avl_heap);
+	iter->avl_heap = NULL;
+}
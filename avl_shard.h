@@ -0,0 +1,133 @@
+/*
+ * Copyright 2017 Ka Ho Ng <ngkaho1234@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#ifndef __AVL_SHARD_H__
+#define __AVL_SHARD_H__
+
+#include <pthread.h>
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sharded AVL tree
+ *
+ * The nodes are spread over a number of avl_root_t, each one with its own
+ * lock, so that threads working on different shards do not contend. A node
+ * goes to the shard its key is routed to, either by hash, for workloads that
+ * do not need a global order, or by range. The shards are padded to a cache
+ * line so that their locks do not share one.
+ *
+ * An iterator merges the shards into a single ordered view when one is
+ * needed.
+ */
+#define AVL_SHARD_ALIGN 64
+
+typedef struct avl_shard_s {
+	pthread_mutex_t avl_lock;		/* Lock of the shard */
+	avl_root_t avl_tree;			/* The tree of the shard */
+} __attribute__((aligned(AVL_SHARD_ALIGN))) avl_shard_t;
+
+/*
+ * Routing routine provided by user. The result is taken modulo the number of
+ * shards, so a hash of the key can be returned as it is.
+ */
+typedef size_t avl_shard_route_t(const void *key, void *arg);
+
+/*
+ * A root structure that holds all the shards
+ */
+typedef struct avl_shard_root_s {
+	avl_shard_t *avl_shards;		/* Array of the shards */
+	size_t avl_nshards;			/* Number of shards */
+	avl_shard_route_t *avl_route;		/* Routing routine */
+	avl_cmp_t *avl_cmp;			/* Comparison between nodes */
+	avl_keycmp_t *avl_keycmp;		/* Comparison to a bare key */
+	void *avl_arg;				/* Argument of avl_route */
+} avl_shard_root_t;
+
+/*
+ * Iterator over all the shards in key order
+ */
+typedef struct avl_shard_iter_s {
+	avl_shard_root_t *avl_root;		/* Shards iterated over */
+	avl_node_t **avl_heap;			/* Next node of every shard, smallest first */
+	size_t avl_count;			/* Number of shards not yet exhausted */
+} avl_shard_iter_t;
+
+int
+avl_shard_init(avl_shard_root_t *avlroot, size_t nshards,
+    avl_shard_route_t *route, avl_cmp_t *cmpfunc, avl_keycmp_t *keycmp,
+    void *arg);
+
+void
+avl_shard_free(avl_shard_root_t *avlroot, avl_destroy_t *fn, void *arg);
+
+avl_shard_t *
+avl_shard_lock(avl_shard_root_t *avlroot, const void *key);
+
+void
+avl_shard_unlock(avl_shard_t *shard);
+
+avl_node_t *
+avl_shard_search(avl_shard_root_t *avlroot, const void *key);
+
+avl_node_t *
+avl_shard_insert(avl_shard_root_t *avlroot, const void *key,
+    avl_node_t *node);
+
+avl_node_t *
+avl_shard_remove(avl_shard_root_t *avlroot, const void *key);
+
+int
+avl_shard_iter_begin(avl_shard_root_t *avlroot, avl_shard_iter_t *iter);
+
+avl_node_t *
+avl_shard_iter_next(avl_shard_iter_t *iter);
+
+void
+avl_shard_iter_end(avl_shard_iter_t *iter);
+
+/*
+ * Return the shard a key is routed to
+ */
+static inline avl_shard_t *
+avl_shard_of(avl_shard_root_t *avlroot, const void *key)
+{
+	return &avlroot->avl_shards[avlroot->avl_route(key, avlroot->avl_arg) %
+	    avlroot->avl_nshards];
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AVL_SHARD_H__ */
@@ -0,0 +1,383 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Scaling of the concurrent tree, of the sharded tree and of avl.c in RCU
+ * mode against avl.c behind a pthread rwlock.
+ *
+ * Every thread works on its own slice of the keys, so nothing but the tree
+ * itself keeps the threads apart. In the mixed workload, each thread does the
+ * given number of operations, of which the given percentage are lookups. In
+ * the one_writer workload, a single thread does that many insertions and
+ * removals while the others only look up until it is done, the case RCU mode
+ * is meant for. In RCU mode the writers are serialized by a mutex.
+ *
+ * avl.c and everything linked with it are built with AVL_RCU so that all the
+ * structures share one binary; on x86 this changes no instruction of the
+ * other modes' descents. The results are written out as a JSON array on
+ * stdout, like bench-tree. Usage:
+ * bench-conc [max threads [ops [read percent]]]
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <time.h>
+#include "avl.h"
+#include "avl_conc.h"
+#include "avl_rcu.h"
+#include "avl_shard.h"
+
+#define node_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define KEYS_PER_THREAD 16384
+#define SHARDS 64
+
+enum bench_mode {
+	BENCH_RWLOCK,
+	BENCH_CONC,
+	BENCH_SHARD,
+	BENCH_RCU,
+};
+
+struct bench_node {
+	int key;
+	avl_node_t node;
+	avl_conc_node_t cnode;
+};
+
+struct bench_thread {
+	pthread_t thread;
+	int id;
+	int ops;				/* Or until the writer is done if 0 */
+	int read_percent;			/* Lookups out of 100 operations */
+	int writer;				/* The others stop once it is done */
+	long done;				/* Operations done */
+	enum bench_mode mode;
+	struct bench_node *pool;
+	struct bench_node **live;
+};
+
+static avl_root_t rw_root;
+static pthread_rwlock_t rw_lock;
+static avl_conc_root_t conc_root;
+static avl_shard_root_t shard_root;
+static avl_rcu_root_t rcu_root;
+static pthread_mutex_t rcu_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t start;
+static int writer_done;
+
+/* Out of every 100 operations, this many are lookups */
+static int read_percent = 80;
+
+static int
+int_cmp(int a, int b)
+{
+	if (a < b)
+		return -1;
+	else if (a > b)
+		return 1;
+	return 0;
+}
+
+static int
+rw_keycmp(const void *key, avl_node_t *b)
+{
+	return int_cmp(*(const int *)key, node_of(b, struct bench_node,
+	    node)->key);
+}
+
+static int
+rw_cmp(avl_node_t *a, avl_node_t *b)
+{
+	return rw_keycmp(&node_of(a, struct bench_node, node)->key, b);
+}
+
+static int
+conc_keycmp(const void *key, avl_conc_node_t *b)
+{
+	return int_cmp(*(const int *)key, node_of(b, struct bench_node,
+	    cnode)->key);
+}
+
+static int
+conc_cmp(avl_conc_node_t *a, avl_conc_node_t *b)
+{
+	return conc_keycmp(&node_of(a, struct bench_node, cnode)->key, b);
+}
+
+static size_t
+shard_route(const void *key, void *arg)
+{
+	(void)arg;
+	return (unsigned)*(const int *)key * 2654435761u >> 16;
+}
+
+static void
+bench_search(enum bench_mode mode, int key)
+{
+	switch (mode) {
+	case BENCH_RWLOCK:
+		pthread_rwlock_rdlock(&rw_lock);
+		avl_search_key(&rw_root, &key, rw_keycmp);
+		pthread_rwlock_unlock(&rw_lock);
+		break;
+	case BENCH_CONC:
+		avl_conc_search_key(&conc_root, &key, conc_keycmp);
+		break;
+	case BENCH_SHARD:
+		avl_shard_search(&shard_root, &key);
+		break;
+	case BENCH_RCU:
+		avl_rcu_search_key(&rcu_root, &key, rw_keycmp);
+		break;
+	}
+}
+
+static void
+bench_insert(enum bench_mode mode, struct bench_node *n)
+{
+	switch (mode) {
+	case BENCH_RWLOCK:
+		pthread_rwlock_wrlock(&rw_lock);
+		avl_insert(&rw_root, &n->node, rw_cmp);
+		pthread_rwlock_unlock(&rw_lock);
+		break;
+	case BENCH_CONC:
+		avl_conc_insert(&conc_root, &n->cnode, conc_cmp);
+		break;
+	case BENCH_SHARD:
+		avl_shard_insert(&shard_root, &n->key, &n->node);
+		break;
+	case BENCH_RCU:
+		pthread_mutex_lock(&rcu_lock);
+		avl_rcu_insert(&rcu_root, &n->node, rw_cmp);
+		pthread_mutex_unlock(&rcu_lock);
+		break;
+	}
+}
+
+static void
+bench_remove(enum bench_mode mode, struct bench_node *n)
+{
+	switch (mode) {
+	case BENCH_RWLOCK:
+		pthread_rwlock_wrlock(&rw_lock);
+		avl_remove(&rw_root, &n->node);
+		pthread_rwlock_unlock(&rw_lock);
+		break;
+	case BENCH_CONC:
+		avl_conc_remove(&conc_root, &n->cnode);
+		break;
+	case BENCH_SHARD:
+		avl_shard_remove(&shard_root, &n->key);
+		break;
+	case BENCH_RCU:
+		pthread_mutex_lock(&rcu_lock);
+		avl_rcu_remove(&rcu_root, &n->node, NULL, NULL);
+		pthread_mutex_unlock(&rcu_lock);
+		break;
+	}
+}
+
+static void *
+bench_worker(void *arg)
+{
+	struct bench_thread *t = arg;
+	unsigned seed = t->id + 1;
+	int i, used = 0;
+
+	pthread_barrier_wait(&start);
+	for (i = 0; t->ops ? i < t->ops :
+	    !__atomic_load_n(&writer_done, __ATOMIC_RELAXED); ++i) {
+		int slot = rand_r(&seed) % KEYS_PER_THREAD;
+		int key = slot * 1024 + t->id;
+		struct bench_node *n = t->live[slot];
+
+		if (rand_r(&seed) % 100 < t->read_percent) {
+			bench_search(t->mode, key);
+			continue;
+		}
+
+		/* Removed nodes are not reused, as the concurrent tree may
+		 * still have them as routing nodes */
+		if (n) {
+			bench_remove(t->mode, n);
+			t->live[slot] = NULL;
+		} else {
+			n = &t->pool[used++];
+			n->key = key;
+			bench_insert(t->mode, n);
+			t->live[slot] = n;
+		}
+	}
+	t->done = i;
+	if (t->writer)
+		__atomic_store_n(&writer_done, 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/*
+ * Run @nthreads threads doing @ops operations each, starting from half of the
+ * keys present, or with @one_writer, @nthreads readers and a writer doing @ops
+ * insertions and removals. Return the run time in seconds, and the throughput
+ * of the lookups and of the changes in operations per second in @reads and
+ * @writes.
+ */
+static double
+bench_run(int nthreads, int ops, enum bench_mode mode, int one_writer,
+    double *reads, double *writes)
+{
+	int i, j, room;
+	long nreads = 0, nwrites = 0;
+	double elapsed;
+	struct timespec t0, t1;
+	struct bench_thread *threads;
+
+	if (one_writer)
+		++nthreads;
+	threads = calloc(nthreads, sizeof(*threads));
+	avl_root_init(&rw_root);
+	avl_root_init(&rcu_root.avl_tree);
+	writer_done = 0;
+	avl_conc_init(&conc_root, NULL, NULL);
+	if (mode == BENCH_SHARD && avl_shard_init(&shard_root, SHARDS,
+	    shard_route, rw_cmp, rw_keycmp, NULL)) {
+		fprintf(stderr, "failed to allocate the shards\n");
+		exit(1);
+	}
+	pthread_barrier_init(&start, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; ++i) {
+		struct bench_thread *t = &threads[i];
+
+		t->id = i;
+		t->writer = one_writer && !i;
+		t->ops = one_writer && i ? 0 : ops;
+		t->read_percent = t->writer ? 0 : one_writer ? 100 :
+		    read_percent;
+		t->mode = mode;
+
+		/* Room for the keys present at first, and for as many
+		 * insertions as operations */
+		room = t->read_percent < 100 ? ops : 0;
+		t->pool = malloc(sizeof(struct bench_node) *
+		    (room + KEYS_PER_THREAD / 2));
+		t->live = calloc(KEYS_PER_THREAD, sizeof(*t->live));
+		for (j = 0; j < KEYS_PER_THREAD / 2; ++j) {
+			struct bench_node *n = &t->pool[room + j];
+
+			n->key = j * 2 * 1024 + i;
+			bench_insert(mode, n);
+			t->live[j * 2] = n;
+		}
+		pthread_create(&t->thread, NULL, bench_worker, t);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	pthread_barrier_wait(&start);
+	for (i = 0; i < nthreads; ++i)
+		pthread_join(threads[i].thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	pthread_barrier_destroy(&start);
+	if (mode == BENCH_SHARD)
+		avl_shard_free(&shard_root, NULL, NULL);
+
+	for (i = 0; i < nthreads; ++i) {
+		if (threads[i].writer)
+			nwrites += threads[i].done;
+		else
+			nreads += threads[i].done;
+		free(threads[i].pool);
+		free(threads[i].live);
+	}
+	free(threads);
+
+	elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	*reads = nreads / elapsed;
+	*writes = nwrites / elapsed;
+	return elapsed;
+}
+
+int
+main(int argc, char **argv)
+{
+	int mode, nthreads, rows = 0, max_threads = 8, ops = 1000000;
+	double elapsed, reads, writes;
+	pthread_rwlockattr_t rw_attr;
+	static const char *const names[] = { "rwlock", "conc", "shard", "rcu" };
+
+	if (argc > 1)
+		max_threads = atoi(argv[1]);
+	if (argc > 2)
+		ops = atoi(argv[2]);
+	if (argc > 3)
+		read_percent = atoi(argv[3]);
+	/* The thread numbers, the writer included, must stay below 1024 */
+	if (max_threads < 1 || max_threads > 1023 || ops < 1 ||
+	    read_percent < 0 || read_percent > 100) {
+		fprintf(stderr, "usage: %s [max threads [ops [read percent]]]\n",
+		    argv[0]);
+		return 1;
+	}
+
+	/* The default rwlock prefers the readers, which would starve the
+	 * writer of the one_writer workload */
+	pthread_rwlockattr_init(&rw_attr);
+	pthread_rwlockattr_setkind_np(&rw_attr,
+	    PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&rw_lock, &rw_attr);
+
+	printf("[\n");
+	for (nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+		for (mode = BENCH_RWLOCK; mode <= BENCH_RCU; mode++) {
+			elapsed = bench_run(nthreads, ops,
+			    (enum bench_mode)mode, 0, &reads, &writes);
+			printf("%s  {\"structure\": \"%s\", "
+			    "\"workload\": \"mixed\", \"threads\": %d, "
+			    "\"ops\": %d, \"read_percent\": %d, "
+			    "\"ops_per_sec\": %.0f}", rows++ ? ",\n" : "",
+			    names[mode], nthreads, ops, read_percent,
+			    (double)nthreads * ops / elapsed);
+		}
+		for (mode = BENCH_RWLOCK; mode <= BENCH_RCU; mode++) {
+			bench_run(nthreads, ops, (enum bench_mode)mode, 1,
+			    &reads, &writes);
+			printf("%s  {\"structure\": \"%s\", "
+			    "\"workload\": \"one_writer\", \"readers\": %d, "
+			    "\"writes\": %d, \"reads_per_sec\": %.0f, "
+			    "\"writes_per_sec\": %.0f}", rows++ ? ",\n" : "",
+			    names[mode], nthreads, ops, reads, writes);
+		}
+	}
+	printf("\n]\n");
+	return 0;
+}
@@ -0,0 +1,837 @@
+/*
+ * Copyright 2017 Ka Ho Ng <ngkaho1234@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Single-threaded operations on avl.c against other ordered containers,
+ * written out as a JSON array on stdout.
+ *
+ * For every size from 1000 up to the maximum by factors of 10, and for keys
+ * inserted in sequential and in random order, each structure inserts n keys,
+ * looks n keys up in sequential, uniform and Zipfian order, iterates over the
+ * whole tree, and removes every key in random order. The avl-inorder and
+ * avl-veb variants move the nodes of avl.c into a fresh arena with
+ * avl_relayout() before the lookups, avl-idx is avl_idx.c with 32-bit
+ * indices instead of pointers, and avl-np is avl_np.c without parent links.
+ * Cache and branch misses are read from perf_event if the kernel lets us, and
+ * are null otherwise.
+ *
+ * Built with AVL_COMPACT or AVL_ORDER_STATISTICS, as bench-tree-compact and
+ * bench-tree-ostat are, only the structures using avl_node_t are run, with
+ * the name of the layout appended to theirs.
+ *
+ * Usage: bench-tree [max size]
+ */
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
+#include "avl.hpp"
+#include "avl_idx.h"
+#include "avl_np.h"
+
+#if defined(__has_include)
+#if __has_include(<boost/intrusive/set.hpp>) && \
+    __has_include(<boost/intrusive/avl_set.hpp>)
+#define BENCH_BOOST
+#include <boost/intrusive/avl_set.hpp>
+#include <boost/intrusive/set.hpp>
+#endif
+#endif
+
+#define node_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+/* Node layout avl.c is built with, appended to the structure names */
+#if defined(AVL_COMPACT)
+#define BENCH_LAYOUT "-compact"
+#elif defined(AVL_ORDER_STATISTICS)
+#define BENCH_LAYOUT "-ostat"
+#else
+#define BENCH_LAYOUT ""
+#define BENCH_OTHERS
+#endif
+
+/* Skew of the Zipfian lookups */
+#define ZIPF_THETA 0.99
+
+/*
+ * Hardware counters of the measured phase
+ */
+static int perf_fd = -1;
+
+struct perf_read {
+	uint64_t nr;
+	uint64_t values[2];
+};
+
+static int
+perf_open(uint64_t config, int group)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = group < 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void
+perf_init(void)
+{
+	perf_fd = perf_open(PERF_COUNT_HW_CACHE_MISSES, -1);
+	if (perf_fd >= 0 && perf_open(PERF_COUNT_HW_BRANCH_MISSES,
+	    perf_fd) < 0) {
+		close(perf_fd);
+		perf_fd = -1;
+	}
+}
+
+/*
+ * A measured phase, printed as one element of the array
+ */
+static int rows;
+static volatile long sink;
+
+struct phase {
+	const char *structure;
+	const char *op;
+	const char *order;
+	const char *keys;
+	size_t n;
+	struct timespec t0;
+
+	phase(const char *s, const char *o, const char *ord, size_t count,
+	    const char *k = NULL)
+	    : structure(s), op(o), order(ord), keys(k), n(count)
+	{
+		if (perf_fd >= 0) {
+			ioctl(perf_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+			ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+	}
+
+	~phase()
+	{
+		struct timespec t1;
+		struct perf_read r;
+		double ns;
+
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (perf_fd >= 0) {
+			ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+			if (read(perf_fd, &r, sizeof(r)) != sizeof(r))
+				r.nr = 0;
+		} else {
+			r.nr = 0;
+		}
+		ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+
+		printf("%s  {\"structure\": \"%s\", \"op\": \"%s\", "
+		    "\"n\": %zu, \"order\": \"%s\", ", rows++ ? ",\n" : "",
+		    structure, op, n, order);
+		if (keys)
+			printf("\"keys\": \"%s\", ", keys);
+		printf("\"ns_per_op\": %.2f, ", ns / n);
+		if (r.nr == 2)
+			printf("\"cache_misses_per_op\": %.3f, "
+			    "\"branch_misses_per_op\": %.3f}",
+			    (double)r.values[0] / n, (double)r.values[1] / n);
+		else
+			printf("\"cache_misses_per_op\": null, "
+			    "\"branch_misses_per_op\": null}");
+	}
+};
+
+/*
+ * Key generators
+ */
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t
+rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static void
+shuffle(std::vector<int> &keys)
+{
+	size_t i;
+
+	for (i = keys.size(); i > 1; --i)
+		std::swap(keys[i - 1], keys[rng() % i]);
+}
+
+/*
+ * Zipfian ranks, after Gray et al., "Quickly generating billion-record
+ * synthetic databases". The hot ranks are scattered over the keys.
+ */
+static void
+zipf_keys(std::vector<int> &keys, size_t n)
+{
+	double zetan = 0, zeta2, alpha, eta, u, uz;
+	size_t i, rank;
+
+	for (i = 1; i <= n; ++i)
+		zetan += 1 / pow((double)i, ZIPF_THETA);
+	zeta2 = 1 + 1 / pow(2.0, ZIPF_THETA);
+	alpha = 1 / (1 - ZIPF_THETA);
+	eta = (1 - pow(2.0 / n, 1 - ZIPF_THETA)) / (1 - zeta2 / zetan);
+	for (i = 0; i < n; ++i) {
+		u = (rng() >> 11) * (1.0 / 9007199254740992.0);
+		uz = u * zetan;
+		if (uz < 1)
+			rank = 0;
+		else if (uz < 1 + pow(0.5, ZIPF_THETA))
+			rank = 1;
+		else
+			rank = (size_t)(n * pow(eta * u - eta + 1, alpha));
+		if (rank >= n)
+			rank = n - 1;
+		keys[i] = (int)(rank * 2654435761ULL % n);
+	}
+}
+
+/*
+ * avl.c through the C routines, with the nodes laid out as allocated, or
+ * moved by avl_relayout()
+ */
+struct avl_bench_node {
+	int key;
+	avl_node_t node;
+};
+
+static int
+avl_bench_cmp(avl_node_t *a, avl_node_t *b)
+{
+	int a1 = node_of(a, struct avl_bench_node, node)->key;
+	int b1 = node_of(b, struct avl_bench_node, node)->key;
+
+	return a1 < b1 ? -1 : a1 > b1;
+}
+
+static int
+avl_bench_keycmp(const void *key, avl_node_t *b)
+{
+	int a1 = *(const int *)key;
+	int b1 = node_of(b, struct avl_bench_node, node)->key;
+
+	return a1 < b1 ? -1 : a1 > b1;
+}
+
+struct avl_bench {
+	avl_root_t root;
+	std::vector<avl_bench_node> nodes, arena;
+	std::vector<avl_bench_node *> by_key;
+	size_t used;
+
+	static avl_node_t *
+	relocate(avl_node_t *node, void *arg)
+	{
+		avl_bench *b = static_cast<avl_bench *>(arg);
+		avl_bench_node *moved = &b->arena[b->used++];
+
+		*moved = *node_of(node, struct avl_bench_node, node);
+		b->by_key[moved->key] = moved;
+		return &moved->node;
+	}
+
+	void
+	build(const std::vector<int> &order)
+	{
+		size_t i;
+
+		avl_root_init(&root);
+		nodes.resize(order.size());
+		by_key.resize(order.size());
+		for (i = 0; i < order.size(); ++i) {
+			nodes[i].key = order[i];
+			by_key[order[i]] = &nodes[i];
+		}
+	}
+
+	void
+	insert(size_t i)
+	{
+		avl_insert(&root, &nodes[i].node, avl_bench_cmp);
+	}
+
+	void
+	relayout(enum avl_layout layout)
+	{
+		arena.resize(nodes.size());
+		used = 0;
+		avl_relayout(&root, layout, relocate, this);
+		std::vector<avl_bench_node>().swap(nodes);
+	}
+
+	bool
+	search(int key)
+	{
+		return avl_search_key(&root, &key, avl_bench_keycmp) != NULL;
+	}
+
+	long
+	iterate()
+	{
+		long sum = 0;
+		avl_node_t *node;
+
+		for (node = avl_first(&root); node; node = avl_next(node))
+			sum += node_of(node, struct avl_bench_node, node)->key;
+		return sum;
+	}
+
+	void
+	remove(int key)
+	{
+		avl_remove(&root, &by_key[key]->node);
+	}
+
+	void
+	clear()
+	{
+		std::vector<avl_bench_node>().swap(nodes);
+		std::vector<avl_bench_node>().swap(arena);
+		std::vector<avl_bench_node *>().swap(by_key);
+	}
+};
+
+/*
+ * avl.c through the C++ wrapper, with the comparison inlined
+ */
+struct avl_cxx_less {
+	typedef void is_transparent;
+
+	bool operator()(const avl_bench_node &a, const avl_bench_node &b) const
+	{
+		return a.key < b.key;
+	}
+	bool operator()(int a, const avl_bench_node &b) const { return a < b.key; }
+	bool operator()(const avl_bench_node &a, int b) const { return a.key < b; }
+};
+
+struct avl_cxx_bench {
+	avl::tree<avl_bench_node, &avl_bench_node::node, avl_cxx_less> tree;
+	std::vector<avl_bench_node> nodes;
+	std::vector<avl_bench_node *> by_key;
+
+	void
+	build(const std::vector<int> &order)
+	{
+		size_t i;
+
+		nodes.resize(order.size());
+		by_key.resize(order.size());
+		for (i = 0; i < order.size(); ++i) {
+			nodes[i].key = order[i];
+			by_key[order[i]] = &nodes[i];
+		}
+	}
+
+	void insert(size_t i) { tree.insert(nodes[i]); }
+	bool search(int key) { return tree.find(key) != tree.end(); }
+
+	long
+	iterate()
+	{
+		long sum = 0;
+
+		for (auto it = tree.begin(); it != tree.end(); ++it)
+			sum += it->key;
+		return sum;
+	}
+
+	void remove(int key) { tree.erase(*by_key[key]); }
+
+	void
+	clear()
+	{
+		tree.clear();
+		std::vector<avl_bench_node>().swap(nodes);
+		std::vector<avl_bench_node *>().swap(by_key);
+	}
+};
+
+/*
+ * avl_idx.c, the elements in an array linked by their indices
+ */
+struct avl_idx_bench_elem {
+	int key;
+	avl_idx_node_t node;
+};
+
+static int
+avl_idx_bench_cmp(const void *a, const void *b)
+{
+	int a1 = static_cast<const avl_idx_bench_elem *>(a)->key;
+	int b1 = static_cast<const avl_idx_bench_elem *>(b)->key;
+
+	return a1 < b1 ? -1 : a1 > b1;
+}
+
+static int
+avl_idx_bench_keycmp(const void *key, const void *elem)
+{
+	int a1 = *(const int *)key;
+	int b1 = static_cast<const avl_idx_bench_elem *>(elem)->key;
+
+	return a1 < b1 ? -1 : a1 > b1;
+}
+
+struct avl_idx_bench {
+	avl_idx_base_t base;
+	avl_idx_root_t root;
+	std::vector<avl_idx_bench_elem> elems;
+	std::vector<avl_idx_t> by_key;
+
+	void
+	build(const std::vector<int> &order)
+	{
+		size_t i;
+
+		elems.resize(order.size());
+		by_key.resize(order.size());
+		for (i = 0; i < order.size(); ++i) {
+			elems[i].key = order[i];
+			by_key[order[i]] = (avl_idx_t)i;
+		}
+		base.avl_base = &elems[0];
+		base.avl_stride = sizeof(avl_idx_bench_elem);
+		base.avl_offset = offsetof(avl_idx_bench_elem, node);
+		avl_idx_root_init(&root);
+	}
+
+	void
+	insert(size_t i)
+	{
+		avl_idx_insert(&base, &root, (avl_idx_t)i, avl_idx_bench_cmp);
+	}
+
+	bool
+	search(int key)
+	{
+		return avl_idx_search_key(&base, &root, &key,
+		    avl_idx_bench_keycmp) != AVL_IDX_NIL;
+	}
+
+	long
+	iterate()
+	{
+		long sum = 0;
+		avl_idx_t idx;
+
+		for (idx = avl_idx_first(&base, &root); idx != AVL_IDX_NIL;
+		    idx = avl_idx_next(&base, idx))
+			sum += elems[idx].key;
+		return sum;
+	}
+
+	void remove(int key) { avl_idx_remove(&base, &root, by_key[key]); }
+
+	void
+	clear()
+	{
+		std::vector<avl_idx_bench_elem>().swap(elems);
+		std::vector<avl_idx_t>().swap(by_key);
+	}
+};
+
+/*
+ * avl_np.c, without parent links: iteration keeps a path, and removal
+ * descends from the root
+ */
+struct avl_np_bench_node {
+	int key;
+	avl_np_node_t node;
+};
+
+static int
+avl_np_bench_keycmp(const void *key, avl_np_node_t *b)
+{
+	int a1 = *(const int *)key;
+	int b1 = node_of(b, struct avl_np_bench_node, node)->key;
+
+	return a1 < b1 ? -1 : a1 > b1;
+}
+
+static int
+avl_np_bench_cmp(avl_np_node_t *a, avl_np_node_t *b)
+{
+	return avl_np_bench_keycmp(&node_of(a, struct avl_np_bench_node,
+	    node)->key, b);
+}
+
+struct avl_np_bench {
+	avl_np_root_t root;
+	std::vector<avl_np_bench_node> nodes;
+
+	void
+	build(const std::vector<int> &order)
+	{
+		size_t i;
+
+		root.avl_root = NULL;
+		nodes.resize(order.size());
+		for (i = 0; i < order.size(); ++i)
+			nodes[i].key = order[i];
+	}
+
+	void
+	insert(size_t i)
+	{
+		avl_np_insert(&root, &nodes[i].node, avl_np_bench_cmp);
+	}
+
+	bool
+	search(int key)
+	{
+		return avl_np_search_key(&root, &key,
+		    avl_np_bench_keycmp) != NULL;
+	}
+
+	long
+	iterate()
+	{
+		long sum = 0;
+		avl_np_cursor_t cursor;
+		avl_np_node_t *node;
+
+		for (node = avl_np_first(&root, &cursor); node;
+		    node = avl_np_next(&cursor))
+			sum += node_of(node, struct avl_np_bench_node,
+			    node)->key;
+		return sum;
+	}
+
+	void
+	remove(int key)
+	{
+		avl_np_remove_key(&root, &key, avl_np_bench_keycmp);
+	}
+
+	void clear() { std::vector<avl_np_bench_node>().swap(nodes); }
+};
+
+/*
+ * Red-black trees of libstdc++, allocating a node per key
+ */
+struct std_map_bench {
+	std::map<int, int> map;
+	const std::vector<int> *order;
+
+	void build(const std::vector<int> &o) { order = &o; }
+	void insert(size_t i) { map.emplace((*order)[i], (*order)[i]); }
+	bool search(int key) { return map.find(key) != map.end(); }
+
+	long
+	iterate()
+	{
+		long sum = 0;
+
+		for (auto it = map.begin(); it != map.end(); ++it)
+			sum += it->first;
+		return sum;
+	}
+
+	void remove(int key) { map.erase(key); }
+	void clear() { map.clear(); }
+};
+
+struct std_set_bench {
+	std::set<int> set;
+	const std::vector<int> *order;
+
+	void build(const std::vector<int> &o) { order = &o; }
+	void insert(size_t i) { set.insert((*order)[i]); }
+	bool search(int key) { return set.find(key) != set.end(); }
+
+	long
+	iterate()
+	{
+		long sum = 0;
+
+		for (auto it = set.begin(); it != set.end(); ++it)
+			sum += *it;
+		return sum;
+	}
+
+	void remove(int key) { set.erase(key); }
+	void clear() { set.clear(); }
+};
+
+#ifdef BENCH_BOOST
+/*
+ * Intrusive red-black and AVL trees of Boost
+ */
+template <class Hook>
+struct boost_bench_node {
+	int key;
+	Hook hook;
+
+	bool operator<(const boost_bench_node &b) const { return key < b.key; }
+};
+
+template <class Hook>
+struct boost_key_less {
+	bool operator()(int a, const boost_bench_node<Hook> &b) const
+	{
+		return a < b.key;
+	}
+	bool operator()(const boost_bench_node<Hook> &a, int b) const
+	{
+		return a.key < b;
+	}
+};
+
+template <class Hook, class Set>
+struct boost_bench {
+	typedef boost_bench_node<Hook> node;
+
+	Set set;
+	std::vector<node> nodes;
+	std::vector<node *> by_key;
+
+	void
+	build(const std::vector<int> &order)
+	{
+		size_t i;
+
+		nodes.resize(order.size());
+		by_key.resize(order.size());
+		for (i = 0; i < order.size(); ++i) {
+			nodes[i].key = order[i];
+			by_key[order[i]] = &nodes[i];
+		}
+	}
+
+	void insert(size_t i) { set.insert(nodes[i]); }
+
+	bool
+	search(int key)
+	{
+		return set.find(key, boost_key_less<Hook>()) != set.end();
+	}
+
+	long
+	iterate()
+	{
+		long sum = 0;
+
+		for (auto it = set.begin(); it != set.end(); ++it)
+			sum += it->key;
+		return sum;
+	}
+
+	void remove(int key) { set.erase(set.iterator_to(*by_key[key])); }
+
+	void
+	clear()
+	{
+		set.clear();
+		std::vector<node>().swap(nodes);
+		std::vector<node *>().swap(by_key);
+	}
+};
+
+typedef boost::intrusive::set_member_hook<> rb_hook;
+typedef boost::intrusive::avl_set_member_hook<> boost_avl_hook;
+typedef boost_bench<rb_hook, boost::intrusive::set<boost_bench_node<rb_hook>,
+    boost::intrusive::member_hook<boost_bench_node<rb_hook>, rb_hook,
+    &boost_bench_node<rb_hook>::hook> > > boost_rb_bench;
+typedef boost_bench<boost_avl_hook,
+    boost::intrusive::avl_set<boost_bench_node<boost_avl_hook>,
+    boost::intrusive::member_hook<boost_bench_node<boost_avl_hook>,
+    boost_avl_hook, &boost_bench_node<boost_avl_hook>::hook> > >
+    boost_avl_bench;
+#endif
+
+/*
+ * Keys shared by every structure for one size and insertion order
+ */
+struct workload {
+	const char *order_name;
+	std::vector<int> order;			/* Keys in insertion order */
+	std::vector<int> removal;		/* Keys in removal order */
+	std::vector<int> lookups[3];		/* Sequential, uniform, Zipfian */
+};
+
+static const char *lookup_names[3] = { "sequential", "uniform", "zipf" };
+
+static void
+check(bool ok, const char *structure, const char *what)
+{
+	if (!ok) {
+		fprintf(stderr, "%s: %s\n", structure, what);
+		exit(1);
+	}
+}
+
+/*
+ * Only the nodes of avl.c can be moved
+ */
+template <class Bench>
+static void
+relayout(Bench *, int)
+{
+}
+
+static void
+relayout(avl_bench *b, int layout)
+{
+	b->relayout((enum avl_layout)layout);
+}
+
+/*
+ * Run every operation on a structure. If layout is not negative, the nodes
+ * of avl.c are moved with avl_relayout() first.
+ */
+template <class Bench>
+static void
+run(const char *name, const workload &w, int layout = -1)
+{
+	Bench *b = new Bench();
+	size_t i, n = w.order.size(), found;
+	long sum;
+	int j;
+
+	b->build(w.order);
+	{
+		phase p(name, "insert", w.order_name, n);
+
+		for (i = 0; i < n; ++i)
+			b->insert(i);
+	}
+	if (layout >= 0) {
+		phase p(name, "relayout", w.order_name, n);
+
+		relayout(b, layout);
+	}
+	for (j = 0; j < 3; ++j) {
+		phase p(name, "search", w.order_name, n, lookup_names[j]);
+
+		found = 0;
+		for (i = 0; i < n; ++i)
+			found += b->search(w.lookups[j][i]);
+		sink = found;
+		check(found == n, name, "a key went missing");
+	}
+	{
+		phase p(name, "iterate", w.order_name, n);
+
+		sum = b->iterate();
+		sink = sum;
+		check(sum == (long)n * (long)(n - 1) / 2, name,
+		    "iteration went wrong");
+	}
+	{
+		phase p(name, "remove", w.order_name, n);
+
+		for (i = 0; i < n; ++i)
+			b->remove(w.removal[i]);
+	}
+	b->clear();
+	delete b;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t i, n, max_size = 1000000;
+	int j, random_order;
+	workload w;
+
+	if (argc > 1)
+		max_size = strtoul(argv[1], NULL, 10);
+	if (max_size < 1000 || max_size > 1000000000) {
+		fprintf(stderr, "usage: %s [max size]\n", argv[0]);
+		return 1;
+	}
+
+	perf_init();
+	printf("[\n");
+	for (n = 1000; n <= max_size; n *= 10) {
+		for (random_order = 0; random_order < 2; ++random_order) {
+			w.order_name = random_order ? "random" : "sequential";
+			w.order.resize(n);
+			for (i = 0; i < n; ++i)
+				w.order[i] = (int)i;
+			w.removal = w.order;
+			if (random_order)
+				shuffle(w.order);
+			shuffle(w.removal);
+			for (j = 0; j < 3; ++j)
+				w.lookups[j].resize(n);
+			for (i = 0; i < n; ++i) {
+				w.lookups[0][i] = (int)i;
+				w.lookups[1][i] = (int)(rng() % n);
+			}
+			zipf_keys(w.lookups[2], n);
+
+			run<avl_bench>("avl" BENCH_LAYOUT, w);
+			run<avl_bench>("avl-inorder" BENCH_LAYOUT, w,
+			    AVL_LAYOUT_INORDER);
+			run<avl_bench>("avl-veb" BENCH_LAYOUT, w,
+			    AVL_LAYOUT_VEB);
+			run<avl_cxx_bench>("avl::tree" BENCH_LAYOUT, w);
+#ifdef BENCH_OTHERS
+			run<avl_idx_bench>("avl-idx", w);
+			run<avl_np_bench>("avl-np", w);
+			run<std_map_bench>("std::map", w);
+			run<std_set_bench>("std::set", w);
+#ifdef BENCH_BOOST
+			run<boost_rb_bench>("boost::intrusive::set", w);
+			run<boost_avl_bench>("boost::intrusive::avl_set", w);
+#endif
+#endif
+		}
+	}
+	printf("\n]\n");
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "avl_conc.h"
+
+#define node_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct int_node {
+	int key;
+	avl_conc_node_t node;
+};
+
+/*
+ * Every thread owns the keys equal to its number modulo THREADS, so it knows
+ * which of them are in the tree while the others change theirs
+ */
+#ifndef THREADS
+#define THREADS 4
+#endif
+#define KEYS 4000
+#define OPS 100000
+
+static avl_conc_root_t conc_root;
+static int released;
+
+static int
+int_keycmp(const void *key, avl_conc_node_t *b)
+{
+	int a1 = *(const int *)key;
+	int b1 = node_of(b, struct int_node, node)->key;
+
+	if (a1 < b1)
+		return -1;
+	else if (a1 > b1)
+		return 1;
+	return 0;
+}
+
+static int
+int_cmp(avl_conc_node_t *a, avl_conc_node_t *b)
+{
+	return int_keycmp(&node_of(a, struct int_node, node)->key, b);
+}
+
+static void
+release_node(avl_conc_node_t *node, void *arg)
+{
+	(void)node;
+	(void)arg;
+	__atomic_add_fetch(&released, 1, __ATOMIC_RELAXED);
+}
+
+struct worker {
+	int id;
+	int removed;
+	struct int_node *live[KEYS / THREADS];
+	struct int_node *pool;
+};
+
+static void *
+worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned seed = w->id + 1;
+	int i, used = 0;
+
+	for (i = 0; i < OPS; ++i) {
+		int slot = rand_r(&seed) % (KEYS / THREADS);
+		int key = slot * THREADS + w->id;
+		int other = rand_r(&seed) % KEYS;
+		avl_conc_node_t *node;
+
+		/* Our own keys are exactly known */
+		node = avl_conc_search_key(&conc_root, &key, int_keycmp);
+		assert(node == (w->live[slot] ? &w->live[slot]->node : NULL));
+
+		node = avl_conc_search_key(&conc_root, &other, int_keycmp);
+		if (node)
+			assert(node_of(node, struct int_node, node)->key ==
+			    other);
+
+		/* Removed nodes are never reused, which stands in for the
+		 * grace period */
+		if (w->live[slot]) {
+			avl_conc_remove(&conc_root, &w->live[slot]->node);
+			w->live[slot] = NULL;
+			++w->removed;
+		} else {
+			struct int_node *n = &w->pool[used++];
+
+			n->key = key;
+			assert(avl_conc_insert(&conc_root, &n->node, int_cmp) ==
+			    &n->node);
+			w->live[slot] = n;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Check the tree once all the threads are done. Routing nodes are counted in
+ * @routing.
+ */
+static int
+conc_check(avl_conc_node_t *node, avl_conc_node_t *parent, int *count,
+    int *routing)
+{
+	int lheight, rheight;
+
+	if (!node)
+		return 0;
+	assert(node->avl_parent == parent);
+	assert(!(node->avl_version & 3));
+	if (node->avl_children[0])
+		assert(int_cmp(node->avl_children[0], node) <= 0);
+	if (node->avl_children[1])
+		assert(int_cmp(node->avl_children[1], node) >= 0);
+	lheight = conc_check(node->avl_children[0], node, count, routing);
+	rheight = conc_check(node->avl_children[1], node, count, routing);
+
+	/* In quiescence the tree is strictly balanced */
+	assert(node->avl_height == 1 + (lheight < rheight ? rheight : lheight));
+	assert(rheight - lheight >= -1 && rheight - lheight <= 1);
+	if (node->avl_routing) {
+		assert(node->avl_children[0] && node->avl_children[1]);
+		++*routing;
+	} else {
+		++*count;
+	}
+	return node->avl_height;
+}
+
+int
+main(void)
+{
+	int i, slot, count = 0, routing = 0, live = 0, removed = 0;
+	pthread_t threads[THREADS];
+	struct worker *workers = calloc(THREADS, sizeof(struct worker));
+
+	avl_conc_init(&conc_root, release_node, NULL);
+	for (i = 0; i < THREADS; ++i) {
+		workers[i].id = i;
+		workers[i].pool = malloc(sizeof(struct int_node) * OPS);
+		assert(!pthread_create(&threads[i], NULL, worker, &workers[i]));
+	}
+	for (i = 0; i < THREADS; ++i)
+		assert(!pthread_join(threads[i], NULL));
+
+	conc_check(conc_root.avl_holder.avl_children[1],
+	    &conc_root.avl_holder, &count, &routing);
+	for (i = 0; i < THREADS; ++i) {
+		for (slot = 0; slot < KEYS / THREADS; ++slot) {
+			int key = slot * THREADS + i;
+			avl_conc_node_t *node;
+
+			node = avl_conc_search_key(&conc_root, &key,
+			    int_keycmp);
+			assert(node == (workers[i].live[slot] ?
+			    &workers[i].live[slot]->node : NULL));
+			live += workers[i].live[slot] != NULL;
+		}
+		removed += workers[i].removed;
+	}
+	assert(count == live);
+	/* Every removed node is either unlinked or still routing */
+	assert(released + routing == removed);
+
+	for (i = 0; i < THREADS; ++i)
+		free(workers[i].pool);
+	free(workers);
+	printf("test-conc: ok\n");
+	return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "avl_cow.h"
+
+#define node_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct int_node {
+	int key;
+	avl_cow_node_t node;
+};
+
+#define KEYS 512
+#define OPS 20000
+#define SNAPSHOTS 16
+
+static int allocated, released, clone_budget = -1;
+
+static int
+int_keycmp(const void *key, avl_np_node_t *b)
+{
+	int a1 = *(const int *)key;
+	int b1 = node_of(avl_cow_node(b), struct int_node, node)->key;
+
+	if (a1 < b1)
+		return -1;
+	else if (a1 > b1)
+		return 1;
+	return 0;
+}
+
+static int
+int_cmp(avl_np_node_t *a, avl_np_node_t *b)
+{
+	return int_keycmp(&node_of(avl_cow_node(a), struct int_node,
+	    node)->key, b);
+}
+
+static struct int_node *
+int_alloc(int key)
+{
+	struct int_node *n = malloc(sizeof(*n));
+
+	n->key = key;
+	++allocated;
+	return n;
+}
+
+static avl_cow_node_t *
+int_clone(avl_cow_node_t *node, void *arg)
+{
+	(void)arg;
+	if (!clone_budget)
+		return NULL;
+	if (clone_budget > 0)
+		--clone_budget;
+	return &int_alloc(node_of(node, struct int_node, node)->key)->node;
+}
+
+static void
+int_release(avl_cow_node_t *node, void *arg)
+{
+	(void)arg;
+	assert(!node->avl_refs);
+	free(node_of(node, struct int_node, node));
+	++released;
+}
+
+/*
+ * Check the shape of a version and that it holds exactly the keys set in
+ * @present
+ */
+static int
+cow_check_node(avl_np_node_t *node)
+{
+	int lheight, rheight;
+
+	if (!node)
+		return 0;
+	assert(avl_cow_node(node)->avl_refs >= 1);
+	lheight = cow_check_node(node->avl_children[0]);
+	rheight = cow_check_node(node->avl_children[1]);
+	assert(rheight - lheight == node->avl_balance);
+	assert(rheight - lheight >= -1 && rheight - lheight <= 1);
+	return 1 + (rheight < lheight ? lheight : rheight);
+}
+
+static void
+cow_check(avl_cow_root_t *root, const char *present)
+{
+	int key, prev = -1;
+	avl_np_cursor_t cursor;
+	avl_np_node_t *node;
+
+	cow_check_node(avl_cow_np(root)->avl_root);
+	for (node = avl_np_first(avl_cow_np(root), &cursor); node;
+	    node = avl_np_next(&cursor)) {
+		key = node_of(avl_cow_node(node), struct int_node, node)->key;
+		assert(key > prev);
+		for (++prev; prev < key; ++prev)
+			assert(!present[prev]);
+		assert(present[key]);
+	}
+	for (++prev; prev < KEYS; ++prev)
+		assert(!present[prev]);
+}
+
+int
+main(void)
+{
+	int i, nsnaps = 0, failed = 0;
+	unsigned seed = 1;
+	char present[KEYS] = { 0 };
+	char snap_present[SNAPSHOTS][KEYS];
+	avl_cow_root_t root, snaps[SNAPSHOTS];
+
+	avl_cow_init(&root, int_clone, int_release, NULL);
+	for (i = 0; i < OPS; ++i) {
+		int key = rand_r(&seed) % KEYS;
+
+		if (present[key]) {
+			assert(avl_cow_remove_key(&root, &key,
+			    int_keycmp) == 1);
+			present[key] = 0;
+		} else {
+			struct int_node *n = int_alloc(key);
+
+			assert(avl_cow_insert(&root, &n->node, int_cmp) ==
+			    &n->node);
+			present[key] = 1;
+		}
+
+		/* Snapshots taken along the way must not see later changes */
+		if (i % (OPS / SNAPSHOTS) == OPS / SNAPSHOTS / 2) {
+			avl_cow_snapshot(&snaps[nsnaps], &root);
+			memcpy(snap_present[nsnaps++], present, KEYS);
+		}
+	}
+	cow_check(&root, present);
+	for (i = 0; i < nsnaps; ++i)
+		cow_check(&snaps[i], snap_present[i]);
+
+	/* Modifying a snapshot leaves the others alone */
+	for (i = 0; i < KEYS; ++i) {
+		if (snap_present[0][i]) {
+			assert(avl_cow_remove_key(&snaps[0], &i,
+			    int_keycmp) == 1);
+			snap_present[0][i] = 0;
+		}
+	}
+	assert(!avl_cow_np(&snaps[0])->avl_root);
+	for (i = 1; i < nsnaps; ++i)
+		cow_check(&snaps[i], snap_present[i]);
+	cow_check(&root, present);
+
+	/*
+	 * A failed copy leaves the version as it was. A fresh snapshot before
+	 * every operation keeps the whole path shared.
+	 */
+	for (i = 0; i < KEYS; ++i) {
+		int ret;
+
+		avl_cow_snapshot(&snaps[0], &root);
+		memcpy(snap_present[0], present, KEYS);
+		clone_budget = rand_r(&seed) % 12;
+		if (present[i]) {
+			ret = avl_cow_remove_key(&root, &i, int_keycmp);
+			assert(ret == 1 || ret == -1);
+			present[i] = ret != 1;
+		} else {
+			struct int_node *n = int_alloc(i);
+			avl_cow_node_t *node;
+
+			node = avl_cow_insert(&root, &n->node, int_cmp);
+			assert(!node || node == &n->node);
+			if (!node) {
+				ret = -1;
+				free(n);
+				--allocated;
+			} else {
+				ret = 1;
+			}
+			present[i] = node != NULL;
+		}
+		failed += ret == -1;
+		clone_budget = -1;
+		cow_check(&root, present);
+		cow_check(&snaps[0], snap_present[0]);
+		avl_cow_free(&snaps[0]);
+	}
+	assert(failed > 0 && failed < KEYS);
+	assert(avl_cow_remove_key(&root, &i, int_keycmp) == 0);
+
+	avl_cow_free(&root);
+	for (i = 0; i < nsnaps; ++i)
+		avl_cow_free(&snaps[i]);
+	assert(allocated == released);
+
+	printf("test-cow: ok\n");
+	return 0;
+}
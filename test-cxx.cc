@@ -0,0 +1,209 @@
+#include "avl.hpp"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <set>
+
+#define COUNT 2000
+
+struct int_node {
+	int key;
+	avl_node_t node;
+};
+
+struct int_node_less {
+	bool operator()(const int_node &a, const int_node &b) const
+	{
+		return a.key < b.key;
+	}
+};
+
+typedef avl::tree<int_node, &int_node::node, int_node_less> int_tree;
+
+struct int_key_less {
+	typedef void is_transparent;
+
+	bool operator()(const int_node &a, const int_node &b) const
+	{
+		return a.key < b.key;
+	}
+	bool operator()(int a, const int_node &b) const { return a < b.key; }
+	bool operator()(const int_node &a, int b) const { return a.key < b; }
+};
+
+typedef avl::tree<int_node, &int_node::node, int_key_less> int_key_tree;
+
+static void
+test_transparent(int_node *nodes)
+{
+	int i;
+	int_key_tree tree;
+
+	for (i = 0; i < COUNT; ++i)
+		tree.insert(nodes[i]);
+	for (i = 0; i < COUNT; ++i) {
+		int_key_tree::iterator it = tree.find(nodes[i].key);
+
+		assert(it != tree.end() && it->key == nodes[i].key);
+		assert(tree.lower_bound(nodes[i].key) == it);
+		assert(tree.upper_bound(nodes[i].key - 1) == it);
+		assert(tree.lower_bound(nodes[i].key + 1) == ++it);
+		assert(tree.upper_bound(nodes[i].key) == it);
+	}
+	assert(tree.find(-1) == tree.end());
+	assert(tree.lower_bound(-1) == tree.begin());
+	assert(tree.lower_bound(COUNT * 2) == tree.end());
+	while (!tree.empty())
+		tree.erase(tree.begin());
+}
+
+static void
+test_multi(int_node *nodes)
+{
+	int i;
+	int_key_tree tree;
+	std::multiset<int> ref;
+
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = rand() % (COUNT / 8);
+		assert(&*tree.insert_multi(nodes[i]) == &nodes[i]);
+		ref.insert(nodes[i].key);
+	}
+	for (i = -1; i <= COUNT / 8; ++i) {
+		std::pair<int_key_tree::iterator, int_key_tree::iterator> r =
+		    tree.equal_range(i);
+		std::size_t count = 0;
+		const int_node *prev = NULL;
+
+		assert(r.first == tree.lower_bound(i));
+		assert(r.second == tree.upper_bound(i));
+		for (int_key_tree::iterator it = r.first; it != r.second; ++it) {
+			/* Equivalent elements are in insertion order */
+			assert(it->key == i && (!prev || prev < &*it));
+			prev = &*it;
+			count++;
+		}
+		assert(count == ref.count(i));
+	}
+	tree.clear();
+}
+
+struct int_node_disposer {
+	std::set<int> *ref;
+
+	explicit int_node_disposer(std::set<int> &r) : ref(&r) {}
+	void operator()(int_node *n) const { assert(ref->erase(n->key) == 1); }
+};
+
+static void
+check_equal(const int_tree &tree, const std::set<int> &ref)
+{
+	std::set<int>::const_iterator r;
+	int_tree::const_iterator it;
+
+	for (it = tree.begin(), r = ref.begin(); r != ref.end(); ++it, ++r) {
+		assert(it != tree.end());
+		assert(it->key == *r);
+	}
+	assert(it == tree.end());
+
+	std::set<int>::const_reverse_iterator rr = ref.rbegin();
+	for (int_tree::const_reverse_iterator rit = tree.rbegin();
+	    rit != tree.rend(); ++rit, ++rr)
+		assert(rit->key == *rr);
+	assert(rr == ref.rend());
+}
+
+int
+main()
+{
+	int i;
+	int_tree tree;
+	std::set<int> ref;
+	int_node *nodes = new int_node[COUNT];
+
+	assert(tree.empty());
+	assert(tree.begin() == tree.end());
+
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = rand() % (COUNT * 2);
+		std::pair<int_tree::iterator, bool> ret = tree.insert(nodes[i]);
+		assert(ret.second == ref.insert(nodes[i].key).second);
+		assert(ret.first->key == nodes[i].key);
+		if (ret.second)
+			assert(&*ret.first == &nodes[i]);
+	}
+	check_equal(tree, ref);
+
+	for (i = -1; i <= COUNT * 2; ++i) {
+		int_node key;
+		int_tree::iterator it;
+		std::set<int>::iterator r;
+
+		key.key = i;
+		it = tree.find(key);
+		if (ref.count(i))
+			assert(it != tree.end() && it->key == i);
+		else
+			assert(it == tree.end());
+
+		it = tree.lower_bound(key);
+		r = ref.lower_bound(i);
+		if (r == ref.end())
+			assert(it == tree.end());
+		else
+			assert(it != tree.end() && it->key == *r);
+
+		it = tree.upper_bound(key);
+		r = ref.upper_bound(i);
+		if (r == ref.end())
+			assert(it == tree.end());
+		else
+			assert(it != tree.end() && it->key == *r);
+	}
+
+	/* The tree is shared with the C routines */
+	assert(avl_first(tree.root()) == &tree.begin()->node);
+	assert(avl_last(tree.root()) == &(--tree.end())->node);
+
+	for (i = 0; i < COUNT; ++i) {
+		int_tree::iterator it = tree.find(nodes[i]);
+
+		if (it == tree.end() || &*it != &nodes[i])
+			continue;
+		if (i % 2) {
+			int_tree::iterator next = it;
+
+			++next;
+			assert(tree.erase(it) == next);
+		} else {
+			tree.erase(nodes[i]);
+		}
+		ref.erase(nodes[i].key);
+		if (i % 97 == 0)
+			check_equal(tree, ref);
+	}
+	check_equal(tree, ref);
+	assert(tree.empty());
+
+	test_multi(nodes);
+	for (i = 0; i < COUNT; ++i)
+		nodes[i].key = i * 2;
+	test_transparent(nodes);
+
+	/* Appending at end() and inserting before the previous element */
+	for (i = 0; i < COUNT / 2; ++i)
+		assert(&*tree.insert(tree.end(), nodes[i]) == &nodes[i]);
+	for (i = COUNT - 1; i >= COUNT / 2; --i)
+		assert(&*tree.insert(tree.end(), nodes[i]) == &nodes[i]);
+	assert(&*tree.insert(tree.begin(), nodes[7]) == &nodes[7]);
+	for (i = 0; i < COUNT; ++i)
+		ref.insert(nodes[i].key);
+	check_equal(tree, ref);
+	tree.clear_and_dispose(int_node_disposer(ref));
+	assert(tree.empty() && ref.empty());
+
+	delete[] nodes;
+	printf("test-cxx: ok\n");
+	return 0;
+}
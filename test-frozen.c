@@ -0,0 +1,197 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avl_frozen.h"
+
+#define node_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct int_node {
+	int key;
+	avl_node_t node;
+};
+
+#define COUNT 300
+
+static int
+int_keycmp(const void *key, avl_node_t *b)
+{
+	int a1 = *(const int *)key;
+	int b1 = node_of(b, struct int_node, node)->key;
+
+	if (a1 < b1)
+		return -1;
+	else if (a1 > b1)
+		return 1;
+	return 0;
+}
+
+static int
+int_cmp(avl_node_t *a, avl_node_t *b)
+{
+	return int_keycmp(&node_of(a, struct int_node, node)->key, b);
+}
+
+static void
+int_extract(avl_node_t *node, void *key)
+{
+	memcpy(key, &node_of(node, struct int_node, node)->key, sizeof(int));
+}
+
+static int
+int_frozen_cmp(const void *key, const void *frozen_key)
+{
+	int a1, b1;
+
+	memcpy(&a1, key, sizeof(int));
+	memcpy(&b1, frozen_key, sizeof(int));
+	return (a1 > b1) - (a1 < b1);
+}
+
+static void
+test_frozen(struct int_node *nodes)
+{
+	int n, i, key;
+
+	/* Every size, so that the implicit tree takes every possible shape */
+	for (n = 0; n <= COUNT; ++n) {
+		avl_root_t root = { NULL };
+		avl_frozen_t *frozen;
+
+		for (i = 0; i < n; ++i) {
+			nodes[i].key = i * 2;
+			avl_insert(&root, &nodes[i].node, int_cmp);
+		}
+		frozen = avl_freeze(&root, sizeof(int), int_extract,
+		    int_frozen_cmp);
+		assert(frozen && avl_frozen_count(frozen) == (size_t)n);
+
+		for (key = -1; key <= n * 2; ++key) {
+			assert(avl_frozen_lower_bound(frozen, &key) ==
+			    avl_lower_bound_key(&root, &key, int_keycmp));
+			assert(avl_frozen_search(frozen, &key) ==
+			    avl_search_key(&root, &key, int_keycmp));
+		}
+
+		/* The snapshot does not see later changes of the tree */
+		if (n) {
+			key = nodes[0].key;
+			avl_remove(&root, &nodes[0].node);
+			assert(avl_frozen_search(frozen, &key) ==
+			    &nodes[0].node);
+		}
+		avl_frozen_free(frozen);
+	}
+}
+
+/*
+ * Signed keys in the order of unsigned ones
+ */
+static uint64_t
+int_key32(avl_node_t *node)
+{
+	return (uint32_t)node_of(node, struct int_node, node)->key ^
+	    0x80000000u;
+}
+
+static uint64_t
+int_key64(avl_node_t *node)
+{
+	return (uint64_t)(int64_t)node_of(node, struct int_node, node)->key ^
+	    0x8000000000000000ull;
+}
+
+static void
+test_frozen_int(struct int_node *nodes)
+{
+	int n, i, key, simd, width;
+
+	for (n = 0; n <= COUNT; ++n) {
+		avl_root_t root = { NULL };
+
+		/* Negative keys as well, down to the smallest one */
+		for (i = 0; i < n; ++i) {
+			nodes[i].key = i * 2 - n;
+			avl_insert(&root, &nodes[i].node, int_cmp);
+		}
+		if (n) {
+			nodes[0].key = INT32_MIN;
+			nodes[n - 1].key = INT32_MAX;
+		}
+
+		for (width = 32; width <= 64; width += 32) {
+			avl_frozen_int_t *frozen = width == 32 ?
+			    avl_freeze_u32(&root, int_key32) :
+			    avl_freeze_u64(&root, int_key64);
+
+			assert(frozen);
+			for (simd = AVL_SIMD_SCALAR; simd <= AVL_SIMD_NEON;
+			    ++simd) {
+				if (avl_frozen_int_use(frozen, simd))
+					continue;
+				for (key = -n - 1; key <= n; ++key) {
+					uint64_t k = width == 32 ?
+					    ((uint32_t)key ^ 0x80000000u) :
+					    ((uint64_t)(int64_t)key ^
+					    0x8000000000000000ull);
+
+					assert(avl_frozen_int_lower_bound(
+					    frozen, k) == avl_lower_bound_key(
+					    &root, &key, int_keycmp));
+					assert(avl_frozen_int_search(frozen,
+					    k) == avl_search_key(&root, &key,
+					    int_keycmp));
+				}
+				/* The largest key is not mistaken for a
+				 * padding slot */
+				if (n && width == 32)
+					assert(avl_frozen_int_search(frozen,
+					    UINT32_MAX) == &nodes[n - 1].node);
+			}
+			avl_frozen_int_free(frozen);
+		}
+	}
+}
+
+int
+main(void)
+{
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+
+	test_frozen(nodes);
+	test_frozen_int(nodes);
+
+	free(nodes);
+	printf("test-frozen: ok\n");
+	return 0;
+}
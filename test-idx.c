@@ -0,0 +1,176 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "avl_idx.h"
+
+struct int_elem {
+	int key;
+	avl_idx_node_t node;
+};
+
+#define COUNT 1000
+
+static int
+int_cmp(const void *a, const void *b)
+{
+	const struct int_elem *a1 = a, *b1 = b;
+
+	if (a1->key < b1->key)
+		return -1;
+	else if (a1->key > b1->key)
+		return 1;
+	return 0;
+}
+
+static int
+int_keycmp(const void *key, const void *elem)
+{
+	int a1 = *(const int *)key;
+	const struct int_elem *b1 = elem;
+
+	if (a1 < b1->key)
+		return -1;
+	else if (a1 > b1->key)
+		return 1;
+	return 0;
+}
+
+static int
+idx_check(const avl_idx_base_t *base, avl_idx_t idx, avl_idx_t parent)
+{
+	int lheight = 0, rheight = 0;
+	avl_idx_node_t *node = avl_idx_node(base, idx);
+
+	assert(node->avl_parent == parent);
+	if (node->avl_children[0] != AVL_IDX_NIL)
+		lheight = idx_check(base, node->avl_children[0], idx) + 1;
+	if (node->avl_children[1] != AVL_IDX_NIL)
+		rheight = idx_check(base, node->avl_children[1], idx) + 1;
+
+	assert(rheight - lheight == node->avl_balance);
+	assert(rheight - lheight >= -1 && rheight - lheight <= 1);
+
+	return rheight < lheight ? lheight : rheight;
+}
+
+static void
+idx_check_root(const avl_idx_base_t *base, avl_idx_root_t *root, size_t n)
+{
+	size_t count = 0;
+	avl_idx_t idx, prev = AVL_IDX_NIL;
+
+	if (root->avl_root != AVL_IDX_NIL)
+		idx_check(base, root->avl_root, AVL_IDX_NIL);
+	for (idx = avl_idx_first(base, root); idx != AVL_IDX_NIL;
+	    idx = avl_idx_next(base, idx)) {
+		assert(avl_idx_prev(base, idx) == prev);
+		if (prev != AVL_IDX_NIL)
+			assert(int_cmp(avl_idx_elem(base, prev),
+			    avl_idx_elem(base, idx)) < 0);
+		prev = idx;
+		++count;
+	}
+	assert(avl_idx_last(base, root) == prev);
+	assert(count == n);
+}
+
+int
+main(void)
+{
+	int i, key;
+	avl_idx_root_t root;
+	avl_idx_base_t base;
+	struct int_elem *elems = malloc(sizeof(struct int_elem) * COUNT);
+	struct int_elem *moved;
+
+	assert(sizeof(avl_idx_node_t) == 16);
+
+	base.avl_base = elems;
+	base.avl_stride = sizeof(struct int_elem);
+	base.avl_offset = offsetof(struct int_elem, node);
+	avl_idx_root_init(&root);
+
+	for (i = 0; i < COUNT; ++i) {
+		/* Insert the even keys in a scrambled order */
+		elems[i].key = (i * 37 % COUNT) * 2;
+		assert(avl_idx_insert(&base, &root, i, int_cmp) ==
+		    (avl_idx_t)i);
+	}
+	idx_check_root(&base, &root, COUNT);
+
+	/* A duplicate is not inserted */
+	elems[COUNT - 1].key = elems[0].key;
+	assert(avl_idx_insert(&base, &root, COUNT - 1, int_cmp) == 0);
+	elems[COUNT - 1].key = ((COUNT - 1) * 37 % COUNT) * 2;
+
+	/*
+	 * The tree holds no address, so a copy of the array at another
+	 * address is a valid tree with the same root
+	 */
+	moved = malloc(sizeof(struct int_elem) * COUNT);
+	memcpy(moved, elems, sizeof(struct int_elem) * COUNT);
+	free(elems);
+	elems = moved;
+	base.avl_base = elems;
+	idx_check_root(&base, &root, COUNT);
+
+	for (key = -1; key <= COUNT * 2; ++key) {
+		avl_idx_t idx = avl_idx_search_key(&base, &root, &key,
+		    int_keycmp);
+		avl_idx_t lb = avl_idx_lower_bound_key(&base, &root, &key,
+		    int_keycmp);
+
+		if (key < 0 || key >= COUNT * 2 || key % 2)
+			assert(idx == AVL_IDX_NIL);
+		else
+			assert(idx != AVL_IDX_NIL && elems[idx].key == key);
+		if (key >= COUNT * 2 - 1)
+			assert(lb == AVL_IDX_NIL);
+		else
+			assert(lb != AVL_IDX_NIL &&
+			    elems[lb].key == (key < 0 ? 0 : key + (key & 1)));
+	}
+
+	for (i = 0; i < COUNT; ++i) {
+		/* Remove in a different order than the insertion */
+		avl_idx_remove(&base, &root, (avl_idx_t)(i * 7 % COUNT));
+		if (!(i % 50))
+			idx_check_root(&base, &root, COUNT - i - 1);
+	}
+	assert(root.avl_root == AVL_IDX_NIL);
+
+	free(elems);
+	printf("test-idx: ok\n");
+	return 0;
+}
@@ -29,13 +29,29 @@ avl_cmp(avl_node_t *a, avl_node_t *b)
 	return 0;
 }
 
+static int
+avl_keycmp(const void *key, avl_node_t *b)
+{
+	int a1;
+	struct int_node *b1;
+
+	a1 = *(const int *)key;
+	b1 = node_of(b, struct int_node, node);
+
+	if (a1 < b1->key)
+		return -1;
+	else if (a1 > b1->key)
+		return 1;
+	return 0;
+}
+
 void
 avl_dump_tree(struct int_node *node, int depth)
 {
 	int whichchild;
 
 	whichchild = avl_which_child(&node->node);
-	printf("%*c|- key:%d balance:%d whichchild:%d\n", depth, ' ', node->key, node->node.avl_balance, whichchild);
+	printf("%*c|- key:%d balance:%d whichchild:%d\n", depth, ' ', node->key, avl_get_balance(&node->node), whichchild);
 	fflush(stdout);
 	
 	if (node->node.avl_children[0])
@@ -57,7 +73,7 @@ avl_check(struct int_node *node, int depth)
 		rheight = avl_check(node_of(node->node.avl_children[1], struct int_node, node), depth + 1) + 1;
 	
 	height_diff = rheight - lheight;
-	if (height_diff != node->node.avl_balance) {
+	if (height_diff != avl_get_balance(&node->node)) {
 		printf("Incorrect tree!!!\n");
 		fflush(stdout);
 		assert(0);
@@ -67,6 +83,15 @@ avl_check(struct int_node *node, int depth)
 		fflush(stdout);
 		assert(0);
 	}
+#ifdef AVL_ORDER_STATISTICS
+	if (node->node.avl_size != 1 +
+	    avl_subtree_size(node->node.avl_children[0]) +
+	    avl_subtree_size(node->node.avl_children[1])) {
+		printf("Incorrect subtree size!!!\n");
+		fflush(stdout);
+		assert(0);
+	}
+#endif
 	
 	if (rheight < lheight)
 		return lheight;
@@ -75,6 +100,1061 @@ avl_check(struct int_node *node, int depth)
 
 #define COUNT 200
 
+static void
+avl_check_root(avl_root_t *root)
+{
+	if (root->avl_root)
+		avl_check(node_of(root->avl_root, struct int_node, node), 0);
+}
+
+static void
+test_key(void)
+{
+	int i, key;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+
+	for (i = 0; i < COUNT; ++i) {
+		/* Insert the even keys in a scrambled order */
+		nodes[i].key = (i * 37 % COUNT) * 2;
+		assert(avl_insert_key(&root, &nodes[i].key, &nodes[i].node,
+		    avl_keycmp) == &nodes[i].node);
+		assert(avl_insert_key(&root, &nodes[i].key, &nodes[COUNT - 1].node,
+		    avl_keycmp) == &nodes[i].node);
+		avl_check_root(&root);
+	}
+	for (key = -1; key <= COUNT * 2; ++key) {
+		avl_node_t *ptr = avl_search_key(&root, &key, avl_keycmp);
+
+		if (key < 0 || key >= COUNT * 2 || key % 2)
+			assert(!ptr);
+		else
+			assert(ptr && node_of(ptr, struct int_node, node)->key == key);
+	}
+	for (i = 0; i < COUNT; ++i) {
+		avl_remove(&root, &nodes[i].node);
+		avl_check_root(&root);
+	}
+	assert(!root.avl_root);
+	free(nodes);
+}
+
+static int
+key_of(avl_node_t *node)
+{
+	return node_of(node, struct int_node, node)->key;
+}
+
+/*
+ * Linear scan over the keys 0, 2, 4, ..., (COUNT - 1) * 2 for the nearest key
+ * following (dir = 1) or preceding (dir = -1) the given key.
+ */
+static int
+bound_ref(int key, int dir, int inclusive)
+{
+	int i, found = -1;
+
+	for (i = 0; i < COUNT; ++i) {
+		int k = i * 2;
+
+		if ((inclusive && k == key) ||
+		    (dir > 0 && k > key) || (dir < 0 && k < key)) {
+			found = k;
+			if (dir > 0)
+				break;
+		}
+	}
+	return found;
+}
+
+static void
+test_bound(void)
+{
+	int i, key;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = (i * 37 % COUNT) * 2;
+		avl_insert(&root, &nodes[i].node, avl_cmp);
+	}
+	for (key = -2; key <= COUNT * 2; ++key) {
+		struct int_node k;
+		avl_node_t *ptr;
+		int ref;
+
+		k.key = key;
+
+		ptr = avl_lower_bound(&root, &k.node, avl_cmp);
+		ref = bound_ref(key, 1, 1);
+		assert(ref < 0 ? !ptr : key_of(ptr) == ref);
+		assert(avl_ceil(&root, &k.node, avl_cmp) == ptr);
+		assert(avl_lower_bound_key(&root, &key, avl_keycmp) == ptr);
+		assert(avl_ceil_key(&root, &key, avl_keycmp) == ptr);
+
+		ptr = avl_upper_bound(&root, &k.node, avl_cmp);
+		ref = bound_ref(key, 1, 0);
+		assert(ref < 0 ? !ptr : key_of(ptr) == ref);
+		assert(avl_upper_bound_key(&root, &key, avl_keycmp) == ptr);
+
+		ptr = avl_floor(&root, &k.node, avl_cmp);
+		ref = bound_ref(key, -1, 1);
+		assert(ref < 0 ? !ptr : key_of(ptr) == ref);
+		assert(avl_floor_key(&root, &key, avl_keycmp) == ptr);
+	}
+	free(nodes);
+}
+
+#ifdef AVL_ORDER_STATISTICS
+static void
+test_order_statistics(void)
+{
+	int i;
+	size_t k, n = 0;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = (i * 37 % COUNT) * 2;
+		avl_insert(&root, &nodes[i].node, avl_cmp);
+		n++;
+		avl_check_root(&root);
+	}
+	for (i = 0; i < COUNT; ++i) {
+		/* The node with key i * 2 has rank i */
+		avl_node_t *ptr = avl_select(&root, i);
+
+		assert(key_of(ptr) == i * 2);
+		assert(avl_rank(&root, ptr) == (size_t)i);
+	}
+	assert(!avl_select(&root, COUNT));
+
+	for (i = 0; i < COUNT; i += 2) {
+		avl_remove(&root, &nodes[i].node);
+		n--;
+		avl_check_root(&root);
+	}
+	for (k = 0; k < n; ++k) {
+		avl_node_t *ptr = avl_select(&root, k);
+
+		assert(avl_rank(&root, ptr) == k);
+		if (k)
+			assert(avl_prev(ptr) == avl_select(&root, k - 1));
+	}
+	assert(!avl_select(&root, n));
+	free(nodes);
+}
+#endif
+
+#ifdef AVL_STATS
+static void
+test_stats(void)
+{
+	int i;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+	avl_stats_t stats;
+
+	avl_stats_reset();
+	avl_stats_get(&stats);
+	assert(!stats.avl_compares && !stats.avl_descents);
+
+	/* Ascending insertions only ever need single rotations */
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = i;
+		avl_insert(&root, &nodes[i].node, avl_cmp);
+	}
+	avl_stats_get(&stats);
+	assert(stats.avl_descents == COUNT);
+	assert(stats.avl_compares == stats.avl_depth_sum);
+	assert(stats.avl_rotations[0] > 0);
+	assert(!stats.avl_rotations[1] && !stats.avl_rotations[2]);
+	assert(stats.avl_fixups == COUNT);
+
+	avl_stats_reset();
+	for (i = 0; i < COUNT; ++i)
+		assert(avl_search_key(&root, &i, avl_keycmp) ==
+		    &nodes[i].node);
+	avl_stats_get(&stats);
+	assert(stats.avl_descents == COUNT);
+	assert(stats.avl_compares == stats.avl_depth_sum);
+
+	/* A tree of 200 nodes is not taller than 1.44 log2(200) */
+	assert(stats.avl_depth_max >= 8 && stats.avl_depth_max <= 11);
+	assert(stats.avl_depth_sum < stats.avl_depth_max * COUNT);
+
+	avl_stats_reset();
+	for (i = 0; i < COUNT; ++i)
+		avl_remove(&root, &nodes[i].node);
+	avl_stats_get(&stats);
+
+	/* Emptying the tree takes no walk */
+	assert(stats.avl_fixups == COUNT - 1);
+	assert(stats.avl_fixup_steps >= COUNT - 1);
+	assert(!stats.avl_compares && !stats.avl_descents);
+
+	free(nodes);
+}
+#endif
+
+static void
+test_build(void)
+{
+	int i, n;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+	avl_node_t **array = malloc(sizeof(avl_node_t *) * COUNT);
+
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = i * 2;
+		array[i] = &nodes[i].node;
+	}
+	for (n = 0; n <= COUNT; ++n) {
+		avl_node_t *ptr;
+
+		avl_build_sorted(&root, array, n);
+		avl_check_root(&root);
+		for (i = 0, ptr = avl_first(&root); i < n; ++i, ptr = avl_next(ptr))
+			assert(ptr == array[i]);
+		assert(!ptr);
+
+		/* The tree built behaves like any other tree */
+		if (n) {
+			avl_remove(&root, array[n / 2]);
+			avl_check_root(&root);
+			assert(avl_insert(&root, array[n / 2], avl_cmp) ==
+			    array[n / 2]);
+			avl_check_root(&root);
+		}
+
+		assert(!avl_build_sorted_checked(&root, array, n, avl_cmp));
+		avl_check_root(&root);
+	}
+
+	/* Unsorted and duplicate keys are refused */
+	nodes[COUNT / 2].key = nodes[COUNT / 2 - 1].key;
+	assert(avl_build_sorted_checked(&root, array, COUNT, avl_cmp) ==
+	    array[COUNT / 2]);
+	assert(!root.avl_root);
+	nodes[COUNT / 2].key = -1;
+	assert(avl_build_sorted_checked(&root, array, COUNT, avl_cmp) ==
+	    array[COUNT / 2]);
+	assert(!root.avl_root);
+
+	free(array);
+	free(nodes);
+}
+
+static unsigned long cmp_count;
+
+static int
+avl_cmp_counted(avl_node_t *a, avl_node_t *b)
+{
+	cmp_count++;
+	return avl_cmp(a, b);
+}
+
+static void
+test_batch(void)
+{
+	int i;
+	unsigned long batch_cmps;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT * 2);
+	avl_node_t **array = malloc(sizeof(avl_node_t *) * COUNT);
+
+	/* The tree holds the odd keys 1, 3, 5, ... */
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = i * 2 + 1;
+		avl_insert(&root, &nodes[i].node, avl_cmp);
+	}
+
+	/* Insert the even keys 0, 2, 4, ..., with a few odd duplicates */
+	for (i = 0; i < COUNT; ++i) {
+		nodes[COUNT + i].key = i % 10 == 9 ? i * 2 + 1 : i * 2;
+		array[i] = &nodes[COUNT + i].node;
+	}
+	cmp_count = 0;
+	assert(avl_insert_sorted_batch(&root, array, COUNT, avl_cmp_counted) ==
+	    COUNT - COUNT / 10);
+	avl_check_root(&root);
+	for (i = 0; i < COUNT; ++i) {
+		if (i % 10 == 9)
+			assert(array[i] == &nodes[i].node);
+		else
+			assert(array[i] == &nodes[COUNT + i].node);
+	}
+	for (i = 0; i < COUNT; ++i)
+		assert(avl_search(&root, array[i], avl_cmp) == array[i]);
+
+	/* Compare against inserting the same nodes one by one */
+	for (i = 0; i < COUNT; ++i)
+		if (i % 10 != 9)
+			avl_remove(&root, &nodes[COUNT + i].node);
+	batch_cmps = cmp_count;
+	cmp_count = 0;
+	for (i = 0; i < COUNT; ++i)
+		avl_insert(&root, &nodes[COUNT + i].node, avl_cmp_counted);
+	assert(batch_cmps < cmp_count);
+
+	free(array);
+	free(nodes);
+}
+
+/*
+ * Check that the tree holds exactly the keys lo, lo + 2, ..., below hi
+ */
+static void
+check_keys(avl_root_t *root, int lo, int hi)
+{
+	avl_node_t *ptr;
+
+	avl_check_root(root);
+	for (ptr = avl_first(root); lo < hi; lo += 2, ptr = avl_next(ptr))
+		assert(ptr && key_of(ptr) == lo);
+	assert(!ptr);
+}
+
+static void
+test_split_join(void)
+{
+	int i, key;
+	avl_root_t root = { NULL }, left = { NULL }, right = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+
+	for (key = -1; key <= COUNT * 2 + 1; ++key) {
+		struct int_node k;
+		int split;
+		avl_node_t *pivot;
+
+		k.key = key;
+		split = key < 0 ? 0 : key > COUNT * 2 ? COUNT * 2 : (key + 1) / 2 * 2;
+
+		/* Vary the shape of the tree being split */
+		for (i = 0; i < COUNT; ++i) {
+			nodes[i].key = (i * 37 % COUNT) * 2;
+			if (key % 3)
+				avl_insert(&root, &nodes[i].node, avl_cmp);
+		}
+		if (!(key % 3)) {
+			for (i = 0; i < COUNT; ++i)
+				avl_insert(&root, &nodes[i].node, avl_cmp);
+		}
+
+		avl_split(&root, &k.node, avl_cmp, &left, &right);
+		assert(!root.avl_root);
+		check_keys(&left, 0, split);
+		check_keys(&right, split, COUNT * 2);
+
+		/* Join with the first node of right as the pivot */
+		avl_join(&root, &left, NULL, &right);
+		assert(!left.avl_root && !right.avl_root);
+		check_keys(&root, 0, COUNT * 2);
+
+		/* Join with an explicit pivot, into the left tree */
+		avl_split_key(&root, &key, avl_keycmp, &left, &right);
+		check_keys(&left, 0, split);
+		check_keys(&right, split, COUNT * 2);
+		pivot = avl_last(&left);
+		if (pivot) {
+			avl_remove(&left, pivot);
+			avl_join(&left, &left, pivot, &right);
+			check_keys(&left, 0, COUNT * 2);
+		} else {
+			avl_join(&left, &left, NULL, &right);
+		}
+		check_keys(&left, 0, COUNT * 2);
+
+		/* Split into the same root and drop the upper part */
+		avl_split(&left, &k.node, avl_cmp, &left, &right);
+		check_keys(&left, 0, split);
+		for (i = 0; i < COUNT; ++i)
+			if (nodes[i].key >= split)
+				avl_remove(&right, &nodes[i].node);
+		for (i = 0; i < COUNT; ++i)
+			if (nodes[i].key < split)
+				avl_remove(&left, &nodes[i].node);
+		assert(!left.avl_root && !right.avl_root);
+	}
+	free(nodes);
+}
+
+static void
+test_hint(void)
+{
+	int i;
+	avl_root_t root = { NULL };
+	avl_node_t *hint = NULL;
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT * 2);
+
+	/* Appending in ascending order costs two comparisons at most */
+	cmp_count = 0;
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = i * 2;
+		assert(avl_insert_hint(&root, hint, &nodes[i].node,
+		    avl_cmp_counted) == &nodes[i].node);
+		hint = &nodes[i].node;
+	}
+	assert(cmp_count <= COUNT * 2);
+	check_keys(&root, 0, COUNT * 2);
+
+	/* Filling the gaps right before the hint */
+	for (i = 0; i < COUNT; ++i) {
+		nodes[COUNT + i].key = i * 2 + 1;
+		assert(avl_insert_hint(&root, &nodes[i + 1 < COUNT ? i + 1 : i].node,
+		    &nodes[COUNT + i].node, avl_cmp) == &nodes[COUNT + i].node);
+		avl_check_root(&root);
+	}
+
+	/* Hints far away and duplicate keys */
+	for (i = 0; i < COUNT * 2; ++i)
+		avl_remove(&root, &nodes[i].node);
+	for (i = 0; i < COUNT * 2; ++i) {
+		nodes[i].key = i * 37 % (COUNT * 2);
+		assert(avl_insert_hint(&root, root.avl_root ? avl_first(&root) :
+		    NULL, &nodes[i].node, avl_cmp) == &nodes[i].node);
+		assert(avl_insert_hint(&root, avl_last(&root), &nodes[i].node,
+		    avl_cmp) == &nodes[i].node);
+		avl_check_root(&root);
+	}
+	for (i = 0; i < COUNT * 2; ++i) {
+		struct int_node dup;
+		avl_node_t *ptr;
+
+		dup.key = i;
+		ptr = avl_insert_hint(&root, &nodes[i * 7 % (COUNT * 2)].node,
+		    &dup.node, avl_cmp);
+		assert(ptr != &dup.node && key_of(ptr) == i);
+	}
+	for (i = 0, hint = avl_first(&root); i < COUNT * 2; ++i) {
+		assert(key_of(hint) == i);
+		hint = avl_next(hint);
+	}
+	assert(!hint);
+	free(nodes);
+}
+
+static void
+destroy_node(avl_node_t *node, void *arg)
+{
+	int *visited = arg;
+
+	/* Both subtrees have been torn down already */
+	assert(!node->avl_children[0] && !node->avl_children[1]);
+	assert(!visited[key_of(node)]);
+	visited[key_of(node)] = 1;
+}
+
+static void
+test_destroy(void)
+{
+	int i, n;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+	int *visited = malloc(sizeof(int) * COUNT);
+
+	avl_destroy(&root, destroy_node, visited);
+	for (n = 1; n <= COUNT; n += 13) {
+		for (i = 0; i < n; ++i) {
+			nodes[i].key = i * 37 % n;
+			avl_insert(&root, &nodes[i].node, avl_cmp);
+			visited[i] = 0;
+		}
+		avl_destroy(&root, destroy_node, visited);
+		assert(!root.avl_root);
+		for (i = 0; i < n; ++i)
+			assert(visited[i]);
+	}
+
+	/* The nodes can be reused */
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = i * 2;
+		avl_insert(&root, &nodes[i].node, avl_cmp);
+	}
+	check_keys(&root, 0, COUNT * 2);
+	avl_destroy(&root, NULL, NULL);
+	assert(!root.avl_root);
+
+	free(visited);
+	free(nodes);
+}
+
+static void
+test_search_from(void)
+{
+	int i, d, key;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+	struct int_node k;
+	avl_node_t *start;
+
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = i * 37 % COUNT * 2;
+		avl_insert(&root, &nodes[i].node, avl_cmp);
+	}
+
+	/* Any start node finds the same node as a search from the root */
+	for (i = 0; i < COUNT; i += 7) {
+		start = &nodes[i].node;
+		for (key = -1; key <= COUNT * 2; ++key) {
+			assert(avl_search_from_key(start, &key, avl_keycmp) ==
+			    avl_search_key(&root, &key, avl_keycmp));
+		}
+	}
+
+	/* Sweeps compare fewer nodes than searches from the root */
+	for (d = 1; d <= 4; d *= 2) {
+		unsigned long from_root;
+
+		cmp_count = 0;
+		for (i = 0; i + d < COUNT; i += d) {
+			k.key = (i + d) * 2;
+			avl_search(&root, &k.node, avl_cmp_counted);
+		}
+		from_root = cmp_count;
+
+		cmp_count = 0;
+		start = avl_first(&root);
+		for (i = 0; i + d < COUNT; i += d) {
+			k.key = (i + d) * 2;
+			start = avl_search_from(start, &k.node, avl_cmp_counted);
+			assert(key_of(start) == k.key);
+		}
+		assert(cmp_count < from_root);
+	}
+
+	free(nodes);
+}
+
+static void
+test_multi(void)
+{
+	int i, key, count;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+	avl_node_t *ptr, *end, *prev;
+
+	/* Keys 0, 1, ..., each appearing about three times */
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = i * 7 % (COUNT / 3);
+		if (i & 1)
+			avl_insert_multi(&root, &nodes[i].node, avl_cmp);
+		else
+			avl_insert_multi_key(&root, &nodes[i].key,
+			    &nodes[i].node, avl_keycmp);
+		avl_check_root(&root);
+	}
+
+	for (key = -1; key <= COUNT / 3; ++key) {
+		ptr = avl_equal_range_key(&root, &key, avl_keycmp, &end);
+		assert(ptr == avl_lower_bound_key(&root, &key, avl_keycmp));
+		assert(end == avl_upper_bound_key(&root, &key, avl_keycmp));
+
+		/* Equal keys are in insertion order */
+		count = 0;
+		for (prev = NULL; ptr != end; prev = ptr, ptr = avl_next(ptr)) {
+			assert(key_of(ptr) == key);
+			if (prev)
+				assert(prev < ptr);
+			count++;
+		}
+		for (i = 0; i < COUNT; ++i)
+			count -= nodes[i].key == key;
+		assert(!count);
+	}
+
+	/* Removing any node of a run keeps the others */
+	for (i = 0; i < COUNT; i += 3)
+		avl_remove(&root, &nodes[i].node);
+	avl_check_root(&root);
+	for (i = 0; i < COUNT; ++i)
+		if (i % 3) {
+			ptr = avl_equal_range(&root, &nodes[i].node, avl_cmp,
+			    &end);
+			while (ptr != &nodes[i].node)
+				ptr = avl_next(ptr);
+			assert(ptr != end);
+		}
+
+	free(nodes);
+}
+
+static void
+test_cursor(void)
+{
+	int i, n, key;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+	avl_cursor_t cursor;
+	avl_node_t *ptr, *ref;
+
+	for (n = 0; n <= COUNT; n += 11) {
+		root.avl_root = NULL;
+		for (i = 0; i < n; ++i) {
+			nodes[i].key = i * 37 % n * 2;
+			avl_insert(&root, &nodes[i].node, avl_cmp);
+		}
+
+		/* Full scans agree with avl_next() and avl_prev() */
+		ref = avl_first(&root);
+		for (ptr = avl_cursor_first(&cursor, &root); ptr;
+		    ptr = avl_cursor_next(&cursor)) {
+			assert(ptr == ref && avl_cursor_get(&cursor) == ptr);
+			ref = avl_next(ref);
+		}
+		assert(!ref && !avl_cursor_next(&cursor));
+		ref = avl_last(&root);
+		for (ptr = avl_cursor_last(&cursor, &root); ptr;
+		    ptr = avl_cursor_prev(&cursor)) {
+			assert(ptr == ref);
+			ref = avl_prev(ref);
+		}
+		assert(!ref && !avl_cursor_prev(&cursor));
+
+		/* Seek, then step either way */
+		for (key = -1; key <= n * 2; ++key) {
+			ref = avl_lower_bound_key(&root, &key, avl_keycmp);
+			ptr = avl_cursor_seek_key(&cursor, &root, &key,
+			    avl_keycmp);
+			assert(ptr == ref);
+			if (!ref)
+				continue;
+			ptr = avl_cursor_next(&cursor);
+			assert(ptr == avl_next(ref));
+			if (ptr)
+				assert(avl_cursor_prev(&cursor) == ref);
+			else
+				continue;
+			assert(avl_cursor_prev(&cursor) == avl_prev(ref));
+		}
+	}
+
+	free(nodes);
+}
+
+/*
+ * Keys seen by test_range(), and where to stop
+ */
+struct range_visit {
+	int next, stop;
+};
+
+static int
+visit_key(avl_node_t *node, void *arg)
+{
+	struct range_visit *v = arg;
+
+	assert(key_of(node) == v->next);
+	v->next += 2;
+	return v->next > v->stop ? v->next : 0;
+}
+
+static void
+test_range(void)
+{
+	int i, n, lo, hi, first, end, removed;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+	int *visited = malloc(sizeof(int) * COUNT * 2);
+	struct range_visit v;
+
+	for (n = 0; n <= COUNT; n += 23) {
+		for (lo = -3; lo <= n * 2 + 3; lo += 5) {
+			for (hi = lo - 4; hi <= n * 2 + 4; hi += 3) {
+				/* The keys 0, 2, ..., in [lo, hi) */
+				first = lo <= 0 ? 0 : (lo + 1) & ~1;
+				end = hi <= 0 ? 0 : (hi + 1) & ~1;
+				if (end > n * 2)
+					end = n * 2;
+				if (end < first)
+					end = first;
+
+				root.avl_root = NULL;
+				for (i = 0; i < n; ++i) {
+					nodes[i].key = i * 37 % n * 2;
+					avl_insert(&root, &nodes[i].node,
+					    avl_cmp);
+				}
+
+				v.next = first;
+				v.stop = end;
+				assert(!avl_range_foreach_key(&root, &lo, &hi,
+				    avl_keycmp, visit_key, &v));
+				assert(v.next == end);
+				if (end - first > 4) {
+					/* Stop after the second node */
+					v.next = first;
+					v.stop = first + 2;
+					assert(avl_range_foreach_key(&root,
+					    &lo, &hi, avl_keycmp, visit_key,
+					    &v) == first + 4);
+				}
+
+				for (i = 0; i < n * 2; ++i)
+					visited[i] = 0;
+				removed = avl_remove_range_key(&root, &lo,
+				    &hi, avl_keycmp, destroy_node, visited);
+				assert(removed == (end - first) / 2);
+				avl_check_root(&root);
+				for (i = 0; i < n * 2; i += 2) {
+					assert(visited[i] ==
+					    (i >= first && i < end));
+					assert(!!avl_search_key(&root, &i,
+					    avl_keycmp) != visited[i]);
+				}
+			}
+		}
+	}
+
+	free(visited);
+	free(nodes);
+}
+
+/*
+ * Arena the nodes are moved into by test_relayout()
+ */
+struct arena {
+	struct int_node *nodes;
+	int used;
+};
+
+static avl_node_t *
+relocate_node(avl_node_t *node, void *arg)
+{
+	struct arena *arena = arg;
+	struct int_node *moved = &arena->nodes[arena->used++];
+
+	*moved = *node_of(node, struct int_node, node);
+	node_of(node, struct int_node, node)->key = -1;
+	return &moved->node;
+}
+
+static int
+depth_of(avl_node_t *node)
+{
+	int depth = 0;
+
+	while ((node = avl_get_parent(node)))
+		depth++;
+	return depth;
+}
+
+static avl_node_t *
+relocate_in_place(avl_node_t *node, void *arg)
+{
+	(void)arg;
+	return node;
+}
+
+static void
+test_relayout(void)
+{
+	int i, layout, n;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+	struct arena arena;
+	struct int_node *moved;
+
+	arena.nodes = malloc(sizeof(struct int_node) * COUNT);
+	for (n = 0; n <= COUNT; n += 7) {
+		for (layout = AVL_LAYOUT_INORDER; layout <= AVL_LAYOUT_VEB;
+		    layout++) {
+			root.avl_root = NULL;
+			for (i = 0; i < n; ++i) {
+				nodes[i].key = i * 37 % n * 2;
+				avl_insert(&root, &nodes[i].node, avl_cmp);
+			}
+			arena.used = 0;
+			avl_relayout(&root, layout, relocate_node, &arena);
+			assert(arena.used == n);
+			check_keys(&root, 0, n * 2);
+
+			/*
+			 * Every node moved once, parents before children
+			 * unless in key order
+			 */
+			for (i = 0; i < n; ++i) {
+				moved = &arena.nodes[i];
+				assert(nodes[i].key == -1);
+				if (layout != AVL_LAYOUT_INORDER &&
+				    avl_get_parent(&moved->node))
+					assert(node_of(avl_get_parent(
+					    &moved->node), struct int_node,
+					    node) < moved);
+				if (layout == AVL_LAYOUT_INORDER)
+					assert(moved->key == i * 2);
+				if (layout == AVL_LAYOUT_BFS && i)
+					assert(depth_of(&moved[-1].node) <=
+					    depth_of(&moved->node));
+			}
+		}
+	}
+
+	/* A routine leaving the nodes in place changes nothing */
+	root.avl_root = NULL;
+	for (i = 0; i < COUNT; ++i) {
+		arena.nodes[i].key = i * 2;
+		avl_insert(&root, &arena.nodes[i].node, avl_cmp);
+	}
+	avl_relayout(&root, AVL_LAYOUT_VEB, relocate_in_place, NULL);
+	check_keys(&root, 0, COUNT * 2);
+
+	free(arena.nodes);
+	free(nodes);
+}
+
+#ifdef AVL_AUGMENT
+/*
+ * Range-sum tree: every node keeps the sum of the keys in its subtree
+ */
+struct sum_node {
+	int key;
+	long sum;
+	avl_node_t node;
+};
+
+static long
+sum_of(avl_node_t *node)
+{
+	if (!node)
+		return 0;
+	return node_of(node, struct sum_node, node)->sum;
+}
+
+static int
+sum_augment(avl_node_t *node)
+{
+	long sum;
+	struct sum_node *n = node_of(node, struct sum_node, node);
+
+	sum = n->key + sum_of(node->avl_children[0]) +
+	    sum_of(node->avl_children[1]);
+	if (sum == n->sum)
+		return 0;
+	n->sum = sum;
+	return 1;
+}
+
+static int
+sum_cmp(avl_node_t *a, avl_node_t *b)
+{
+	struct sum_node *a1, *b1;
+
+	a1 = node_of(a, struct sum_node, node);
+	b1 = node_of(b, struct sum_node, node);
+	return (a1->key > b1->key) - (a1->key < b1->key);
+}
+
+static long
+sum_check(avl_node_t *node)
+{
+	long sum;
+
+	if (!node)
+		return 0;
+	sum = node_of(node, struct sum_node, node)->key +
+	    sum_check(node->avl_children[0]) + sum_check(node->avl_children[1]);
+	assert(sum == sum_of(node));
+	return sum;
+}
+
+/*
+ * Sum of the keys less than key, in a single descent
+ */
+static long
+sum_below(avl_root_t *root, int key)
+{
+	long sum = 0;
+	avl_node_t *cur = root->avl_root;
+
+	while (cur) {
+		struct sum_node *n = node_of(cur, struct sum_node, node);
+
+		if (n->key < key) {
+			sum += n->key + sum_of(cur->avl_children[0]);
+			cur = cur->avl_children[1];
+		} else {
+			cur = cur->avl_children[0];
+		}
+	}
+	return sum;
+}
+
+static void
+test_augment(void)
+{
+	int i, key;
+	avl_root_t root = { NULL, sum_augment };
+	struct sum_node *nodes = malloc(sizeof(struct sum_node) * COUNT);
+	avl_node_t **array = malloc(sizeof(avl_node_t *) * COUNT);
+
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = i * 37 % COUNT;
+		avl_insert(&root, &nodes[i].node, sum_cmp);
+		sum_check(root.avl_root);
+	}
+	for (key = 0; key <= COUNT; ++key)
+		assert(sum_below(&root, key) == (long)key * (key - 1) / 2);
+
+	/* Bulk build maintains the augmented data as well */
+	for (i = 0; i < COUNT; ++i)
+		avl_remove(&root, &nodes[i].node);
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = i;
+		array[i] = &nodes[i].node;
+	}
+	avl_build_sorted(&root, array, COUNT);
+	sum_check(root.avl_root);
+
+	/* So do split and join */
+	for (key = 0; key <= COUNT; key += 7) {
+		struct sum_node k;
+		avl_root_t left = { NULL, sum_augment };
+		avl_root_t right = { NULL, sum_augment };
+
+		k.key = key;
+		avl_split(&root, &k.node, sum_cmp, &left, &right);
+		sum_check(left.avl_root);
+		sum_check(right.avl_root);
+		assert(sum_of(left.avl_root) == (long)key * (key - 1) / 2);
+		avl_join(&root, &left, NULL, &right);
+		sum_check(root.avl_root);
+	}
+
+	for (i = 0; i < COUNT; i += 2) {
+		avl_remove(&root, &nodes[i].node);
+		sum_check(root.avl_root);
+	}
+	for (i = 1; i < COUNT; i += 2) {
+		avl_remove(&root, &nodes[i].node);
+		sum_check(root.avl_root);
+	}
+	assert(!root.avl_root);
+	free(array);
+	free(nodes);
+}
+
+#endif
+
+static int prefetched;
+
+static void
+count_prefetch(avl_node_t *node)
+{
+	(void)node;
+	++prefetched;
+}
+
+static void
+test_search_many(void)
+{
+	int i, n;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+	int *keys = malloc(sizeof(int) * (COUNT * 2 + 2));
+	const void **keyp = malloc(sizeof(void *) * (COUNT * 2 + 2));
+	avl_node_t **out = malloc(sizeof(avl_node_t *) * (COUNT * 2 + 2));
+
+	/* Present and missing keys, in a scrambled order */
+	for (i = 0; i < COUNT * 2 + 2; ++i) {
+		keys[i] = (i * 37 % (COUNT * 2 + 2)) - 1;
+		keyp[i] = &keys[i];
+	}
+
+	avl_search_many(&root, keyp, COUNT, avl_keycmp, NULL, out);
+	for (i = 0; i < COUNT; ++i)
+		assert(!out[i]);
+
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = i * 2;
+		avl_insert(&root, &nodes[i].node, avl_cmp);
+	}
+	/* Fewer keys than a group as well */
+	for (n = 0; n <= COUNT * 2 + 2; n += n < 16 ? 1 : 97) {
+		avl_search_many(&root, keyp, n, avl_keycmp, NULL, out);
+		for (i = 0; i < n; ++i)
+			assert(out[i] == avl_search_key(&root, &keys[i],
+			    avl_keycmp));
+	}
+
+	prefetched = 0;
+	avl_search_many(&root, keyp, COUNT * 2 + 2, avl_keycmp,
+	    count_prefetch, out);
+	assert(prefetched > 0);
+	for (i = 0; i < COUNT * 2 + 2; ++i)
+		assert(out[i] == avl_search_key(&root, &keys[i], avl_keycmp));
+
+	free(out);
+	free(keyp);
+	free(keys);
+	free(nodes);
+}
+
+/* Descent during which each key was last prefetched, indexed by key */
+static int hinted[COUNT * 2 + 2];
+static int descent;
+
+static void
+hint_prefetch(avl_node_t *node)
+{
+	hinted[node_of(node, struct int_node, node)->key] = descent;
+}
+
+static int
+avl_keycmp_hinted(const void *key, avl_node_t *b)
+{
+	assert(hinted[node_of(b, struct int_node, node)->key] == descent);
+	return avl_keycmp(key, b);
+}
+
+static int
+avl_cmp_hinted(avl_node_t *a, avl_node_t *b)
+{
+	return avl_keycmp_hinted(&node_of(a, struct int_node, node)->key, b);
+}
+
+/*
+ * Every node a descent compares the key with has been handed to the prefetch
+ * routine before
+ */
+static void
+test_prefetch_hook(void)
+{
+	int i, key;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+
+	for (i = 0; i < COUNT; ++i) {
+		nodes[i].key = i * 37 % COUNT * 2;
+		++descent;
+		if (i % 2)
+			assert(avl_insert_prefetch(&root, &nodes[i].node,
+			    avl_cmp_hinted, hint_prefetch) == &nodes[i].node);
+		else
+			assert(avl_insert_key_prefetch(&root, &nodes[i].key,
+			    &nodes[i].node, avl_keycmp_hinted,
+			    hint_prefetch) == &nodes[i].node);
+	}
+	avl_check_root(&root);
+
+	for (key = -1; key < COUNT * 2 + 1; ++key) {
+		avl_node_t *node = avl_search_key(&root, &key, avl_keycmp);
+		struct int_node probe;
+
+		++descent;
+		assert(avl_search_key_prefetch(&root, &key, avl_keycmp_hinted,
+		    hint_prefetch) == node);
+		++descent;
+		probe.key = key;
+		assert(avl_search_prefetch(&root, &probe.node, avl_cmp_hinted,
+		    hint_prefetch) == node);
+	}
+	assert(avl_insert_prefetch(&root, &nodes[0].node, avl_cmp,
+	    NULL) == &nodes[0].node);
+
+	free(nodes);
+}
+
 int
 main()
 {
@@ -100,6 +1180,10 @@ main()
 		}
 	}
 
+	for (i = 0; i < COUNT; ++i)
+		assert(avl_search_key(&avlroot, &nodes[i].key, avl_keycmp) ==
+		    &nodes[i].node);
+
 	for (i = 0; i < COUNT; ++i) {
 		printf(" Deleting: %d\n", nodes[i].key);
 		avl_remove(&avlroot, &nodes[i].node);
@@ -110,5 +1194,29 @@ main()
 	}
 	
 	free(nodes);
+
+	test_key();
+	test_bound();
+	test_build();
+	test_batch();
+	test_split_join();
+	test_hint();
+	test_destroy();
+	test_relayout();
+	test_range();
+	test_cursor();
+	test_multi();
+	test_search_from();
+#ifdef AVL_AUGMENT
+	test_augment();
+#endif
+	test_search_many();
+	test_prefetch_hook();
+#ifdef AVL_ORDER_STATISTICS
+	test_order_statistics();
+#endif
+#ifdef AVL_STATS
+	test_stats();
+#endif
 	return 0;
 }
@@ -0,0 +1,297 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "avl_mmap.h"
+
+struct int_elem {
+	int key;
+	avl_idx_node_t node;
+};
+
+#define COUNT 10000
+
+static int
+int_cmp(const void *a, const void *b)
+{
+	const struct int_elem *a1 = a, *b1 = b;
+
+	if (a1->key < b1->key)
+		return -1;
+	else if (a1->key > b1->key)
+		return 1;
+	return 0;
+}
+
+static int
+int_keycmp(const void *key, const void *elem)
+{
+	int a1 = *(const int *)key;
+	const struct int_elem *b1 = elem;
+
+	if (a1 < b1->key)
+		return -1;
+	else if (a1 > b1->key)
+		return 1;
+	return 0;
+}
+
+static avl_mmap_t *
+mmap_open(const char *path, int flags)
+{
+	return avl_mmap_open(path, sizeof(struct int_elem),
+	    offsetof(struct int_elem, node), flags);
+}
+
+static avl_mmap_t *
+mmap_recover(const char *path)
+{
+	return avl_mmap_recover(path, sizeof(struct int_elem),
+	    offsetof(struct int_elem, node), int_cmp);
+}
+
+/*
+ * Check that the tree holds the multiples of 3 below COUNT, in order
+ */
+static void
+mmap_check(avl_mmap_t *map)
+{
+	int key, expected = 0;
+	avl_idx_t idx;
+	const avl_idx_base_t *base = avl_mmap_base(map);
+
+	for (idx = avl_idx_first(base, avl_mmap_root(map)); idx != AVL_IDX_NIL;
+	    idx = avl_idx_next(base, idx)) {
+		assert(((struct int_elem *)avl_idx_elem(base, idx))->key ==
+		    expected);
+		expected += 3;
+	}
+	assert(expected == (COUNT + 2) / 3 * 3);
+	for (key = 0; key < COUNT; ++key) {
+		idx = avl_idx_search_key(base, avl_mmap_root(map), &key,
+		    int_keycmp);
+		assert((idx != AVL_IDX_NIL) == !(key % 3));
+	}
+}
+
+/*
+ * Replace the element with key 0 by a new one, and hand out an element with
+ * key 1 which is never inserted
+ */
+static void
+crash_ops(avl_mmap_t *map)
+{
+	int key = 0;
+	avl_idx_t idx;
+	const avl_idx_base_t *base;
+
+	idx = avl_idx_search_key(avl_mmap_base(map), avl_mmap_root(map), &key,
+	    int_keycmp);
+	assert(!avl_mmap_remove(map, idx));
+	assert(!avl_mmap_free(map, idx));
+	idx = avl_mmap_alloc(map);
+	base = avl_mmap_base(map);
+	((struct int_elem *)avl_idx_elem(base, idx))->key = 0;
+	assert(avl_mmap_insert(map, idx, int_cmp) == idx);
+	idx = avl_mmap_alloc(map);
+	((struct int_elem *)avl_idx_elem(avl_mmap_base(map), idx))->key = 1;
+}
+
+/*
+ * Cut the left subtree of the root off, as a rotation cut short would
+ */
+static void
+crash_rotation(avl_mmap_t *map)
+{
+	assert(!avl_mmap_dirty(map));
+	avl_idx_node(avl_mmap_base(map),
+	    avl_mmap_root(map)->avl_root)->avl_children[0] = AVL_IDX_NIL;
+}
+
+/*
+ * Run @fn on the tree in the file at @path in a process which then dies
+ * without a checkpoint
+ */
+static void
+crash(const char *path, void (*fn)(avl_mmap_t *))
+{
+	int status;
+	pid_t pid = fork();
+
+	if (!pid) {
+		avl_mmap_t *map = mmap_open(path, 0);
+
+		assert(map);
+		fn(map);
+		_exit(0);
+	}
+	assert(pid > 0 && waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && !WEXITSTATUS(status));
+}
+
+/*
+ * Flip a byte of the file at @offset
+ */
+static void
+corrupt(const char *path, off_t offset)
+{
+	char c;
+	int fd = open(path, O_RDWR);
+
+	assert(fd >= 0);
+	assert(pread(fd, &c, 1, offset) == 1);
+	c ^= 1;
+	assert(pwrite(fd, &c, 1, offset) == 1);
+	close(fd);
+}
+
+int
+main(void)
+{
+	int i;
+	char path[64];
+	avl_mmap_t *map;
+	avl_idx_t idx, freed = AVL_IDX_NIL;
+
+	snprintf(path, sizeof(path), "/tmp/test-mmap.%d", (int)getpid());
+	unlink(path);
+	assert(!mmap_open(path, 0) && errno == ENOENT);
+
+	/* Fill a new file past its initial size, then remove all keys but
+	 * the multiples of 3 */
+	map = mmap_open(path, AVL_MMAP_CREATE | AVL_MMAP_CHECKSUM);
+	assert(map);
+	for (i = 0; i < COUNT; ++i) {
+		struct int_elem *elem;
+
+		idx = avl_mmap_alloc(map);
+		assert(idx != AVL_IDX_NIL);
+		elem = avl_idx_elem(avl_mmap_base(map), idx);
+		elem->key = i;
+		assert(avl_mmap_insert(map, idx, int_cmp) == idx);
+	}
+	for (i = 0; i < COUNT; ++i) {
+		if (!(i % 3))
+			continue;
+		idx = avl_idx_search_key(avl_mmap_base(map),
+		    avl_mmap_root(map), &i, int_keycmp);
+		assert(!avl_mmap_remove(map, idx));
+		assert(!avl_mmap_free(map, idx));
+		freed = idx;
+	}
+	/* Freed elements are handed out again */
+	idx = avl_mmap_alloc(map);
+	assert(idx == freed);
+	assert(!avl_mmap_free(map, idx));
+	mmap_check(map);
+	assert(!avl_mmap_sync(map));
+	assert(!avl_mmap_close(map));
+
+	/* The tree is there right after opening the file again */
+	map = mmap_open(path, 0);
+	assert(map);
+	mmap_check(map);
+
+	/* The layout of the elements must be the same */
+	assert(!avl_mmap_open(path, sizeof(struct int_elem) + 4,
+	    offsetof(struct int_elem, node), 0) && errno == EINVAL);
+
+	/* Closing the file makes a checkpoint */
+	idx = avl_mmap_alloc(map);
+	assert(idx != AVL_IDX_NIL);
+	assert(!avl_mmap_close(map));
+	map = mmap_open(path, 0);
+	assert(map);
+	assert(!avl_mmap_free(map, idx));
+	mmap_check(map);
+	assert(!avl_mmap_close(map));
+
+	/* A file changed after its last checkpoint is refused, but can be
+	 * recovered as the process left it */
+	crash(path, crash_ops);
+	assert(!mmap_open(path, 0) && errno == EIO);
+	assert(!mmap_open(path, AVL_MMAP_CREATE) && errno == EIO);
+	map = mmap_recover(path);
+	assert(map);
+	mmap_check(map);
+	assert(!avl_mmap_close(map));
+
+	/* A tree broken in the middle of a change is built again */
+	crash(path, crash_rotation);
+	assert(!mmap_open(path, 0) && errno == EIO);
+	map = mmap_recover(path);
+	assert(map);
+	mmap_check(map);
+	assert(!avl_mmap_close(map));
+	map = mmap_open(path, 0);
+	assert(map);
+	mmap_check(map);
+	assert(!avl_mmap_close(map));
+
+	/* A checkpoint also covers changes made in place */
+	unlink(path);
+	map = mmap_open(path, AVL_MMAP_CREATE | AVL_MMAP_CHECKSUM);
+	assert(map);
+	idx = avl_mmap_alloc(map);
+	((struct int_elem *)avl_idx_elem(avl_mmap_base(map), idx))->key = 1;
+	assert(avl_mmap_insert(map, idx, int_cmp) == idx);
+	assert(!avl_mmap_sync(map));
+	assert(!avl_mmap_dirty(map));
+	((struct int_elem *)avl_idx_elem(avl_mmap_base(map), idx))->key = 2;
+	assert(!avl_mmap_sync(map));
+	assert(!avl_mmap_close(map));
+	map = mmap_open(path, 0);
+	assert(map);
+	i = 2;
+	assert(avl_idx_search_key(avl_mmap_base(map), avl_mmap_root(map), &i,
+	    int_keycmp) == idx);
+	assert(!avl_mmap_close(map));
+
+	/* Corruption of the first element, which starts on the second page,
+	 * or of the header is detected */
+	corrupt(path, 4096);
+	assert(!mmap_open(path, 0) && errno == EIO);
+	corrupt(path, 4096);
+	assert((map = mmap_open(path, 0)));
+	assert(!avl_mmap_close(map));
+	corrupt(path, 40);
+	assert(!mmap_open(path, 0) && errno == EINVAL);
+
+	unlink(path);
+	printf("test-mmap: ok\n");
+	return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "avl_np.h"
+
+#define node_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct int_node {
+	int key;
+	avl_np_node_t node;
+};
+
+#define COUNT 1000
+
+static int
+int_keycmp(const void *key, avl_np_node_t *b)
+{
+	int a1 = *(const int *)key;
+	int b1 = node_of(b, struct int_node, node)->key;
+
+	if (a1 < b1)
+		return -1;
+	else if (a1 > b1)
+		return 1;
+	return 0;
+}
+
+static int
+int_cmp(avl_np_node_t *a, avl_np_node_t *b)
+{
+	return int_keycmp(&node_of(a, struct int_node, node)->key, b);
+}
+
+static int
+np_check(avl_np_node_t *node, size_t *count)
+{
+	int lheight = 0, rheight = 0;
+
+	if (!node)
+		return 0;
+	lheight = np_check(node->avl_children[0], count);
+	rheight = np_check(node->avl_children[1], count);
+	assert(rheight - lheight == node->avl_balance);
+	assert(rheight - lheight >= -1 && rheight - lheight <= 1);
+	++*count;
+
+	return 1 + (rheight < lheight ? lheight : rheight);
+}
+
+/*
+ * Check the shape of the tree, and walk it with a cursor in both directions
+ */
+static void
+np_check_root(avl_np_root_t *root, size_t n)
+{
+	size_t count = 0;
+	avl_np_cursor_t cursor;
+	avl_np_node_t *node, *prev = NULL;
+
+	np_check(root->avl_root, &count);
+	assert(count == n);
+
+	count = 0;
+	for (node = avl_np_first(root, &cursor); node;
+	    node = avl_np_next(&cursor)) {
+		if (prev)
+			assert(int_cmp(prev, node) < 0);
+		prev = node;
+		++count;
+	}
+	assert(count == n);
+	assert(!avl_np_cursor_node(&cursor));
+
+	prev = NULL;
+	for (node = avl_np_last(root, &cursor); node;
+	    node = avl_np_prev(&cursor)) {
+		if (prev)
+			assert(int_cmp(prev, node) > 0);
+		prev = node;
+		--count;
+	}
+	assert(!count);
+}
+
+int
+main(void)
+{
+	int i, key;
+	avl_np_root_t root = { NULL };
+	avl_np_cursor_t cursor;
+	struct int_node *nodes = malloc(sizeof(struct int_node) * COUNT);
+	struct int_node dup;
+
+	for (i = 0; i < COUNT; ++i) {
+		/* Insert the even keys in a scrambled order */
+		nodes[i].key = (i * 37 % COUNT) * 2;
+		assert(avl_np_insert(&root, &nodes[i].node, int_cmp) ==
+		    &nodes[i].node);
+		if (!(i % 100))
+			np_check_root(&root, i + 1);
+	}
+	np_check_root(&root, COUNT);
+
+	dup.key = nodes[0].key;
+	assert(avl_np_insert(&root, &dup.node, int_cmp) == &nodes[0].node);
+
+	for (key = -1; key <= COUNT * 2; ++key) {
+		avl_np_node_t *ptr = avl_np_search_key(&root, &key, int_keycmp);
+		avl_np_node_t *lb = avl_np_seek(&root, &cursor, &key,
+		    int_keycmp);
+
+		if (key < 0 || key >= COUNT * 2 || key % 2)
+			assert(!ptr);
+		else
+			assert(ptr &&
+			    node_of(ptr, struct int_node, node)->key == key);
+		if (key >= COUNT * 2 - 1) {
+			assert(!lb);
+			continue;
+		}
+		assert(lb && node_of(lb, struct int_node, node)->key ==
+		    (key < 0 ? 0 : key + (key & 1)));
+
+		/* The cursor can step from the bound in both directions */
+		ptr = avl_np_next(&cursor);
+		if (ptr)
+			assert(node_of(ptr, struct int_node, node)->key ==
+			    node_of(lb, struct int_node, node)->key + 2);
+		if (ptr)
+			assert(avl_np_prev(&cursor) == lb);
+	}
+
+	for (i = 0; i < COUNT; ++i) {
+		/* Remove in a different order than the insertion */
+		struct int_node *n = &nodes[i * 7 % COUNT];
+
+		assert(avl_np_remove(&root, &n->node, int_cmp) == &n->node);
+		assert(!avl_np_remove_key(&root, &n->key, int_keycmp));
+		if (!(i % 50))
+			np_check_root(&root, COUNT - i - 1);
+	}
+	assert(!root.avl_root);
+
+	free(nodes);
+	printf("test-np: ok\n");
+	return 0;
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "avl_pool.h"
+
+#define node_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct int_node {
+	int key;
+	avl_node_t node;
+	char payload[20];
+};
+
+#define COUNT 20000
+
+/* Smallest slab, see avl_pool.c */
+#define SLAB (64 * 1024)
+
+static int
+int_cmp(avl_node_t *a, avl_node_t *b)
+{
+	int a1 = node_of(a, struct int_node, node)->key;
+	int b1 = node_of(b, struct int_node, node)->key;
+
+	if (a1 < b1)
+		return -1;
+	else if (a1 > b1)
+		return 1;
+	return 0;
+}
+
+static int
+same_slab(const void *a, const void *b)
+{
+	return ((uintptr_t)a & ~(uintptr_t)(SLAB - 1)) ==
+	    ((uintptr_t)b & ~(uintptr_t)(SLAB - 1));
+}
+
+/*
+ * Insert @key, allocating its node next to its neighbour in the tree
+ */
+static struct int_node *
+insert(avl_root_t *root, avl_pool_t *pool, int key)
+{
+	struct int_node k, *n;
+	avl_node_t *hint;
+
+	k.key = key;
+	hint = avl_floor(root, &k.node, int_cmp);
+	n = avl_pool_alloc_near(pool,
+	    hint ? node_of(hint, struct int_node, node) : NULL);
+	assert(n);
+	assert(((uintptr_t)n & 15) == 0);
+	n->key = key;
+	assert(avl_insert(root, &n->node, int_cmp) == &n->node);
+	return n;
+}
+
+static void
+test_args(void)
+{
+	errno = 0;
+	assert(!avl_pool_create(sizeof(avl_node_t) - 1, 0, -1));
+	assert(errno == EINVAL);
+	assert(!avl_pool_create(sizeof(struct int_node),
+	    sizeof(struct int_node), -1));
+	assert(!avl_pool_create(sizeof(struct int_node), 0, 1 << 20));
+}
+
+static void
+test_near(void)
+{
+	avl_pool_t *pool = avl_pool_create(sizeof(struct int_node),
+	    offsetof(struct int_node, node), -1);
+	void *objs[4 * SLAB / sizeof(struct int_node)];
+	void *a, *b;
+	size_t i, n = sizeof(objs) / sizeof(objs[0]);
+
+	assert(pool);
+	for (i = 0; i < n; i++)
+		objs[i] = avl_pool_alloc(pool);
+
+	/* Free an object in the first slab, the hint gets it back */
+	a = objs[0];
+	avl_pool_free(pool, objs[1]);
+	b = avl_pool_alloc_near(pool, a);
+	assert(b == objs[1]);
+
+	/* A full slab falls back to the others */
+	for (i = 2; i < n; i += 64)
+		if (!same_slab(objs[i], a))
+			break;
+	assert(i < n);
+	avl_pool_free(pool, objs[i]);
+	b = avl_pool_alloc_near(pool, a);
+	assert(b == objs[i]);
+
+	for (i = 0; i < n; i++)
+		avl_pool_free(pool, objs[i]);
+	assert(avl_pool_used(pool) == 0);
+	avl_pool_destroy(pool);
+}
+
+/*
+ * A pool sitting on a slab boundary reuses its empty slab instead of mapping
+ * a new one on every allocation
+ */
+static void
+test_boundary(void)
+{
+	avl_pool_t *pool = avl_pool_create(sizeof(struct int_node),
+	    offsetof(struct int_node, node), -1);
+	void *objs[2 * SLAB / sizeof(struct int_node)];
+	void *obj, *extra;
+	size_t i, n;
+
+	assert(pool);
+	/* Fill the first slab exactly */
+	for (n = 0; ; n++) {
+		obj = avl_pool_alloc(pool);
+		assert(obj && n < sizeof(objs) / sizeof(objs[0]));
+		if (avl_pool_slabs(pool) == 2)
+			break;
+		objs[n] = obj;
+	}
+	assert(n > 0 && avl_pool_slabs(pool) == 2);
+
+	for (i = 0; i < 1000; i++) {
+		avl_pool_free(pool, obj);
+		assert(avl_pool_slabs(pool) == 2);
+		obj = avl_pool_alloc(pool);
+		assert(obj);
+		assert(avl_pool_slabs(pool) == 2);
+	}
+
+	/* A second empty slab is given back, the first one is kept */
+	objs[n] = obj;
+	for (i = 1; i < n; i++)
+		assert((objs[n + i] = avl_pool_alloc(pool)));
+	extra = avl_pool_alloc(pool);
+	assert(extra && avl_pool_slabs(pool) == 3);
+	avl_pool_free(pool, extra);
+	assert(avl_pool_slabs(pool) == 3);
+	for (i = 0; i < n; i++)
+		avl_pool_free(pool, objs[n + i]);
+	assert(avl_pool_slabs(pool) == 2);
+	assert(avl_pool_alloc(pool) == extra);
+	assert(avl_pool_slabs(pool) == 2);
+	avl_pool_destroy(pool);
+}
+
+static void
+test_tree(int numa_node)
+{
+	avl_root_t root = { NULL };
+	avl_pool_t *pool = avl_pool_create(sizeof(struct int_node),
+	    offsetof(struct int_node, node), numa_node);
+	avl_node_t *node, *next;
+	unsigned seed = 1;
+	size_t total = 0;
+	int i, key;
+
+	assert(pool);
+	for (i = 0; i < COUNT; i++) {
+		seed = seed * 1103515245 + 12345;
+		key = (seed >> 8) % (4 * COUNT);
+		if (avl_search(&root, &(struct int_node){ .key = key }.node,
+		    int_cmp))
+			continue;
+		insert(&root, pool, key);
+	}
+	for (node = avl_first(&root); node; node = avl_next(node))
+		total++;
+	assert(avl_pool_used(pool) == total);
+
+	/* Remove every other node and insert them again */
+	i = 0;
+	for (node = avl_first(&root); node; node = next) {
+		next = avl_next(node);
+		if (i++ & 1) {
+			key = node_of(node, struct int_node, node)->key;
+			avl_remove(&root, node);
+			avl_pool_free(pool, node_of(node, struct int_node,
+			    node));
+			insert(&root, pool, key);
+		}
+	}
+	assert(avl_pool_used(pool) == total);
+
+	avl_destroy(&root, avl_pool_release, pool);
+	assert(!root.avl_root);
+	assert(avl_pool_used(pool) == 0);
+
+	/* Destroying the pool releases whatever is still allocated */
+	for (i = 0; i < COUNT; i++)
+		assert(avl_pool_alloc(pool));
+	avl_pool_destroy(pool);
+}
+
+int
+main(void)
+{
+	test_args();
+	test_near();
+	test_boundary();
+	test_tree(-1);
+	test_tree(0);
+	printf("test-pool: ok\n");
+	return 0;
+}
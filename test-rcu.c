@@ -0,0 +1,227 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "avl_rcu.h"
+
+#define node_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct int_node {
+	int key;
+	avl_node_t node;
+	struct int_node *next;
+};
+
+/* Keys in [0, KEYS), the even ones stay in the tree all along */
+#define KEYS 2000
+#define READERS 3
+#define LOOKUPS 20000
+#define BATCH 8
+
+static avl_rcu_root_t rcu_root;
+static int running = READERS;
+
+static int
+int_keycmp(const void *key, avl_node_t *b)
+{
+	int a1 = *(const int *)key;
+	int b1 = node_of(b, struct int_node, node)->key;
+
+	if (a1 < b1)
+		return -1;
+	else if (a1 > b1)
+		return 1;
+	return 0;
+}
+
+static int
+int_cmp(avl_node_t *a, avl_node_t *b)
+{
+	return int_keycmp(&node_of(a, struct int_node, node)->key, b);
+}
+
+static int
+key_of(avl_node_t *node)
+{
+	assert(node);
+	return node_of(node, struct int_node, node)->key;
+}
+
+/*
+ * The removed nodes are kept until the readers are done, which stands in for
+ * the grace period
+ */
+static void
+defer_node(avl_node_t *node, void *arg)
+{
+	struct int_node *n = node_of(node, struct int_node, node);
+
+	n->next = *(struct int_node **)arg;
+	*(struct int_node **)arg = n;
+}
+
+/*
+ * The readers do a fixed amount of work while the writer keeps writing at
+ * full speed until they are done, so this hangs should a reader starve
+ */
+static void *
+reader(void *arg)
+{
+	unsigned seed = (unsigned)(size_t)arg;
+	int i, j;
+
+	for (i = 0; i < LOOKUPS; ++i) {
+		int key = rand_r(&seed) % KEYS, keys[BATCH];
+		const void *keyp[BATCH];
+		avl_node_t *node, *out[BATCH];
+		struct int_node probe;
+
+		/* A plain lookup terminates and is right when it finds */
+		node = avl_search_key(&rcu_root.avl_tree, &key, int_keycmp);
+		if (node)
+			assert(key_of(node) == key);
+
+		node = avl_rcu_search_key(&rcu_root, &key, int_keycmp);
+		if (!(key % 2))
+			assert(key_of(node) == key);
+		probe.key = key;
+		node = avl_rcu_search(&rcu_root, &probe.node, int_cmp);
+		if (!(key % 2))
+			assert(key_of(node) == key);
+
+		for (j = 0; j < BATCH; ++j) {
+			keys[j] = (key + j * 2) % KEYS;
+			keyp[j] = &keys[j];
+		}
+		avl_rcu_search_many(&rcu_root, keyp, BATCH, int_keycmp, NULL,
+		    out);
+		for (j = 0; j < BATCH; ++j) {
+			if (out[j])
+				assert(key_of(out[j]) == keys[j]);
+			else
+				assert(keys[j] % 2);
+		}
+
+		/* The closest even key is always there, the odd one may be */
+		key |= 1;
+		probe.key = key;
+		if (key < KEYS - 1) {
+			node = avl_rcu_lower_bound_key(&rcu_root, &key,
+			    int_keycmp);
+			assert(key_of(node) >= key && key_of(node) <= key + 1);
+			node = avl_rcu_ceil(&rcu_root, &probe.node, int_cmp);
+			assert(key_of(node) >= key && key_of(node) <= key + 1);
+			node = avl_rcu_upper_bound_key(&rcu_root, &key,
+			    int_keycmp);
+			assert(key_of(node) == key + 1);
+			node = avl_rcu_upper_bound(&rcu_root, &probe.node,
+			    int_cmp);
+			assert(key_of(node) == key + 1);
+		}
+		node = avl_rcu_floor_key(&rcu_root, &key, int_keycmp);
+		assert(key_of(node) >= key - 1 && key_of(node) <= key);
+		node = avl_rcu_floor(&rcu_root, &probe.node, int_cmp);
+		assert(key_of(node) >= key - 1 && key_of(node) <= key);
+		node = avl_rcu_lower_bound(&rcu_root, &probe.node, int_cmp);
+		assert(!node || (key_of(node) >= key &&
+		    key_of(node) <= key + 1));
+		node = avl_rcu_ceil_key(&rcu_root, &key, int_keycmp);
+		assert(!node || (key_of(node) >= key &&
+		    key_of(node) <= key + 1));
+	}
+	__atomic_fetch_sub(&running, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+int
+main(void)
+{
+	int i;
+	pthread_t threads[READERS];
+	struct int_node *evens = malloc(sizeof(struct int_node) * KEYS / 2);
+	struct int_node *odd[KEYS / 2] = { NULL }, *deferred = NULL, *n;
+	size_t inserted = 0, live = 0, removed = 0;
+
+	for (i = 0; i < KEYS / 2; ++i) {
+		evens[i].key = i * 2;
+		avl_rcu_insert(&rcu_root, &evens[i].node, int_cmp);
+	}
+	for (i = 0; i < READERS; ++i)
+		assert(!pthread_create(&threads[i], NULL, reader,
+		    (void *)(size_t)(i + 1)));
+
+	/* Insert and remove the odd keys, every insertion using a new node */
+	srand(1);
+	while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+		int slot = rand() % (KEYS / 2);
+
+		if (odd[slot]) {
+			avl_rcu_remove(&rcu_root, &odd[slot]->node, defer_node,
+			    &deferred);
+			odd[slot] = NULL;
+		} else {
+			odd[slot] = malloc(sizeof(struct int_node));
+			odd[slot]->key = slot * 2 + 1;
+			assert(avl_rcu_insert(&rcu_root, &odd[slot]->node,
+			    int_cmp) == &odd[slot]->node);
+			++inserted;
+		}
+	}
+	for (i = 0; i < READERS; ++i)
+		assert(!pthread_join(threads[i], NULL));
+	assert(!rcu_root.avl_waiters && !(rcu_root.avl_seq & 1));
+
+	/* Every removed node went through the deferred free */
+	for (i = 0; i < KEYS / 2; ++i)
+		live += odd[i] != NULL;
+	while ((n = deferred)) {
+		deferred = n->next;
+		free(n);
+		++removed;
+	}
+	assert(inserted == live + removed);
+
+	for (i = 0; i < KEYS; ++i) {
+		avl_node_t *node = avl_search_key(&rcu_root.avl_tree, &i,
+		    int_keycmp);
+
+		assert(!(i % 2) || !node == !odd[i / 2]);
+		assert(i % 2 || node == &evens[i / 2].node);
+	}
+
+	for (i = 0; i < KEYS / 2; ++i)
+		free(odd[i]);
+	free(evens);
+	printf("test-rcu: ok\n");
+	return 0;
+}
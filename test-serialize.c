@@ -0,0 +1,249 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "avl_serialize.h"
+
+#define node_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct int_node {
+	int key;
+	avl_node_t node;
+};
+
+#define COUNT 10000
+#define RECSIZE 4
+
+/*
+ * Serialized bytes, written to and read from memory
+ */
+struct stream {
+	unsigned char *buf;
+	size_t len, pos;
+	int live;				/* Nodes decoded and not yet released */
+};
+
+static int
+int_cmp(avl_node_t *a, avl_node_t *b)
+{
+	int a1 = node_of(a, struct int_node, node)->key;
+	int b1 = node_of(b, struct int_node, node)->key;
+
+	if (a1 < b1)
+		return -1;
+	else if (a1 > b1)
+		return 1;
+	return 0;
+}
+
+static void
+int_encode(avl_node_t *node, void *rec, void *arg)
+{
+	unsigned key = node_of(node, struct int_node, node)->key;
+	unsigned char *p = rec;
+
+	(void)arg;
+	p[0] = key;
+	p[1] = key >> 8;
+	p[2] = key >> 16;
+	p[3] = key >> 24;
+}
+
+static avl_node_t *
+int_decode(const void *rec, void *arg)
+{
+	const unsigned char *p = rec;
+	struct stream *s = arg;
+	struct int_node *n = malloc(sizeof(*n));
+
+	n->key = p[0] | p[1] << 8 | p[2] << 16 | (unsigned)p[3] << 24;
+	++s->live;
+	return &n->node;
+}
+
+static void
+int_release(avl_node_t *node, void *arg)
+{
+	struct stream *s = arg;
+
+	free(node_of(node, struct int_node, node));
+	--s->live;
+}
+
+static int
+stream_write(const void *buf, size_t len, void *arg)
+{
+	struct stream *s = arg;
+
+	s->buf = realloc(s->buf, s->len + len);
+	memcpy(s->buf + s->len, buf, len);
+	s->len += len;
+	return 0;
+}
+
+static int
+stream_read(void *buf, size_t len, void *arg)
+{
+	struct stream *s = arg;
+
+	if (len > s->len - s->pos)
+		return -1;
+	memcpy(buf, s->buf + s->pos, len);
+	s->pos += len;
+	return 0;
+}
+
+/*
+ * Check the balance of a tree holding the keys 0, 2, ..., 2 * (n - 1)
+ */
+static int
+tree_height(avl_node_t *node)
+{
+	int lheight, rheight;
+
+	if (!node)
+		return 0;
+	if (node->avl_children[0])
+		assert(avl_get_parent(node->avl_children[0]) == node);
+	if (node->avl_children[1])
+		assert(avl_get_parent(node->avl_children[1]) == node);
+	lheight = tree_height(node->avl_children[0]);
+	rheight = tree_height(node->avl_children[1]);
+	assert(rheight - lheight == avl_get_balance(node));
+	assert(avl_abs_balance(rheight - lheight) <= 1);
+	return 1 + (rheight < lheight ? lheight : rheight);
+}
+
+static void
+tree_check(avl_root_t *root, int n)
+{
+	int key = 0;
+	avl_node_t *node;
+
+	if (root->avl_root)
+		assert(!avl_get_parent(root->avl_root));
+	tree_height(root->avl_root);
+	for (node = avl_first(root); node; node = avl_next(node)) {
+		assert(node_of(node, struct int_node, node)->key == key);
+		key += 2;
+	}
+	assert(key == 2 * n);
+}
+
+static void
+serialize(int n, struct stream *s)
+{
+	int i;
+	avl_root_t root = { NULL };
+	struct int_node *nodes = calloc(n ? n : 1, sizeof(*nodes));
+
+	for (i = 0; i < n; ++i) {
+		nodes[i].key = 2 * i;
+		avl_insert(&root, &nodes[i].node, int_cmp);
+	}
+	memset(s, 0, sizeof(*s));
+	assert(!avl_serialize(&root, RECSIZE, int_encode, stream_write, s));
+	assert(s->len == AVL_SERIALIZE_HEADER + (size_t)n * RECSIZE);
+	free(nodes);
+}
+
+int
+main(void)
+{
+	int n, ret;
+	size_t pos;
+	unsigned seed = 1;
+	struct stream s;
+	avl_root_t root = { NULL };
+	avl_deserializer_t *d;
+
+	/* Round trips through the pull interface */
+	for (n = 0; n <= COUNT; n = n ? n * 10 : 1) {
+		serialize(n, &s);
+		assert(!avl_deserialize(&root, RECSIZE, int_decode, int_cmp,
+		    stream_read, int_release, &s));
+		assert(s.pos == s.len && s.live == n);
+		tree_check(&root, n);
+		avl_destroy(&root, int_release, &s);
+		assert(!s.live);
+		free(s.buf);
+	}
+
+	/* Chunks of any size, with records split across them */
+	serialize(COUNT, &s);
+	d = avl_deserialize_begin(&root, RECSIZE, int_decode, NULL, &s);
+	for (pos = 0; pos < s.len; ) {
+		size_t len = 1 + rand_r(&seed) % 37;
+
+		if (len > s.len - pos)
+			len = s.len - pos;
+		assert(avl_deserialize_need(d) >= (pos < AVL_SERIALIZE_HEADER ?
+		    AVL_SERIALIZE_HEADER - pos : s.len - pos));
+		ret = avl_deserialize_feed(d, s.buf + pos, len);
+		pos += len;
+		assert(ret == (pos == s.len));
+	}
+	assert(!avl_deserialize_need(d));
+	/* Going past the end leaves the tree alone */
+	assert(avl_deserialize_feed(d, s.buf, 1) == -1 && errno == EINVAL);
+	assert(!avl_deserialize_end(d, int_release, &s));
+	tree_check(&root, COUNT);
+	avl_destroy(&root, int_release, &s);
+
+	/* A truncated input gives back the nodes decoded so far */
+	d = avl_deserialize_begin(&root, RECSIZE, int_decode, NULL, &s);
+	assert(!avl_deserialize_feed(d, s.buf, s.len / 2 + 1));
+	assert(s.live > 0);
+	assert(avl_deserialize_end(d, int_release, &s) == -1);
+	assert(!root.avl_root && !s.live);
+
+	/* Keys out of order are caught with a comparison routine */
+	memcpy(s.buf + AVL_SERIALIZE_HEADER + 100 * RECSIZE,
+	    s.buf + AVL_SERIALIZE_HEADER + 99 * RECSIZE, RECSIZE);
+	s.pos = 0;
+	assert(avl_deserialize(&root, RECSIZE, int_decode, int_cmp,
+	    stream_read, int_release, &s) == -1 && errno == EINVAL);
+	assert(!root.avl_root && !s.live);
+
+	/* Records of another size are refused */
+	s.pos = 0;
+	assert(avl_deserialize(&root, RECSIZE * 2, int_decode, NULL,
+	    stream_read, int_release, &s) == -1 && errno == EINVAL);
+	assert(!s.live);
+	free(s.buf);
+
+	printf("test-serialize: ok\n");
+	return 0;
+}
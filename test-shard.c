@@ -0,0 +1,164 @@
+/*
+ * Copyright 2017 Ka Ho Ng <khng300@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "avl_shard.h"
+
+#define node_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct int_node {
+	int key;
+	avl_node_t node;
+};
+
+#define THREADS 4
+#define SHARDS 8
+#define KEYS_PER_THREAD 2000
+#define KEYS (THREADS * KEYS_PER_THREAD)
+
+static avl_shard_root_t shard_root;
+static struct int_node nodes[KEYS];
+
+static int
+int_keycmp(const void *key, avl_node_t *b)
+{
+	int a1 = *(const int *)key;
+	int b1 = node_of(b, struct int_node, node)->key;
+
+	if (a1 < b1)
+		return -1;
+	else if (a1 > b1)
+		return 1;
+	return 0;
+}
+
+static int
+int_cmp(avl_node_t *a, avl_node_t *b)
+{
+	return int_keycmp(&node_of(a, struct int_node, node)->key, b);
+}
+
+static size_t
+hash_route(const void *key, void *arg)
+{
+	(void)arg;
+	return (unsigned)*(const int *)key * 2654435761u;
+}
+
+static size_t
+range_route(const void *key, void *arg)
+{
+	(void)arg;
+	return *(const int *)key / (KEYS / SHARDS);
+}
+
+/*
+ * Every thread inserts the keys equal to its number modulo THREADS, then
+ * removes the odd ones
+ */
+static void *
+worker(void *arg)
+{
+	int i, id = (int)(size_t)arg;
+
+	for (i = id; i < KEYS; i += THREADS) {
+		nodes[i].key = i;
+		assert(avl_shard_insert(&shard_root, &i, &nodes[i].node) ==
+		    &nodes[i].node);
+	}
+	for (i = id; i < KEYS; i += THREADS) {
+		assert(avl_shard_search(&shard_root, &i) == &nodes[i].node);
+		assert(avl_shard_insert(&shard_root, &i, &nodes[0].node) ==
+		    &nodes[i].node);
+		if (i & 1)
+			assert(avl_shard_remove(&shard_root, &i) ==
+			    &nodes[i].node);
+	}
+	return NULL;
+}
+
+static void
+shard_test(avl_shard_route_t *route)
+{
+	int i, key, expected = 0;
+	size_t s;
+	pthread_t threads[THREADS];
+	avl_shard_iter_t iter;
+	avl_node_t *node;
+
+	assert(!avl_shard_init(&shard_root, SHARDS, route, int_cmp,
+	    int_keycmp, NULL));
+	for (i = 0; i < THREADS; ++i)
+		assert(!pthread_create(&threads[i], NULL, worker,
+		    (void *)(size_t)i));
+	for (i = 0; i < THREADS; ++i)
+		assert(!pthread_join(threads[i], NULL));
+
+	/* Every shard only holds the keys routed to it */
+	for (s = 0; s < SHARDS; ++s) {
+		avl_root_t *tree = &shard_root.avl_shards[s].avl_tree;
+
+		for (node = avl_first(tree); node; node = avl_next(node)) {
+			key = node_of(node, struct int_node, node)->key;
+			assert(avl_shard_of(&shard_root, &key) ==
+			    &shard_root.avl_shards[s]);
+		}
+	}
+
+	/* The merged view is the even keys in order */
+	assert(!avl_shard_iter_begin(&shard_root, &iter));
+	while ((node = avl_shard_iter_next(&iter))) {
+		assert(node_of(node, struct int_node, node)->key == expected);
+		expected += 2;
+	}
+	assert(expected == KEYS);
+	assert(!avl_shard_iter_next(&iter));
+	avl_shard_iter_end(&iter);
+
+	key = 1;
+	assert(!avl_shard_search(&shard_root, &key));
+	assert(!avl_shard_remove(&shard_root, &key));
+	avl_shard_free(&shard_root, NULL, NULL);
+}
+
+int
+main(void)
+{
+	assert(sizeof(avl_shard_t) % AVL_SHARD_ALIGN == 0);
+	shard_test(hash_route);
+	shard_test(range_route);
+
+	printf("test-shard: ok\n");
+	return 0;
+}